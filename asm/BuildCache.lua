@@ -0,0 +1,71 @@
+local Validate = require("Validate")
+
+local SourceFile = require("SourceFile")
+local ObjectFile = require("ObjectFile")
+
+-- Gives the object of each source file, assembling it at most once a run.
+-- Given a directory, objects are also kept there from run to run, under a
+-- key hashed from the file's name and contents and from the assembler's
+-- own sources, so that a file is only assembled again once it has changed.
+-- With optimize set, objects are assembled through the optimizer, and kept
+-- apart from the others.
+local BuildCache = {
+	directory = nil,
+	optimize = nil,
+	assemblerKey = nil,
+	objects = nil
+}
+
+local assemblerModules = {"Instruction", "ObjectFile", "Optimizer", "SourceFile", "SourceLine"}
+
+-- 64-bit FNV-1a, carrying on from hash if given
+local function Hash(str, hash)
+	hash = hash or 0xcbf29ce484222325
+	for i = 1, #str do
+		hash = (hash ~ str:byte(i)) * 0x100000001b3
+	end
+	return hash
+end
+
+local function ReadFile(filename)
+	local inFile = io.open(filename, "rb") or error("Failed to open "..filename)
+	local contents = inFile:read("a")
+	inFile:close()
+	return contents
+end
+
+function BuildCache:New(obj)
+	Validate(obj, {})
+	self.__index = self
+	setmetatable(obj, self)
+	obj.assemblerKey = Hash(tostring(ObjectFile.formatVersion) .. (obj.optimize and " optimize" or ""))
+	for _, module in ipairs(assemblerModules) do
+		local filename = package.searchpath(module, package.path)
+		obj.assemblerKey = Hash(ReadFile(filename), obj.assemblerKey)
+	end
+	obj.objects = {}
+	return obj
+end
+
+function BuildCache:Object(filename)
+	if self.objects[filename] then
+		return self.objects[filename]
+	end
+	local key = Hash(filename .. "\0", self.assemblerKey)
+	key = string.format("%016x", Hash(ReadFile(filename), key))
+	local cachedFile = self.directory and self.directory .. "/" .. filename:gsub("/", "_") .. (self.optimize and ".opt.lvo" or ".lvo")
+	local obj = cachedFile and ObjectFile:Read(cachedFile, key)
+	if not obj then
+		obj = ObjectFile:New{
+			sourceFile = SourceFile:New{rootFilename = filename},
+			optimize = self.optimize
+		}
+		if cachedFile then
+			obj:Write(cachedFile, key)
+		end
+	end
+	self.objects[filename] = obj
+	return obj
+end
+
+return BuildCache
@@ -0,0 +1,416 @@
+local Validate = require("Validate")
+
+-- Links a program from the object of its root source file and the objects
+-- of the files it includes. Sections are placed in the order they stand in
+-- the source, each included object's where its .include line is, as though
+-- the files had been spliced together: at their .org, or else straight
+-- after the section placed before them. Label references are then resolved
+-- across all objects. loadObject gives the object for a file name.
+--
+-- Sections are linked as chunks, each running from a label, or the start
+-- of the section, to the next. With prune set, only chunks reachable from
+-- the entry point are kept: from the start of the root file, the start of
+-- each section with an .org, such as the interrupt table's, and labels
+-- named by .export, through label references and through code running on
+-- into the next chunk. With profile naming a file of folded stacks, as the
+-- emulator's profiler writes, routines are laid out hottest first after the
+-- first in each run of code between .orgs, the rest following in source
+-- order. A routine here is a run of chunks each running on into the next.
+local Linker = {
+	root = nil,
+	loadObject = nil,
+	prune = nil,
+	profile = nil,
+	bytes = nil,
+	labels = nil,
+	sourceMap = nil,
+	prunedBytes = nil,
+	hotRoutines = nil
+}
+
+-- Instructions after which code does not run on into what follows
+local endsCode = {[0x40] = true, [0x4B] = true, [0x4C] = true, [0x70] = true}
+
+-- Sections in the order they are placed, as {object, section}
+local function PlaceSections(self)
+	local placed = {}
+	local including = {}
+	local function Place(obj)
+		if including[obj] then
+			error("File "..obj.file.." includes itself")
+		end
+		including[obj] = true
+		for _, item in ipairs(obj.items) do
+			if item.include then
+				Place(self.loadObject(item.include))
+			else
+				placed[#placed+1] = {object = obj, section = item.section}
+			end
+		end
+		including[obj] = nil
+	end
+	Place(self.root)
+	return placed
+end
+
+-- The chunks of a placed section, in order, each with the labels at its
+-- start and the references and source map entries within it
+local function SplitSection(placement)
+	local obj, s = placement.object, placement.section
+	local bytes = obj.sections[s].bytes
+	local labelsAt = {[0] = {}}
+	for label, position in pairs(obj.labels) do
+		if position.section == s then
+			labelsAt[position.offset] = labelsAt[position.offset] or {}
+			table.insert(labelsAt[position.offset], label)
+		end
+	end
+	local starts = {}
+	for offset, labels in pairs(labelsAt) do
+		table.sort(labels)
+		starts[#starts+1] = offset
+	end
+	table.sort(starts)
+	local chunks = {}
+	for i, offset in ipairs(starts) do
+		chunks[i] = {
+			placement = placement,
+			first = offset,
+			last = starts[i+1] or #bytes,
+			labels = labelsAt[offset],
+			references = {},
+			entries = {}
+		}
+	end
+	-- The chunk holding offset, given offsets in increasing order
+	local current = 1
+	local function ChunkAt(offset)
+		while chunks[current+1] and chunks[current+1].first <= offset do
+			current = current + 1
+		end
+		return chunks[current]
+	end
+	for _, entry in ipairs(obj.sourceMap) do
+		if entry.section == s then
+			table.insert(ChunkAt(entry.offset).entries, entry)
+		end
+	end
+	current = 1
+	for _, reference in ipairs(obj.references) do
+		if reference.section == s then
+			table.insert(ChunkAt(reference.offset).references, reference)
+		end
+	end
+	for _, chunk in ipairs(chunks) do
+		local entry = chunk.entries[#chunk.entries]
+		chunk.runsOn = not entry or not (entry.data or endsCode[bytes[entry.offset + 1]])
+	end
+	return chunks
+end
+
+-- Samples by label, from the innermost frame of each stack
+local function ReadProfile(filename)
+	local samples = {}
+	for line in io.lines(filename) do
+		local stack, count = line:match("^(.-)%s+(%d+)$")
+		if stack then
+			local label = stack:match("([^;]*)$")
+			samples[label] = (samples[label] or 0) + tonumber(count)
+		end
+	end
+	return samples
+end
+
+-- Routines of a run of chunks, hottest first after the first, and the last
+-- kept last when it runs on past the end of the run
+local function LayOutRun(chunks, samples)
+	local routines = {}
+	local routine
+	for _, chunk in ipairs(chunks) do
+		if not routine then
+			routine = {chunks = {}, samples = 0, order = #routines + 1}
+			routines[#routines+1] = routine
+		end
+		routine.chunks[#routine.chunks+1] = chunk
+		for _, label in ipairs(chunk.labels) do
+			routine.samples = routine.samples + (samples[label] or 0)
+		end
+		if not chunk.runsOn then
+			routine = nil
+		end
+	end
+	local first, last = 2, routine and #routines - 1 or #routines
+	local moved = {}
+	for i = first, last do
+		moved[#moved+1] = routines[i]
+	end
+	table.sort(moved, function (lhs, rhs)
+		if lhs.samples ~= rhs.samples then
+			return lhs.samples > rhs.samples
+		end
+		return lhs.order < rhs.order
+	end)
+	local hot = 0
+	for i, moving in ipairs(moved) do
+		routines[first + i-1] = moving
+		if moving.samples > 0 then
+			hot = hot + 1
+		end
+	end
+	local laidOut = {}
+	for _, placedRoutine in ipairs(routines) do
+		for _, chunk in ipairs(placedRoutine.chunks) do
+			laidOut[#laidOut+1] = chunk
+		end
+	end
+	return laidOut, hot
+end
+
+local function LinkProgram(self)
+	local bytes, labels, sourceMap = self.bytes, self.labels, self.sourceMap
+	local placed = PlaceSections(self)
+	-- Every placed section's chunks in order, with where each label is
+	local chunks, chunkOf = {}, {}
+	for i, placement in ipairs(placed) do
+		placement.chunks = SplitSection(placement)
+		for _, chunk in ipairs(placement.chunks) do
+			chunks[#chunks+1] = chunk
+			for _, label in ipairs(chunk.labels) do
+				if chunkOf[label] then
+					error("Label "..label.." defined again in "..placement.object.file)
+				end
+				chunkOf[label] = chunk
+			end
+		end
+		-- Code runs on from the end of a section into the next placed after
+		-- it, unless that has an .org of its own
+		local nextPlacement = placed[i+1]
+		if nextPlacement and not nextPlacement.object.sections[nextPlacement.section].org then
+			placement.chunks[#placement.chunks].next = true
+		end
+	end
+	for i, chunk in ipairs(chunks) do
+		chunk.next = chunk.next or (chunks[i+1] and chunks[i+1].placement == chunk.placement)
+		chunk.next = chunk.next and chunks[i+1] or nil
+		for _, reference in ipairs(chunk.references) do
+			if not chunkOf[reference.label] then
+				error("Referenced label "..reference.label.." not found")
+			end
+		end
+	end
+
+	-- Chunks kept, marked from the roots
+	local kept = {}
+	if self.prune then
+		local pending = {}
+		for i, placement in ipairs(placed) do
+			if i == 1 or placement.object.sections[placement.section].org then
+				pending[#pending+1] = placement.chunks[1]
+			end
+			for _, label in ipairs(placement.object.exports) do
+				pending[#pending+1] = chunkOf[label] or error("Exported label "..label.." not found")
+			end
+		end
+		while #pending > 0 do
+			local chunk = table.remove(pending)
+			if not kept[chunk] then
+				kept[chunk] = true
+				for _, reference in ipairs(chunk.references) do
+					pending[#pending+1] = chunkOf[reference.label]
+				end
+				if chunk.runsOn and chunk.next then
+					pending[#pending+1] = chunk.next
+				end
+			end
+		end
+	else
+		for _, chunk in ipairs(chunks) do
+			kept[chunk] = true
+		end
+	end
+
+	-- Runs of chunks laid out one after another, a new run at each .org
+	local runs = {}
+	for i, placement in ipairs(placed) do
+		local org = placement.object.sections[placement.section].org
+		if i == 1 or org then
+			runs[#runs+1] = {org = org, file = placement.object.file, chunks = {}}
+		end
+		local run = runs[#runs]
+		for _, chunk in ipairs(placement.chunks) do
+			if kept[chunk] then
+				run.chunks[#run.chunks+1] = chunk
+			else
+				self.prunedBytes = self.prunedBytes + chunk.last - chunk.first
+			end
+		end
+	end
+	local samples = self.profile and ReadProfile(self.profile)
+
+	-- Where each chunk's bytes, labels and references went
+	local here = 0
+	local slots = {}
+	for _, run in ipairs(runs) do
+		local address = run.org or here
+		if samples then
+			local hot
+			run.chunks, hot = LayOutRun(run.chunks, samples)
+			self.hotRoutines = self.hotRoutines + hot
+		end
+		for _, chunk in ipairs(run.chunks) do
+			local obj = chunk.placement.object
+			local chunkBytes = obj.sections[chunk.placement.section].bytes
+			local start = address - chunk.first
+			if address + chunk.last - chunk.first > 65536 then
+				error("Program out of bounds in "..run.file)
+			end
+			for i = chunk.first + 1, chunk.last do
+				if bytes[start + i] then
+					error("Overlapping bytes at address "..(start + i-1))
+				end
+				bytes[start + i] = chunkBytes[i]
+			end
+			for _, label in ipairs(chunk.labels) do
+				labels[label] = address
+			end
+			for _, reference in ipairs(chunk.references) do
+				slots[#slots+1] = {address = start + reference.offset, label = reference.label}
+			end
+			for _, entry in ipairs(chunk.entries) do
+				sourceMap[#sourceMap+1] = {
+					address = start + entry.offset,
+					size = entry.size,
+					file = obj.file,
+					line = entry.line
+				}
+			end
+			address = address + chunk.last - chunk.first
+		end
+		here = address
+	end
+	for _, slot in ipairs(slots) do
+		local labelPos = labels[slot.label]
+		bytes[slot.address + 1] = labelPos%256
+		bytes[slot.address + 2] = math.floor(labelPos/256)
+	end
+end
+
+function Linker:New(obj)
+	Validate(obj, {root = "table", loadObject = "function"})
+	self.__index = self
+	setmetatable(obj, self)
+	obj.bytes = {}
+	obj.labels = {}
+	obj.sourceMap = {}
+	obj.prunedBytes = 0
+	obj.hotRoutines = 0
+	xpcall(function ()
+		LinkProgram(obj)
+	end, function (catchMessage)
+		local explanation = "Link error:\n" .. catchMessage
+		if g_doBacktrace then
+			explanation = debug.traceback(explanation)
+		end
+		io.stderr:write(explanation .. "\n")
+		os.exit(1)
+	end)
+	return obj
+end
+
+-- Bytes from first to last as a string, with gaps zero-filled
+local function ByteString(bytes, first, last)
+	local chars = {}
+	for i = first, last do
+		assert(bytes[i] ~= true, "Program is not linked")
+		chars[#chars+1] = string.char(bytes[i] or 0)
+	end
+	return table.concat(chars)
+end
+
+function Linker:WriteBinary(filename)
+	local outFile = io.open(filename, "wb") or error("Failed to open "..filename)
+	outFile:write(ByteString(self.bytes, 1, table.maxn(self.bytes)))
+	outFile:close()
+end
+
+-- Segmented images, as read by the emulator, are a header, a table of
+-- segments and the bytes of each segment. See cpu/image.hpp.
+local segmentEntrySize = 12
+
+local function Adler32(str)
+	local a, b = 1, 0
+	for i = 1, #str do
+		a = (a + str:byte(i)) % 65521
+		b = (b + a) % 65521
+	end
+	return b*65536 + a
+end
+
+local function U16(value)
+	return string.char(value%256, math.floor(value/256)%256)
+end
+
+local function U32(value)
+	return U16(value%65536) .. U16(math.floor(value/65536))
+end
+
+-- Populated address ranges, joined where the gap between them costs less
+-- than another segment would
+local function FindSegments(bytes)
+	local segments = {}
+	local current
+	for i = 1, table.maxn(bytes) do
+		if bytes[i] then
+			if current and i - current.last <= segmentEntrySize then
+				current.last = i
+			else
+				current = {first = i, last = i}
+				segments[#segments+1] = current
+			end
+		end
+	end
+	return segments
+end
+
+function Linker:WriteImage(filename)
+	local entries, contents = {}, {}
+	for _, segment in ipairs(FindSegments(self.bytes)) do
+		local data = ByteString(self.bytes, segment.first, segment.last)
+		entries[#entries+1] = U16(segment.first-1) .. U16(0) .. U32(#data) .. U32(Adler32(data))
+		contents[#contents+1] = data
+	end
+	local segmentTable = table.concat(entries)
+	local outFile = io.open(filename, "wb") or error("Failed to open "..filename)
+	outFile:write("LVSI", string.char(1, 0), U16(#entries), U32(Adler32(segmentTable)))
+	outFile:write(segmentTable, table.concat(contents))
+	outFile:close()
+end
+
+-- Symbol maps, as read by the emulator's profiler, are text with a line
+-- per label and a line per instruction, addresses and sizes in hex:
+--   label <address> <name>
+--   line <address> <size> <file>:<line>
+function Linker:WriteMap(filename)
+	local labelNames = {}
+	for label in pairs(self.labels) do
+		labelNames[#labelNames+1] = label
+	end
+	table.sort(labelNames, function (lhs, rhs)
+		local lhsAddress, rhsAddress = self.labels[lhs], self.labels[rhs]
+		if lhsAddress ~= rhsAddress then
+			return lhsAddress < rhsAddress
+		end
+		return lhs < rhs
+	end)
+	local outFile = io.open(filename, "w") or error("Failed to open "..filename)
+	for _, label in ipairs(labelNames) do
+		outFile:write(string.format("label %04X %s\n", self.labels[label], label))
+	end
+	for _, entry in ipairs(self.sourceMap) do
+		outFile:write(string.format("line %04X %X %s:%d\n",
+			entry.address, entry.size, entry.file, entry.line))
+	end
+	outFile:close()
+end
+
+return Linker
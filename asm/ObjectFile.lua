@@ -1,102 +1,221 @@
 local Validate = require("Validate")
 
 local Instruction = require("Instruction")
+local Optimize = require("Optimizer")
 
+-- The assembled code of one source file, relocatable: its bytes are in
+-- sections, each either at the address a .org gave it or, before any .org,
+-- placed by the linker after whatever came before it. Labels are exported
+-- as offsets into sections, references to labels are imported by name
+-- whether defined here or not, and .include lines name other objects for
+-- the linker to place where they stand. Labels named by .export lines are
+-- kept by the linker even when nothing refers to them. See Linker.lua.
+-- With optimize set, instructions go through Optimizer.lua first, and
+-- optimizations lists the changes it made.
 local ObjectFile = {
+	file = nil,
 	sourceFile = nil,
-	bytes = nil,
+	optimize = nil,
+	sections = nil,
+	items = nil,
 	labels = nil,
-	references = nil
+	exports = nil,
+	references = nil,
+	sourceMap = nil,
+	optimizations = nil
 }
 
-local function CompileProgram(self)
-	local bytes, labels, references = self.bytes, self.labels, self.references
-	local target = 1
+-- Changes whenever objects are written differently
+ObjectFile.formatVersion = 3
+
+-- Reports an error in sourceLine and exits
+local function LineError(sourceLine)
+	return function (msg)
+		local explanation = "Error encountered " .. sourceLine.file .. ":" .. sourceLine.line .. ":\n"
+		explanation = explanation .. msg
+		if g_doBacktrace then
+			explanation = debug.traceback(explanation)
+		end
+		io.stderr:write(explanation .. "\n")
+		os.exit()
+	end
+end
+
+-- Each section's labels and instructions, in order, as {label = name} and
+-- {instruction = instruction, reference = label}
+local function ParseProgram(self, streams)
+	local sections, items, exports = self.sections, self.items, self.exports
+	local function StartSection(org)
+		sections[#sections+1] = {org = org, bytes = {}}
+		streams[#sections] = {}
+		items[#items+1] = {section = #sections}
+	end
+	StartSection(nil)
 	for _, sourceLine in ipairs(self.sourceFile.lines) do
 		xpcall(function ()
+			local stream = streams[#sections]
 			if not sourceLine.contents:find("^%s*;") then
 				if sourceLine.contents:find("^.org%s+") then
 					local orgPoint = sourceLine.contents:match("^.org%s+([%xx]+)")
 					orgPoint = tonumber(orgPoint) or error("Given org point is not a number")
-					target = orgPoint + 1
+					StartSection(orgPoint)
+				elseif sourceLine.contents:find("^%.include%s+\"[^\"]+\"") then
+					local includedFile = sourceLine.contents:match("^%.include%s+\"([^\"]+)\"")
+					items[#items+1] = {include = includedFile}
+					StartSection(nil)
+				elseif sourceLine.contents:find("^%.export%s+") then
+					local label = sourceLine.contents:match("^%.export%s+([_%a][_%w]*)%s*$") or error("Expected a label to export")
+					exports[#exports+1] = label
 				elseif sourceLine.contents:find("^[_%a][_%w]*:") then
 					local label = sourceLine.contents:match("^([_%a][_%w]*):")
-					labels[label] = target-1
+					stream[#stream+1] = {label = label}
 				else
 					local instruction = Instruction:New{sourceLine = sourceLine}
 print(instruction.sourceLine.contents)
-					if instruction:LoadFromLine(references) then
-						if references[instruction] then
-							references[instruction] = {references[instruction], target}
-						end
-						for i, byte in ipairs(instruction.code) do
-							assert(not bytes[target + i-1], "Overlapping bytes at address "..(target+i-1))
-							assert(target + i <= 65536, "Program out of bounds")
-							bytes[target + i-1] = byte
-						end
-						target = target + #instruction.code
+					local instructionReferences = {}
+					if instruction:LoadFromLine(instructionReferences) then
+						stream[#stream+1] = {instruction = instruction, reference = instructionReferences[instruction]}
 					else
 						error("Not a recognised instruction")
 					end
 				end
 			end
 		end,
-		function (msg)
-			local explanation = "Error encountered " .. sourceLine.file .. ":" .. sourceLine.line .. ":\n"
-			explanation = explanation .. msg
-			if g_doBacktrace then
-				explanation = debug.traceback(explanation)
+		LineError(sourceLine))
+	end
+end
+
+-- Lays out each section's stream as its bytes, labels, references and
+-- source map entries
+local function LayOutProgram(self, streams)
+	local labels, references, sourceMap = self.labels, self.references, self.sourceMap
+	for s, section in ipairs(self.sections) do
+		local bytes = section.bytes
+		for _, item in ipairs(streams[s]) do
+			if item.label then
+				labels[item.label] = {section = s, offset = #bytes}
+			else
+				local instruction = item.instruction
+				xpcall(function ()
+					local offset = #bytes
+					if item.reference then
+						-- The address goes in the instruction's first two
+						-- bytes for DB, after the op code otherwise
+						references[#references+1] = {
+							section = s,
+							offset = instruction.code[1] == true and offset or offset + 1,
+							label = item.reference
+						}
+					end
+					for i, byte in ipairs(instruction.code) do
+						bytes[offset + i] = byte
+					end
+					assert((section.org or 0) + #bytes <= 65536, "Program out of bounds")
+					sourceMap[#sourceMap+1] = {
+						section = s,
+						offset = offset,
+						size = #instruction.code,
+						line = instruction.sourceLine.line,
+						data = instruction.type == "DB" or nil
+					}
+				end,
+				LineError(instruction.sourceLine))
 			end
-			io.stderr:write(explanation .. "\n")
-			os.exit()
-		end)
+		end
 	end
 end
 
+local function CompileProgram(self)
+	local streams = {}
+	ParseProgram(self, streams)
+	if self.optimize then
+		self.optimizations = Optimize(streams)
+	end
+	LayOutProgram(self, streams)
+end
+
 function ObjectFile:New(obj)
 	Validate(obj, {sourceFile = "table"})
 	self.__index = self
 	setmetatable(obj, self)
-	obj.bytes = {}
+	obj.file = obj.sourceFile.rootFilename
+	obj.sections = {}
+	obj.items = {}
 	obj.labels = {}
+	obj.exports = {}
 	obj.references = {}
+	obj.sourceMap = {}
+	obj.optimizations = {}
 	CompileProgram(obj)
+	obj.sourceFile = nil
 	return obj
 end
 
-local function LinkProgram(self)
-	local bytes, labels, references = self.bytes, self.labels, self.references
-	xpcall(function ()
-		for _, refPair in pairs(references) do
-			local label, target = unpack(refPair)
-			local labelPos = labels[label] or error("Referenced label "..label.." not found")
-			if bytes[target] == true then
-				bytes[target] = labels[label]%256
-				bytes[target+1] = math.floor(labels[label]/256)
-			else
-				bytes[target+1] = labels[label]%256
-				bytes[target+2] = math.floor(labels[label]/256)
-			end
-		end
-	end, function (catchMessage)
-		local explanation = "Link error:\n" .. catchMessage
-		if g_doBacktrace then
-			explanation = debug.traceback(explanation)
+-- Objects are written as a Lua table constructor, holding only numbers,
+-- strings, booleans and tables, with a line per field and per element of
+-- the fields
+local function Serialize(value, out, depth)
+	depth = depth or 0
+	if type(value) ~= "table" then
+		out[#out+1] = string.format("%q", value)
+		return
+	end
+	local separator = depth < 2 and ",\n" or ","
+	out[#out+1] = depth < 2 and "{\n" or "{"
+	for _, element in ipairs(value) do
+		Serialize(element, out, depth + 1)
+		out[#out+1] = separator
+	end
+	local keys = {}
+	for key in pairs(value) do
+		if type(key) == "string" then
+			keys[#keys+1] = key
 		end
-		io.stderr:write(explanation .. "\n")
-		os.exit(1)
-	end)
+	end
+	table.sort(keys)
+	for _, key in ipairs(keys) do
+		out[#out+1] = key:find("^[_%a][_%w]*$") and key .. "=" or string.format("[%q]=", key)
+		Serialize(value[key], out, depth + 1)
+		out[#out+1] = separator
+	end
+	out[#out+1] = "}"
 end
 
-function ObjectFile:WriteBinary(filename)
-	LinkProgram(self)
-	local outFile = io.open(filename, "wb") or error("Failed to open "..filename)
-	for i = 1, table.maxn(self.bytes) do
-		assert(self.bytes[i] ~= true, "Program is not linked")
-		outFile:write(string.char(self.bytes[i] or 0))
-		print(self.bytes[i] or 0)
-	end
+-- Writes the object, with key to tell later whether it is still up to date
+function ObjectFile:Write(filename, key)
+	local out = {"return "}
+	Serialize({
+		formatVersion = ObjectFile.formatVersion,
+		key = key,
+		file = self.file,
+		sections = self.sections,
+		items = self.items,
+		labels = self.labels,
+		exports = self.exports,
+		references = self.references,
+		sourceMap = self.sourceMap,
+		optimizations = self.optimizations
+	}, out)
+	out[#out+1] = "\n"
+	local outFile = io.open(filename, "w") or error("Failed to open "..filename)
+	outFile:write(table.concat(out))
 	outFile:close()
 end
 
+-- The object written to filename, or nil if there is none, it was written
+-- with another format or its key is not the one given
+function ObjectFile:Read(filename, key)
+	local chunk = loadfile(filename, "t", {})
+	local ok, obj = false, nil
+	if chunk then
+		ok, obj = pcall(chunk)
+	end
+	if not ok or type(obj) ~= "table" or obj.formatVersion ~= ObjectFile.formatVersion or obj.key ~= key then
+		return nil
+	end
+	obj.formatVersion, obj.key = nil, nil
+	self.__index = self
+	return setmetatable(obj, self)
+end
+
 return ObjectFile
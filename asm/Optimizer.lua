@@ -0,0 +1,276 @@
+local Instruction = require("Instruction")
+local SourceLine = require("SourceLine")
+
+-- Peephole optimizations for asm.lua --optimize, over the instructions of
+-- one file. Each section is given as a stream of {label = name} and
+-- {instruction = instruction, reference = label} items, in source order.
+-- Nothing is moved past a label, and what is known of registers is
+-- forgotten at each, so that code jumped to from elsewhere does what it
+-- did. Code that counts on instructions' sizes, such as computed jumps into
+-- the middle of a run of code, is not safe to optimize.
+
+-- Op codes whose meaning is not plain from the code
+local opJP = 0x40
+local opMovG8, opMovR16 = 0x20, 0x21
+local opPushG8, opPushR16, opPopG8, opPopR16 = 0xA0, 0xB0, 0xC0, 0xD0
+local opMovG8Num, opMovR16Num = 0x80, 0x90
+local opAddR16Num = 0xF0
+local regSP, regC, regCH = 2, 1, 3
+
+local g8Names = {[0] = "AL", "AH", "CL", "CH"}
+local r16Names = {[0] = "A", "C", "SP", "BP"}
+
+-- Stores of what the load before them read, by the load's op code
+local storeBack = {[0x23] = 0x25, [0x24] = 0x26, [0x29] = 0x2D, [0x2A] = 0x2E}
+
+-- Jumps that may be sent straight on to where the JP they land on goes
+local threadedJumps = {[0x40] = true, [0x41] = true, [0x42] = true, [0x43] = true, [0x44] = true}
+
+-- Instructions that leave A and C as they are, and carry on to the next
+local keepsRegisters = {
+	[0x00] = true, [0x25] = true, [0x26] = true, [0x2C] = true, [0x2D] = true, [0x2E] = true,
+	[0x41] = true, [0x42] = true, [0x43] = true, [0x44] = true,
+	[0x50] = true, [0x51] = true, [0x52] = true, [0x53] = true, [0x54] = true, [0x55] = true,
+	[0x61] = true, [0x92] = true, [0x93] = true, [0xF2] = true, [0xF3] = true,
+	[0xA0] = true, [0xA1] = true, [0xA2] = true, [0xA3] = true,
+	[0xB0] = true, [0xB1] = true, [0xB2] = true, [0xB3] = true
+}
+
+-- Flags each instruction sets, and the instructions that read them
+local setsFlags = {
+	[0x01] = {zero = true, carry = true}, [0x02] = {zero = true, carry = true},
+	[0x03] = {zero = true}, [0x04] = {zero = true}, [0x0D] = {carry = true},
+	[0xE0] = {zero = true, carry = true}, [0xE1] = {zero = true, carry = true},
+	[0xE2] = {zero = true, carry = true}, [0xE3] = {zero = true, carry = true},
+	[0xF0] = {zero = true, carry = true}, [0xF1] = {zero = true, carry = true},
+	[0xF2] = {zero = true, carry = true}, [0xF3] = {zero = true, carry = true}
+}
+local readsFlags = {[0x28] = true, [0x41] = true, [0x42] = true, [0x43] = true, [0x44] = true}
+
+-- Instructions after which the next in the stream is not what runs next
+local leavesStream = {
+	[0x40] = true, [0x48] = true, [0x49] = true, [0x4A] = true,
+	[0x4B] = true, [0x4C] = true, [0x70] = true
+}
+
+local function Text(item)
+	return item.instruction.sourceLine.contents:gsub(";.*", ""):match("^%s*(.-)%s*$")
+end
+
+local function Hex(num, digits)
+	return string.format("0x%0" .. digits .. "X", num)
+end
+
+-- An item assembled from contents, standing for the instruction's line
+local function Rewrite(instruction, contents)
+	local rewritten = Instruction:New{sourceLine = SourceLine:New{
+		file = instruction.sourceLine.file,
+		line = instruction.sourceLine.line,
+		contents = "\t" .. contents
+	}}
+	local references = {}
+	rewritten:LoadFromLine(references)
+	return {instruction = rewritten, reference = references[rewritten]}
+end
+
+local function Note(changes, item, text, saved)
+	changes[#changes+1] = {line = item.instruction.sourceLine.line, text = text, saved = saved}
+end
+
+-- The op code, or nil for labels and data
+local function OpCode(item)
+	if item.instruction and item.instruction.type ~= "DB" then
+		return item.instruction.code[1]
+	end
+end
+
+-- MOV X, X; PUSH X then POP X; a load then a store of it back
+local function RemoveRedundant(stream, changes)
+	local result = {}
+	local i = 1
+	while i <= #stream do
+		local item, nextItem = stream[i], stream[i+1]
+		local op, nextOp = OpCode(item), nextItem and OpCode(nextItem)
+		local code = op and item.instruction.code
+		local nextCode = nextOp and nextItem.instruction.code
+		-- CH reads as AH in the CPU, so that MOV CH, CH and PUSH CH then POP
+		-- CH copy AH into CH, and are kept
+		if (op == opMovG8 and code[2] // 16 == code[2] % 16 and code[2] % 16 ~= regCH)
+		or (op == opMovR16 and code[2] // 16 == code[2] % 16) then
+			Note(changes, item, Text(item) .. " removed", #code)
+			i = i + 1
+		elseif op and nextOp and (
+			(op >= opPushG8 and op < opPushG8 + 4 and op - opPushG8 ~= regCH and nextOp == opPopG8 + op - opPushG8)
+			or (op >= opPushR16 and op < opPushR16 + 4 and op - opPushR16 ~= regSP and nextOp == opPopR16 + op - opPushR16)
+		) then
+			Note(changes, item, Text(item) .. " then " .. Text(nextItem) .. " removed", 2)
+			i = i + 2
+		elseif op and storeBack[op] and nextOp == storeBack[op] and code[2] == nextCode[2] then
+			Note(changes, nextItem, Text(nextItem) .. " removed, storing back what was just loaded", #nextCode)
+			result[#result+1] = item
+			i = i + 2
+		else
+			result[#result+1] = item
+			i = i + 1
+		end
+	end
+	return result
+end
+
+-- Jumps to a JP go straight to where it goes, given that the JP is in this
+-- file
+local function ThreadJumps(streams, changes)
+	local labelled = {}
+	for _, stream in ipairs(streams) do
+		for i, item in ipairs(stream) do
+			if item.label then
+				labelled[item.label] = {stream = stream, index = i}
+			end
+		end
+	end
+	-- Where a jump to label goes on to, as a label or number, or nil
+	local function OnwardTarget(label)
+		local place = labelled[label]
+		if not place then
+			return nil
+		end
+		local i = place.index
+		while place.stream[i] and place.stream[i].label do
+			i = i + 1
+		end
+		local item = place.stream[i]
+		if item and OpCode(item) == opJP then
+			return item.reference or item.instruction.p1
+		end
+	end
+	for _, stream in ipairs(streams) do
+		for i, item in ipairs(stream) do
+			if threadedJumps[OpCode(item)] and item.reference then
+				local target, seen = item.reference, {[item.reference] = true}
+				local onward = OnwardTarget(target)
+				while onward and not seen[onward] do
+					target, seen[onward] = onward, true
+					onward = OnwardTarget(target)
+				end
+				if target ~= item.reference then
+					stream[i] = Rewrite(item.instruction, item.instruction.type .. " " .. target)
+					Note(changes, item, Text(item) .. " -> " .. item.instruction.type .. " " .. target
+						.. ", " .. item.reference .. " jumping on there", 0)
+				end
+			end
+		end
+	end
+end
+
+-- MOV of a number a register already holds, in part or in whole, following
+-- what is known of AL, AH, CL and CH through the code between labels
+local function ShortenMoves(stream, changes)
+	local result = {}
+	local known = {}
+	for _, item in ipairs(stream) do
+		local op = OpCode(item)
+		local code = op and item.instruction.code
+		local kept = item
+		if op and op >= opMovG8Num and op < opMovG8Num + 4 then
+			local reg = op - opMovG8Num
+			if known[reg] == code[2] then
+				Note(changes, item, Text(item) .. " removed, " .. g8Names[reg] .. " already " .. Hex(code[2], 2), #code)
+				kept = nil
+			end
+			known[reg] = code[2]
+		elseif (op == opMovR16Num or op == opMovR16Num + regC) and not item.reference then
+			local reg = op - opMovR16Num
+			local low, high = 2 * reg, 2 * reg + 1
+			if known[low] == code[2] and known[high] == code[3] then
+				Note(changes, item, Text(item) .. " removed, " .. r16Names[reg] .. " already " .. Hex(code[2] + 256 * code[3], 4), #code)
+				kept = nil
+			elseif known[high] == code[3] then
+				kept = Rewrite(item.instruction, "MOV " .. g8Names[low] .. ", " .. Hex(code[2], 2))
+				Note(changes, item, Text(item) .. " -> " .. Text(kept) .. ", " .. g8Names[high] .. " already " .. Hex(code[3], 2), 1)
+			elseif known[low] == code[2] then
+				kept = Rewrite(item.instruction, "MOV " .. g8Names[high] .. ", " .. Hex(code[3], 2))
+				Note(changes, item, Text(item) .. " -> " .. Text(kept) .. ", " .. g8Names[low] .. " already " .. Hex(code[2], 2), 1)
+			end
+			known[low], known[high] = code[2], code[3]
+		elseif not (op and keepsRegisters[op]) then
+			known = {}
+		end
+		result[#result+1] = kept
+	end
+	return result
+end
+
+-- Whether the flags as they stand after stream[i] are set again before
+-- anything reads them, looking no further than straight-line code
+local function FlagsUnused(stream, i)
+	local zeroSet, carrySet = false, false
+	for j = i + 1, #stream do
+		local item = stream[j]
+		if item.instruction then
+			local op = OpCode(item)
+			local code = item.instruction.code
+			if not op or readsFlags[op] or leavesStream[op] or (op == 0x22 and code[2] == 0x01) then
+				return false
+			end
+			local sets = setsFlags[op]
+			if sets then
+				zeroSet = zeroSet or sets.zero or false
+				carrySet = carrySet or sets.carry or false
+				if zeroSet and carrySet then
+					return true
+				end
+			end
+		end
+	end
+	return false
+end
+
+-- ADD C of 1, 2, -1 or -2, as INC C or DEC C once or twice, where nothing
+-- reads the flags the ADD would have set
+local function AddsToSteps(stream, changes)
+	local result = {}
+	local steps = {[1] = "INC C", [2] = "INC C", [0xFFFF] = "DEC C", [0xFFFE] = "DEC C"}
+	for i, item in ipairs(stream) do
+		local op = OpCode(item)
+		local code = op and item.instruction.code
+		local value = op == opAddR16Num + regC and not item.reference and code[2] + 256 * code[3]
+		if value and steps[value] and FlagsUnused(stream, i) then
+			local count = (value == 1 or value == 0xFFFF) and 1 or 2
+			for _ = 1, count do
+				result[#result+1] = Rewrite(item.instruction, steps[value])
+			end
+			Note(changes, item, Text(item) .. " -> " .. string.rep(steps[value], count, " then ") .. ", flags unused", #code - count)
+		else
+			result[#result+1] = item
+		end
+	end
+	return result
+end
+
+-- Optimizes each stream in streams in place, giving a list of the changes
+-- made as {line, text, saved}, saved being the bytes saved
+local function Optimize(streams)
+	local changes = {}
+	local before
+	repeat
+		before = #changes
+		for s, stream in ipairs(streams) do
+			stream = RemoveRedundant(stream, changes)
+			stream = ShortenMoves(stream, changes)
+			streams[s] = AddsToSteps(stream, changes)
+		end
+		ThreadJumps(streams, changes)
+	until #changes == before
+	for i, change in ipairs(changes) do
+		change.order = i
+	end
+	table.sort(changes, function (a, b)
+		return a.line < b.line or (a.line == b.line and a.order < b.order)
+	end)
+	for _, change in ipairs(changes) do
+		change.order = nil
+	end
+	return changes
+end
+
+return Optimize
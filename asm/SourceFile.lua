@@ -7,26 +7,20 @@ local SourceFile = {
 	lines = nil
 }
 
-local function LoadFile(filename, sourceLines, insertIndex)
-	insertIndex = insertIndex or 1
-	local currentIndex = insertIndex
+-- Lines of the one file, .include lines kept as they are, for the linker to
+-- place the included file's object there
+local function LoadFile(filename, sourceLines)
 	local lineNumber = 1
 	for line in io.lines(filename) do
-		if line:find("^%.include%s+\"[^\"]+\"") then
-			local includedFile = line:match("^%.include%s+\"([^\"]+)\"")
-			_, currentIndex = LoadFile(includedFile, sourceLines, currentIndex)
-		elseif not line:find("^%s*$") then
-			local sourceLine = SourceLine:New{
+		if not line:find("^%s*$") then
+			sourceLines[#sourceLines+1] = SourceLine:New{
 				file = filename,
 				line = lineNumber,
 				contents = line
 			}
-			table.insert(sourceLines, currentIndex, sourceLine)
-			currentIndex = currentIndex + 1
 		end
 		lineNumber = lineNumber + 1
 	end
-	return insertIndex, currentIndex
 end
 
 function SourceFile:New(obj)
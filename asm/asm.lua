@@ -16,21 +16,87 @@ function table.maxn(t)
 end
 
 g_doBacktrace = false
-for i, str in ipairs(arg) do
-	if str == "--bt" then
+g_writeImage = false
+g_mapFile = nil
+g_cacheDirectory = nil
+g_optimize = false
+g_prune = false
+g_profile = nil
+for i = #arg, 1, -1 do
+	if arg[i] == "--bt" then
 		g_doBacktrace = true
 		table.remove(arg, i)
-		break
+	elseif arg[i] == "--segmented" then
+		g_writeImage = true
+		table.remove(arg, i)
+	elseif arg[i] == "--map" and arg[i+1] then
+		g_mapFile = arg[i+1]
+		table.remove(arg, i+1)
+		table.remove(arg, i)
+	elseif arg[i] == "--optimize" then
+		g_optimize = true
+		table.remove(arg, i)
+	elseif arg[i] == "--prune" then
+		g_prune = true
+		table.remove(arg, i)
+	elseif arg[i] == "--profile" and arg[i+1] then
+		g_profile = arg[i+1]
+		table.remove(arg, i+1)
+		table.remove(arg, i)
+	elseif arg[i] == "--cache" and arg[i+1] then
+		g_cacheDirectory = arg[i+1]
+		table.remove(arg, i+1)
+		table.remove(arg, i)
 	end
 end
 
 xpcall(function()
-	local SourceFile = require("SourceFile")
-	local ObjectFile = require("ObjectFile")
+	local BuildCache = require("BuildCache")
+	local Linker = require("Linker")
 
-	local sourceFile = SourceFile:New{rootFilename = arg[1]}
-	local objectFile = ObjectFile:New{sourceFile = sourceFile}
-	objectFile:WriteBinary(arg[2])
+	-- Each file is assembled on its own, or taken from the cache directory
+	-- if unchanged since, and the objects linked
+	local buildCache = BuildCache:New{directory = g_cacheDirectory, optimize = g_optimize}
+	local objects, loaded = {}, {}
+	local function LoadObject(filename)
+		local obj = buildCache:Object(filename)
+		if not loaded[obj] then
+			objects[#objects+1], loaded[obj] = obj, true
+		end
+		return obj
+	end
+	local linker = Linker:New{
+		root = LoadObject(arg[1]),
+		loadObject = LoadObject,
+		prune = g_prune,
+		profile = g_profile
+	}
+	if g_writeImage then
+		linker:WriteImage(arg[2])
+	else
+		linker:WriteBinary(arg[2])
+	end
+	if g_mapFile then
+		linker:WriteMap(g_mapFile)
+	end
+	-- What the optimizer changed, whether just now or when the objects were
+	-- cached
+	if g_optimize then
+		local changes, saved = 0, 0
+		for _, obj in ipairs(objects) do
+			for _, change in ipairs(obj.optimizations) do
+				io.stderr:write(obj.file .. ":" .. change.line .. ": " .. change.text .. "\n")
+				changes, saved = changes + 1, saved + change.saved
+			end
+		end
+		io.stderr:write("Optimized: " .. changes .. " changes, " .. saved .. " bytes saved\n")
+	end
+	if g_prune then
+		io.stderr:write("Pruned: " .. linker.prunedBytes .. " bytes unreachable\n")
+	end
+	if g_profile then
+		io.stderr:write("Profile: " .. linker.hotRoutines .. " hot routines laid out first\n")
+	end
 end,
 function(err)
 	if g_doBacktrace then
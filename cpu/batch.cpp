@@ -0,0 +1,267 @@
+#include "batch.hpp"
+#include "lockstep.hpp"
+#include "mem.hpp"
+#include "snapshot.hpp"
+#include "work_pool.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+	// A worker's machine, kept from job to job
+	struct Worker {
+		Mem                  mem;
+		std::ifstream        input;
+		std::ofstream        output;
+		std::unique_ptr<CPU> cpu;
+	};
+
+	bool is_snapshot(const std::string &path)
+	{
+		std::ifstream file{path, std::ios::binary};
+		char magic[4];
+		return file.read(magic, sizeof magic) && std::memcmp(magic, "LVSS", sizeof magic) == 0;
+	}
+
+	const char * status_name(const Batch::Status status)
+	{
+		switch (status) {
+		case Batch::Status::stopped:
+			return "stopped";
+		case Batch::Status::out_of_cycles:
+			return "out_of_cycles";
+		case Batch::Status::failed:
+			break;
+		}
+		return "failed";
+	}
+}
+
+// Reads the manifest, throwing std::runtime_error at the first bad line
+Batch::Batch(std::istream &manifest)
+{
+	std::string line;
+	for (unsigned line_number = 1; std::getline(manifest, line); ++line_number) {
+		std::istringstream fields{line};
+		Job job;
+		if (!(fields >> job.image_path) || job.image_path[0] == '#') {
+			continue;
+		}
+		std::string extra;
+		if (!(fields >> job.input_path >> job.output_path >> job.cycles) || fields >> extra) {
+			throw std::runtime_error{
+				"Batch manifest line " + std::to_string(line_number)
+				+ " is not an image, input, output and cycle budget"
+			};
+		}
+		_jobs.push_back(job);
+	}
+}
+
+void Batch::load_images()
+{
+	for (const auto &job : _jobs) {
+		auto &loaded = _images[job.image_path];
+		if (loaded.image || !loaded.error.empty()) {
+			continue;
+		}
+		try {
+			if (is_snapshot(job.image_path)) {
+				const Snapshot snapshot{job.image_path};
+				loaded.image = snapshot.image();
+				loaded.state = std::make_unique<CPU::State>(snapshot.state());
+			} else {
+				loaded.image = Image::load_file(job.image_path);
+				if (!loaded.image) {
+					loaded.error = "Could not open image " + job.image_path;
+				}
+			}
+		} catch (const std::exception &error) {
+			loaded.error = error.what();
+		}
+	}
+}
+
+// Runs every job, with threads workers, or as many as the host has cores,
+// and up to lanes jobs of the same image in lockstep
+void Batch::run(
+	const double       clock_rate,
+	const CPU::Options &options,
+	const unsigned     threads,
+	const unsigned     lanes
+)
+{
+	load_images();
+	_results.assign(_jobs.size(), Result{});
+	Work_pool pool{threads};
+	std::vector<std::unique_ptr<Worker>> workers(pool.threads());
+
+	// Jobs by the group they run in, in manifest order
+	std::vector<std::vector<std::size_t>> groups;
+	std::map<std::string, std::size_t> filling;
+	for (std::size_t job_index = 0; job_index < _jobs.size(); ++job_index) {
+		const auto &image_path = _jobs[job_index].image_path;
+		const auto found = filling.find(image_path);
+		if (lanes > 1 && _images.at(image_path).image && found != filling.end()) {
+			auto &group = groups[found->second];
+			group.push_back(job_index);
+			if (group.size() == lanes) {
+				filling.erase(found);
+			}
+			continue;
+		}
+		if (lanes > 1) {
+			filling[image_path] = groups.size();
+		}
+		groups.push_back({job_index});
+	}
+
+	const auto run_job = [&](const unsigned worker_index, const std::size_t job_index) {
+		const auto &job = _jobs[job_index];
+		auto &result = _results[job_index];
+		const auto &loaded = _images.at(job.image_path);
+		if (!loaded.image) {
+			result.error = loaded.error;
+			return;
+		}
+
+		auto &worker = workers[worker_index];
+		if (!worker) {
+			worker = std::make_unique<Worker>();
+		}
+		worker->input.close();
+		worker->input.clear();
+		worker->input.open(job.input_path, std::ios::binary);
+		if (!worker->input) {
+			result.error = "Could not open input " + job.input_path;
+			return;
+		}
+		worker->output.close();
+		worker->output.clear();
+		worker->output.open(job.output_path, std::ios::binary);
+		if (!worker->output) {
+			result.error = "Could not open output " + job.output_path;
+			return;
+		}
+
+		worker->mem.reset(loaded.image);
+		if (!worker->cpu) {
+			worker->cpu = std::make_unique<CPU>(
+				worker->mem,
+				clock_rate,
+				worker->input,
+				worker->output,
+				options
+			);
+		}
+		auto &cpu = *worker->cpu;
+		if (loaded.state) {
+			cpu.restore(*loaded.state);
+		} else {
+			cpu.reset();
+		}
+		const auto start = cpu.cycles();
+		const auto budget = job.cycles ? job.cycles : Scheduler::never;
+		cpu.set_cycle_limit(job.cycles ? start + job.cycles : Scheduler::never);
+		while (cpu.is_on() && cpu.cycles() - start < budget) {
+			cpu.step();
+		}
+		worker->output.flush();
+		result.status = cpu.is_on() ? Status::out_of_cycles : Status::stopped;
+		result.cycles = cpu.cycles() - start;
+		if (!worker->output) {
+			result.status = Status::failed;
+			result.error = "Could not write output " + job.output_path;
+		}
+	};
+	const auto run_lanes = [&](const std::vector<std::size_t> &group) {
+		std::vector<std::unique_ptr<std::ifstream>> inputs;
+		std::vector<std::unique_ptr<std::ofstream>> outputs;
+		std::vector<Lockstep::Lane> lanes;
+		std::vector<std::size_t> lane_jobs;
+		std::vector<std::uint64_t> starts;
+		for (const auto job_index : group) {
+			const auto &job = _jobs[job_index];
+			auto &result = _results[job_index];
+			auto input = std::make_unique<std::ifstream>(job.input_path, std::ios::binary);
+			if (!*input) {
+				result.error = "Could not open input " + job.input_path;
+				continue;
+			}
+			auto output = std::make_unique<std::ofstream>(job.output_path, std::ios::binary);
+			if (!*output) {
+				result.error = "Could not open output " + job.output_path;
+				continue;
+			}
+			const auto &loaded = _images.at(job.image_path);
+			const auto start = loaded.state ? loaded.state->cycles : 0;
+			Lockstep::Lane lane;
+			lane.image = loaded.image;
+			lane.state = loaded.state.get();
+			lane.input = input.get();
+			lane.output = output.get();
+			lane.until = job.cycles ? start + job.cycles : Scheduler::never;
+			lanes.push_back(lane);
+			lane_jobs.push_back(job_index);
+			starts.push_back(start);
+			inputs.push_back(std::move(input));
+			outputs.push_back(std::move(output));
+		}
+
+		Lockstep lockstep{lanes, clock_rate, options};
+		lockstep.run();
+		for (std::size_t lane = 0; lane < lanes.size(); ++lane) {
+			const auto &job = _jobs[lane_jobs[lane]];
+			auto &result = _results[lane_jobs[lane]];
+			auto &output = *outputs[lane];
+			output.flush();
+			result.status = lockstep.is_on(lane) ? Status::out_of_cycles : Status::stopped;
+			result.cycles = lockstep.cycles(lane) - starts[lane];
+			if (!output) {
+				result.status = Status::failed;
+				result.error = "Could not write output " + job.output_path;
+			}
+		}
+	};
+	pool.run(groups.size(), [&](const unsigned worker_index, const std::size_t group_index) {
+		const auto &group = groups[group_index];
+		try {
+			if (group.size() == 1) {
+				run_job(worker_index, group[0]);
+			} else {
+				run_lanes(group);
+			}
+		} catch (const std::exception &error) {
+			for (const auto job_index : group) {
+				_results[job_index] = Result{Status::failed, 0, error.what()};
+			}
+		}
+	});
+}
+
+// Whether every job ran, to STOP or to the end of its budget
+bool Batch::succeeded() const
+{
+	for (const auto &result : _results) {
+		if (result.status == Status::failed) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Writes a line per job, in manifest order: the job's index from 0, its
+// status, the cycles it ran, and what went wrong if it failed
+void Batch::report(std::ostream &out) const
+{
+	for (std::size_t i = 0; i < _results.size(); ++i) {
+		const auto &result = _results[i];
+		out << i << " " << status_name(result.status) << " " << result.cycles;
+		if (!result.error.empty()) {
+			out << " " << result.error;
+		}
+		out << "\n";
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef LVCPU_BATCH_HPP_INCLUDED
+#define LVCPU_BATCH_HPP_INCLUDED
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cpu.hpp"
+#include "image.hpp"
+
+// Many guest jobs run in one process, on a work-stealing pool. Each worker
+// thread keeps one Mem and one CPU, reset between jobs, and images are
+// loaded once however many jobs run them.
+//
+// The manifest has a job per line, of an image path, an input path, an
+// output path and a cycle budget, separated by whitespace. A budget of 0
+// runs until STOP. Blank lines and lines starting with '#' are skipped. An
+// image may be a snapshot, which jobs then start from.
+//
+// Jobs of the same image can also run in lockstep, a number of lanes at a
+// time, each group of them taking one worker.
+class Batch {
+public:
+	struct Job {
+		std::string   image_path;
+		std::string   input_path;
+		std::string   output_path;
+		std::uint64_t cycles;
+	};
+
+	enum class Status {
+		stopped,
+		out_of_cycles,
+		failed
+	};
+
+	struct Result {
+		Status        status = Status::failed;
+		std::uint64_t cycles = 0;
+		std::string   error;
+	};
+
+private:
+	struct Loaded_image {
+		std::shared_ptr<const Image> image;
+		std::unique_ptr<CPU::State>  state;
+		std::string                  error;
+	};
+
+	std::vector<Job> _jobs;
+	std::vector<Result> _results;
+	std::map<std::string, Loaded_image> _images;
+
+	void load_images();
+
+public:
+	explicit Batch(std::istream &manifest);
+	void run(
+		double             clock_rate,
+		const CPU::Options &options,
+		unsigned           threads = 0,
+		unsigned           lanes = 1
+	);
+	bool succeeded() const;
+	void report(std::ostream &out) const;
+};
+
+#endif // LVCPU_BATCH_HPP_INCLUDED
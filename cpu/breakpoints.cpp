@@ -0,0 +1,81 @@
+#include "breakpoints.hpp"
+
+#include <stdexcept>
+
+// Marks the pages of every breakpoint and watched range
+void Breakpoints::update_pages()
+{
+	_break_pages.fill(0);
+	_read_pages.fill(0);
+	_write_pages.fill(0);
+	for (const auto address : _breakpoints) {
+		_break_pages[address >> 8] = 1;
+	}
+	for (const auto &watchpoint : _watchpoints) {
+		for (unsigned page = watchpoint.first >> 8; page <= watchpoint.last >> 8u; ++page) {
+			_read_pages[page] |= (watchpoint.access & Access::reads) != 0;
+			_write_pages[page] |= (watchpoint.access & Access::writes) != 0;
+		}
+	}
+}
+
+// Gives whether there was no breakpoint at address yet. The Mem the
+// breakpoints are attached to has to be told of changes with
+// Mem::breakpoints_changed(), as do those below.
+bool Breakpoints::add_breakpoint(const std::uint16_t address)
+{
+	const bool added = _breakpoints.insert(address).second;
+	update_pages();
+	return added;
+}
+
+bool Breakpoints::remove_breakpoint(const std::uint16_t address)
+{
+	const bool removed = _breakpoints.erase(address);
+	update_pages();
+	return removed;
+}
+
+void Breakpoints::add_watchpoint(const Watchpoint &watchpoint)
+{
+	if (watchpoint.first > watchpoint.last || !(watchpoint.access & (Access::reads | Access::writes))) {
+		throw std::out_of_range{"Breakpoints::add_watchpoint() given an empty watchpoint"};
+	}
+	_watchpoints.push_back(watchpoint);
+	update_pages();
+}
+
+// Removes the watchpoint at index in watchpoints(), if there is one
+bool Breakpoints::remove_watchpoint(const std::size_t index)
+{
+	if (index >= _watchpoints.size()) {
+		return false;
+	}
+	_watchpoints.erase(_watchpoints.begin() + index);
+	update_pages();
+	return true;
+}
+
+const std::set<std::uint16_t> & Breakpoints::breakpoints() const
+{
+	return _breakpoints;
+}
+
+const std::vector<Breakpoints::Watchpoint> & Breakpoints::watchpoints() const
+{
+	return _watchpoints;
+}
+
+// The breakpoint or access stopped at, while stopped()
+const Breakpoints::Hit & Breakpoints::hit() const
+{
+	return _hit;
+}
+
+// Carries on from a hit, running the instruction of a breakpoint stopped at
+// rather than stopping there again
+void Breakpoints::resume()
+{
+	_continuing = _stopped && _hit.kind == Hit::breakpoint ? _hit.address : -1;
+	_stopped = false;
+}
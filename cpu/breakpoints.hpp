@@ -0,0 +1,166 @@
+#ifndef LVCPU_BREAKPOINTS_HPP_INCLUDED
+#define LVCPU_BREAKPOINTS_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <set>
+#include <vector>
+
+// Execution breakpoints on guest addresses, and watchpoints on reads and
+// writes of address ranges, for stopping a run where it gets interesting.
+//
+// Pages are marked as having breakpoints or being watched, and Mem sends
+// accesses to marked pages the slow way, as it does those to devices, so
+// code and data elsewhere run as fast as ever. The CPU decodes a breakpoint
+// into a stop, and translated code is not made to run over one.
+//
+// A hit is kept until resume(). A breakpoint stops before its instruction
+// runs, and a watchpoint once the access has happened, at the end of the
+// step; translated code leaves its block right after a write that hits,
+// but finishes the block after a read that does.
+class Breakpoints {
+public:
+	enum Access : unsigned {
+		reads = 1,
+		writes = 2
+	};
+
+	struct Watchpoint {
+		std::uint16_t first;
+		std::uint16_t last;
+		unsigned      access;
+	};
+
+	struct Hit {
+		enum Kind {
+			breakpoint,
+			read,
+			write
+		} kind;
+		std::uint16_t address;
+		std::uint8_t  value;
+	};
+
+private:
+	std::set<std::uint16_t> _breakpoints;
+	std::vector<Watchpoint> _watchpoints;
+	// Non-zero for pages with breakpoints, and pages watched for reads and
+	// for writes
+	std::array<std::uint8_t, 256> _break_pages = {};
+	std::array<std::uint8_t, 256> _read_pages = {};
+	std::array<std::uint8_t, 256> _write_pages = {};
+	bool _stopped = false;
+	Hit _hit = {};
+	// Breakpoint resumed from, which its instruction runs past once
+	std::int32_t _continuing = -1;
+
+	void        update_pages();
+	inline void accessed(Hit::Kind kind, unsigned access, std::uint16_t address, std::uint8_t value);
+
+public:
+	bool                            add_breakpoint(std::uint16_t address);
+	bool                            remove_breakpoint(std::uint16_t address);
+	void                            add_watchpoint(const Watchpoint &watchpoint);
+	bool                            remove_watchpoint(std::size_t index);
+	const std::set<std::uint16_t> & breakpoints() const;
+	const std::vector<Watchpoint> & watchpoints() const;
+	inline bool                     breaks_at(std::uint16_t address) const;
+	inline bool                     breaks_in(std::uint16_t address, unsigned count) const;
+	inline bool                     watches_reads(std::uint8_t page) const;
+	inline bool                     watches_writes(std::uint8_t page) const;
+	inline void                     read(std::uint16_t address, std::uint8_t value);
+	inline void                     wrote(std::uint16_t address, std::uint8_t value);
+	inline void                     stopped_at(std::uint16_t address);
+	inline bool                     continues_at(std::uint16_t address);
+	inline bool                     stopped() const;
+	const Hit &                     hit() const;
+	void                            resume();
+};
+
+bool Breakpoints::breaks_at(const std::uint16_t address) const
+{
+	return _break_pages[address >> 8] && _breakpoints.count(address);
+}
+
+// Whether any of the count bytes from address on has a breakpoint
+bool Breakpoints::breaks_in(const std::uint16_t address, const unsigned count) const
+{
+	for (unsigned i = 0; i < count; ++i) {
+		if (breaks_at(address + i)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Breakpoints::watches_reads(const std::uint8_t page) const
+{
+	return _read_pages[page];
+}
+
+bool Breakpoints::watches_writes(const std::uint8_t page) const
+{
+	return _write_pages[page];
+}
+
+// Stops on the first access of a run to a watched address
+void Breakpoints::accessed(
+	const Hit::Kind     kind,
+	const unsigned      access,
+	const std::uint16_t address,
+	const std::uint8_t  value)
+{
+	if (_stopped) {
+		return;
+	}
+	for (const auto &watchpoint : _watchpoints) {
+		if ((watchpoint.access & access) && address >= watchpoint.first && address <= watchpoint.last) {
+			_stopped = true;
+			_hit = Hit{kind, address, value};
+			return;
+		}
+	}
+}
+
+// The guest read value from address, which is on a page watched for reads
+// or a device page
+void Breakpoints::read(const std::uint16_t address, const std::uint8_t value)
+{
+	if (_read_pages[address >> 8]) {
+		accessed(Hit::read, Access::reads, address, value);
+	}
+}
+
+void Breakpoints::wrote(const std::uint16_t address, const std::uint8_t value)
+{
+	if (_write_pages[address >> 8]) {
+		accessed(Hit::write, Access::writes, address, value);
+	}
+}
+
+void Breakpoints::stopped_at(const std::uint16_t address)
+{
+	if (!_stopped) {
+		_stopped = true;
+		_hit = Hit{Hit::breakpoint, address, 0};
+	}
+}
+
+// Whether the breakpoint at address is being resumed from, and so runs its
+// instruction instead of stopping, this once
+bool Breakpoints::continues_at(const std::uint16_t address)
+{
+	if (_continuing != address) {
+		return false;
+	}
+	_continuing = -1;
+	return true;
+}
+
+bool Breakpoints::stopped() const
+{
+	return _stopped;
+}
+
+#endif // LVCPU_BREAKPOINTS_HPP_INCLUDED
@@ -0,0 +1,195 @@
+#include "console_input.hpp"
+
+#include <algorithm>
+
+#if defined(__unix__)
+	#include <cerrno>
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <unistd.h>
+#endif
+
+#if defined(__unix__)
+
+Console_input::Console_input(const std::string &path, const bool blocking) :
+	_blocking(blocking)
+{
+	_fd = ::open(path.c_str(), O_RDONLY);
+	if (_fd < 0) {
+		return;
+	}
+	if (::pipe(_wake) != 0) {
+		::close(_fd);
+		_fd = -1;
+		return;
+	}
+	_thread = std::thread{&Console_input::run_thread, this};
+}
+
+Console_input::~Console_input()
+{
+	if (_thread.joinable()) {
+		{
+			const std::lock_guard<std::mutex> lock{_mutex};
+			_stopping = true;
+		}
+		_space.notify_one();
+		const char wake = 0;
+		while (::write(_wake[1], &wake, 1) < 0 && errno == EINTR) {
+		}
+		_thread.join();
+	}
+	for (const int fd : {_fd, _wake[0], _wake[1]}) {
+		if (fd >= 0) {
+			::close(fd);
+		}
+	}
+}
+
+bool Console_input::is_open() const
+{
+	return _fd >= 0;
+}
+
+// Waits until the ring has room, returning false if stopped first
+bool Console_input::wait_for_space()
+{
+	const auto has_space = [&] {
+		return _read.load(std::memory_order_relaxed) - _released.load() < capacity;
+	};
+	if (has_space()) {
+		return true;
+	}
+	std::unique_lock<std::mutex> lock{_mutex};
+	_thread_waiting = true;
+	_space.wait(lock, [&] {
+		return has_space() || _stopping;
+	});
+	_thread_waiting = false;
+	return !_stopping;
+}
+
+void Console_input::run_thread()
+{
+	while (wait_for_space()) {
+		::pollfd waits[2] = {{_fd, POLLIN, 0}, {_wake[0], POLLIN, 0}};
+		if (::poll(waits, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (waits[1].revents) {
+			return;
+		}
+		const auto read = _read.load(std::memory_order_relaxed);
+		const auto offset = read % capacity;
+		const auto space = std::min<std::uint64_t>(
+			capacity - (read - _released.load()),
+			capacity - offset
+		);
+		const auto count = ::read(_fd, _ring.data() + offset, space);
+		if (count < 0 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			break;
+		}
+		_read.store(read + count);
+		if (_reader_waiting) {
+			const std::lock_guard<std::mutex> lock{_mutex};
+			_ready.notify_one();
+		}
+	}
+	// Read errors end input as the end of the file does
+	_end = true;
+	const std::lock_guard<std::mutex> lock{_mutex};
+	_ready.notify_one();
+}
+
+// Hands back the get area, which has been read through, to the thread and
+// waits until input beyond it is ready or has ended
+void Console_input::wait_for_input()
+{
+	_released = _taken;
+	if (_thread_waiting) {
+		const std::lock_guard<std::mutex> lock{_mutex};
+		_space.notify_one();
+	}
+	if (_read.load() == _taken) {
+		std::unique_lock<std::mutex> lock{_mutex};
+		_reader_waiting = true;
+		_ready.wait(lock, [&] {
+			return _read.load() != _taken || _end;
+		});
+		_reader_waiting = false;
+	}
+}
+
+// Ready input beyond the get area, without blocking unless made to, when it
+// is only ever 0 if the file could not be opened
+std::streamsize Console_input::showmanyc()
+{
+	if (_blocking && is_open()) {
+		wait_for_input();
+	}
+	const auto ready = _read.load() - _taken;
+	if (ready == 0 && _end && _read.load() == _taken) {
+		return -1;
+	}
+	return ready;
+}
+
+// Hands back the get area to the thread and takes what is ready after it,
+// waiting if nothing is
+Console_input::int_type Console_input::underflow()
+{
+	if (gptr() < egptr()) {
+		return traits_type::to_int_type(*gptr());
+	}
+	if (!is_open()) {
+		return traits_type::eof();
+	}
+	wait_for_input();
+	const auto read = _read.load();
+	if (read == _taken) {
+		return traits_type::eof();
+	}
+	const auto offset = _taken % capacity;
+	const auto count = std::min<std::uint64_t>(read - _taken, capacity - offset);
+	char *const begin = _ring.data() + offset;
+	setg(begin, begin, begin + count);
+	_taken += count;
+	return traits_type::to_int_type(*gptr());
+}
+
+#else
+
+Console_input::Console_input(const std::string &path, bool)
+{
+	_file.open(path, std::ios::in | std::ios::binary);
+}
+
+Console_input::~Console_input() = default;
+
+bool Console_input::is_open() const
+{
+	return _file.is_open();
+}
+
+std::streamsize Console_input::showmanyc()
+{
+	return _file.in_avail();
+}
+
+Console_input::int_type Console_input::underflow()
+{
+	return _file.sgetc();
+}
+
+Console_input::int_type Console_input::uflow()
+{
+	return _file.sbumpc();
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef LVCPU_CONSOLE_INPUT_HPP_INCLUDED
+#define LVCPU_CONSOLE_INPUT_HPP_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(__unix__)
+	#include <fstream>
+#endif
+
+// Stream buffer for the guest's console input, read ahead by a thread of
+// its own. The thread waits on the input and fills a ring, which it shares
+// with the reader of the stream without locking, so in_avail() tells how
+// much input is ready, or -1 at its end, without ever blocking. Reading
+// blocks only when nothing is ready.
+//
+// Made blocking, in_avail() instead waits until input is ready or has
+// ended, so that what it tells never hangs on how far the thread has got.
+//
+// Where threads cannot be woken from a blocking read, input is read
+// straight from the file instead.
+class Console_input final : public std::streambuf {
+#if defined(__unix__)
+	int _fd = -1;
+	// Wakes the thread from waiting on input, to stop it
+	int _wake[2] = {-1, -1};
+	static constexpr std::size_t capacity = 4096;
+	std::vector<char> _ring = std::vector<char>(capacity);
+
+	// Characters read into the ring, and released from it after being
+	// taken by the reader of the stream, so far
+	std::atomic<std::uint64_t> _read{0};
+	std::atomic<std::uint64_t> _released{0};
+	std::atomic<bool> _end{false};
+	// Characters taken into the get area so far
+	std::uint64_t _taken = 0;
+
+	std::mutex _mutex;
+	std::condition_variable _space;
+	std::condition_variable _ready;
+	std::atomic<bool> _thread_waiting{false};
+	std::atomic<bool> _reader_waiting{false};
+	bool _stopping = false;
+	bool _blocking;
+	std::thread _thread;
+
+	void run_thread();
+	bool wait_for_space();
+	void wait_for_input();
+#else
+	std::filebuf _file;
+#endif
+
+protected:
+	std::streamsize showmanyc() override;
+	int_type        underflow() override;
+#if !defined(__unix__)
+	int_type        uflow() override;
+#endif
+
+public:
+	explicit Console_input(const std::string &path, bool blocking = false);
+	~Console_input() override;
+	Console_input(const Console_input &) = delete;
+	Console_input & operator = (const Console_input &) = delete;
+	bool is_open() const;
+};
+
+#endif // LVCPU_CONSOLE_INPUT_HPP_INCLUDED
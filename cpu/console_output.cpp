@@ -0,0 +1,250 @@
+#include "console_output.hpp"
+
+#include <algorithm>
+
+#if defined(__unix__)
+	#include <cerrno>
+	#include <fcntl.h>
+	#include <sys/uio.h>
+	#include <unistd.h>
+#endif
+
+namespace {
+	std::size_t round_up_to_power_of_two(const std::size_t size)
+	{
+		std::size_t result = 1;
+		while (result < size) {
+			result <<= 1;
+		}
+		return result;
+	}
+}
+
+// Opens path for writing, truncating it as std::ofstream would
+Console_output::Console_output(const std::string &path, const Settings &settings) :
+	_settings(settings),
+	_ring(round_up_to_power_of_two(std::max<std::size_t>(settings.capacity, 1))),
+	_mask(_ring.size() - 1)
+{
+#if defined(__unix__)
+	_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+#else
+	_file.open(path, std::ios::binary);
+#endif
+	if (_settings.interval.count() > 0) {
+		_settings.writer_thread = true;
+	}
+	if (_settings.unbuffered) {
+		_settings.writer_thread = false;
+	}
+	reset_put_area();
+	if (is_open() && _settings.writer_thread) {
+		_thread = std::thread{&Console_output::run_writer, this};
+	}
+}
+
+Console_output::~Console_output()
+{
+	if (_thread.joinable()) {
+		{
+			const std::lock_guard<std::mutex> lock{_mutex};
+			_stopping = true;
+		}
+		_wake.notify_one();
+		_thread.join();
+	} else {
+		sync();
+	}
+#if defined(__unix__)
+	if (_fd >= 0) {
+		::close(_fd);
+	}
+#endif
+}
+
+bool Console_output::is_open() const
+{
+#if defined(__unix__)
+	return _fd >= 0;
+#else
+	return _file.is_open();
+#endif
+}
+
+bool Console_output::write_out(
+	const char        *first,
+	std::size_t       first_size,
+	const char        *second,
+	std::size_t       second_size)
+{
+#if defined(__unix__)
+	while (first_size + second_size > 0) {
+		::iovec pieces[2] = {
+			{const_cast<char *>(first), first_size},
+			{const_cast<char *>(second), second_size}
+		};
+		const auto count = first_size ? ::writev(_fd, pieces, 2) : ::write(_fd, second, second_size);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		auto written = static_cast<std::size_t>(count);
+		const auto from_first = std::min(written, first_size);
+		first += from_first;
+		first_size -= from_first;
+		written -= from_first;
+		second_size -= written;
+		second += written;
+	}
+	return true;
+#else
+	_file.write(first, first_size);
+	_file.write(second, second_size);
+	_file.flush();
+	return static_cast<bool>(_file);
+#endif
+}
+
+bool Console_output::write_held()
+{
+	const auto held = _held;
+	_held = 0;
+	return write_out(_ring.data(), held, nullptr, 0);
+}
+
+// Without a writer thread, plain output is put straight into the free part
+// of the ring. Otherwise the put area is left empty, so that every
+// character comes to overflow, to be handed over or checked for newline.
+void Console_output::reset_put_area()
+{
+	if (_settings.writer_thread || _settings.on_newline || _settings.unbuffered) {
+		setp(nullptr, nullptr);
+	} else {
+		setp(_ring.data() + _held, _ring.data() + _ring.size());
+	}
+}
+
+void Console_output::request_drain()
+{
+	{
+		const std::lock_guard<std::mutex> lock{_mutex};
+		_drain_requested = true;
+	}
+	_wake.notify_one();
+}
+
+// Waits until the writer thread has written out every character before
+// target, or failed
+void Console_output::wait_written(const std::uint64_t target)
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	_drain_requested = true;
+	_wake.notify_one();
+	_drained.wait(lock, [&] {
+		return _written.load(std::memory_order_acquire) >= target || _failed.load();
+	});
+}
+
+Console_output::int_type Console_output::put_shared(const char c)
+{
+	const auto put = _put.load(std::memory_order_relaxed);
+	if (put - _written.load(std::memory_order_acquire) == _ring.size()) {
+		wait_written(put - _ring.size() + 1);
+	}
+	if (_failed.load(std::memory_order_relaxed)) {
+		return traits_type::eof();
+	}
+	_ring[put & _mask] = c;
+	_put.store(put + 1, std::memory_order_release);
+	// Half full, so the writer catches up while the guest runs on
+	const bool half_full = put + 1 - _written.load(std::memory_order_relaxed) == _ring.size() / 2;
+	if (half_full || (_settings.on_newline && c == '\n')) {
+		request_drain();
+	}
+	return traits_type::to_int_type(c);
+}
+
+void Console_output::run_writer()
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	for (;;) {
+		const auto requested = [&] {
+			return _drain_requested || _stopping;
+		};
+		if (_settings.interval.count() > 0) {
+			_wake.wait_for(lock, _settings.interval, requested);
+		} else {
+			_wake.wait(lock, requested);
+		}
+		const bool stopping = _stopping;
+		_drain_requested = false;
+		lock.unlock();
+		const auto written = _written.load(std::memory_order_relaxed);
+		const auto put = _put.load(std::memory_order_acquire);
+		if (put != written && !_failed.load(std::memory_order_relaxed)) {
+			const auto offset = written & _mask;
+			const auto first_size = std::min<std::uint64_t>(put - written, _ring.size() - offset);
+			if (!write_out(
+				_ring.data() + offset,
+				first_size,
+				_ring.data(),
+				put - written - first_size
+			)) {
+				_failed.store(true);
+			}
+		}
+		lock.lock();
+		_written.store(put, std::memory_order_release);
+		_drained.notify_all();
+		if (stopping) {
+			return;
+		}
+	}
+}
+
+Console_output::int_type Console_output::overflow(const int_type c)
+{
+	if (traits_type::eq_int_type(c, traits_type::eof())) {
+		return sync() == 0 ? traits_type::not_eof(c) : traits_type::eof();
+	}
+	if (_thread.joinable()) {
+		return put_shared(traits_type::to_char_type(c));
+	}
+	if (!is_open()) {
+		return traits_type::eof();
+	}
+	_held += pptr() - pbase();
+	setp(nullptr, nullptr);
+	const auto put = traits_type::to_char_type(c);
+	bool written = _held < _ring.size() || write_held();
+	if (written) {
+		_ring[_held++] = put;
+		if (_settings.unbuffered || (_settings.on_newline && put == '\n')) {
+			written = write_held();
+		}
+	}
+	reset_put_area();
+	return written ? c : traits_type::eof();
+}
+
+// Writes out everything held, returning once it is written. Cheap when
+// nothing is held, as on flush before each read of input.
+int Console_output::sync()
+{
+	if (_thread.joinable()) {
+		const auto put = _put.load(std::memory_order_relaxed);
+		if (_written.load(std::memory_order_acquire) != put) {
+			wait_written(put);
+		}
+		return _failed.load() ? -1 : 0;
+	}
+	if (!is_open()) {
+		return -1;
+	}
+	_held += pptr() - pbase();
+	const bool written = _held == 0 || write_held();
+	reset_put_area();
+	return written ? 0 : -1;
+}
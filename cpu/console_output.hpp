@@ -0,0 +1,89 @@
+#ifndef LVCPU_CONSOLE_OUTPUT_HPP_INCLUDED
+#define LVCPU_CONSOLE_OUTPUT_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(__unix__)
+	#include <fstream>
+#endif
+
+// Stream buffer for the guest's console output. Output is held in a ring
+// and written out in batches, two pieces at a time with writev where the
+// ring wraps, rather than a system call per character. It is written out
+// when the ring fills, on flush, and as the flush policy asks: at each
+// newline, or every interval from a writer thread.
+//
+// With a writer thread, characters are handed over through the ring, and
+// the guest waits on the writer only when the ring is full or on flush.
+// Without one, plain output is put straight into the ring by sputc, with
+// no call into this class until the ring fills.
+class Console_output final : public std::streambuf {
+public:
+	struct Settings {
+		// Bytes held before writing out, rounded up to a power of two
+		std::size_t capacity = 65536;
+		// Write out at every newline
+		bool on_newline = false;
+		// Time between writes of whatever is held, or zero for none; starts
+		// the writer thread
+		std::chrono::milliseconds interval{0};
+		// Write out from a thread of its own
+		bool writer_thread = false;
+		// Write out every character as it is put
+		bool unbuffered = false;
+	};
+
+private:
+#if defined(__unix__)
+	int _fd = -1;
+#else
+	std::ofstream _file;
+#endif
+	Settings _settings;
+	std::vector<char> _ring;
+	std::size_t _mask;
+
+	// Without a writer thread, characters held before the put area
+	std::size_t _held = 0;
+
+	// With a writer thread, characters put and written out so far
+	std::atomic<std::uint64_t> _put{0};
+	std::atomic<std::uint64_t> _written{0};
+	std::atomic<bool> _failed{false};
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _drained;
+	bool _drain_requested = false;
+	bool _stopping = false;
+	std::thread _thread;
+
+	bool write_out(const char *first, std::size_t first_size, const char *second, std::size_t second_size);
+	bool write_held();
+	void reset_put_area();
+	void request_drain();
+	void wait_written(std::uint64_t target);
+	int_type put_shared(char c);
+	void run_writer();
+
+protected:
+	int_type overflow(int_type c) override;
+	int      sync() override;
+
+public:
+	Console_output(const std::string &path, const Settings &settings);
+	~Console_output() override;
+	Console_output(const Console_output &) = delete;
+	Console_output & operator = (const Console_output &) = delete;
+	bool is_open() const;
+};
+
+#endif // LVCPU_CONSOLE_OUTPUT_HPP_INCLUDED
@@ -0,0 +1,98 @@
+#ifndef LVCPU_COUNTER_PORT_HPP_INCLUDED
+#define LVCPU_COUNTER_PORT_HPP_INCLUDED
+
+#include <chrono>
+#include <cstdint>
+
+#include "cpu.hpp"
+#include "device.hpp"
+
+// The CPU's counters as a device, for guests to measure themselves. Writing
+// a counter number as a word to offset 0 of a page, or its low byte there
+// and then its high byte to offset 1, latches that counter, and offsets 0
+// to 7 then read the latched value, least significant byte first. Reads
+// past offset 7 are 0.
+//
+// Counters are numbered:
+//   0x000  cycles
+//   0x001  instructions
+//   0x002  translated instructions
+//   0x003  bytes fetched
+//   0x004  bytes read
+//   0x005  bytes written
+//   0x006  stack operations
+//   0x007  interrupts
+//   0x008  double faults
+//   0x009  bytes in
+//   0x00A  bytes out
+//   0x00B  host nanoseconds running
+//   0x1xx  instructions with op code xx
+//   0x2xx  interrupts with code xx
+// and other numbers read as 0. All of them read as 0 unless built with
+// counters, but for cycles. Translated code latching a counter sees it as
+// it was when the code started running.
+class Counter_port final : public Device {
+	const CPU *_cpu;
+	std::uint8_t _low = 0;
+	std::uint64_t _latched = 0;
+
+	inline std::uint64_t value(unsigned number) const;
+
+public:
+	inline explicit     Counter_port(const CPU &cpu);
+	inline std::uint8_t read(std::uint16_t address) override;
+	inline void         write(std::uint16_t address, std::uint8_t value) override;
+};
+
+Counter_port::Counter_port(const CPU &cpu) :
+	_cpu(&cpu)
+{}
+
+std::uint64_t Counter_port::value(const unsigned number) const
+{
+	const auto &counters = _cpu->counters();
+	switch (number >> 8) {
+	case 1:
+		return counters.instructions_by_op_code[number & 0xFF];
+	case 2:
+		return counters.interrupts_by_code[number & 0xFF];
+	}
+	switch (number) {
+	case 0x000: return _cpu->cycles();
+	case 0x001: return counters.instructions;
+	case 0x002: return counters.translated_instructions;
+	case 0x003: return counters.bytes_fetched;
+	case 0x004: return counters.bytes_read;
+	case 0x005: return counters.bytes_written;
+	case 0x006: return counters.stack_operations;
+	case 0x007: return counters.interrupts();
+	case 0x008: return counters.double_faults;
+	case 0x009: return counters.bytes_in;
+	case 0x00A: return counters.bytes_out;
+	case 0x00B:
+		return Counters::enabled
+			? std::chrono::duration_cast<std::chrono::nanoseconds>(_cpu->running()).count()
+			: 0;
+	}
+	return 0;
+}
+
+std::uint8_t Counter_port::read(const std::uint16_t address)
+{
+	const auto offset = address & 0xFFu;
+	return offset < 8 ? static_cast<std::uint8_t>(_latched >> 8 * offset) : 0;
+}
+
+void Counter_port::write(const std::uint16_t address, const std::uint8_t value)
+{
+	switch (address & 0xFFu) {
+	case 0:
+		_low = value;
+		break;
+	case 1:
+		_latched = this->value(value << 8 | _low);
+		break;
+	}
+}
+
+#endif // LVCPU_COUNTER_PORT_HPP_INCLUDED
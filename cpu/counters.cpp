@@ -0,0 +1,68 @@
+#include "counters.hpp"
+
+#include <cstdio>
+#include <numeric>
+
+namespace {
+	// Writes the counts that are not zero as an object keyed by their index
+	// in hex
+	void write_json_counts(std::ostream &out, const std::array<std::uint64_t, 256> &counts)
+	{
+		out << "{";
+		const char *separator = "";
+		for (std::size_t i = 0; i < counts.size(); ++i) {
+			if (counts[i]) {
+				char key[8];
+				std::snprintf(key, sizeof key, "0x%02X", static_cast<unsigned>(i));
+				out << separator << "\n\t\t\"" << key << "\": " << counts[i];
+				separator = ",";
+			}
+		}
+		out << (*separator ? "\n\t}" : "}");
+	}
+}
+
+// Interrupts raised, of all codes, double faults included
+std::uint64_t Counters::interrupts() const
+{
+	return std::accumulate(interrupts_by_code.begin(), interrupts_by_code.end(), std::uint64_t{0});
+}
+
+// Writes the counts as a JSON object, with the cycles run and the host time
+// spent running them, not counting time slept to keep to the clock rate
+void Counters::write_json(
+	std::ostream                              &out,
+	const std::uint64_t                       cycles,
+	const std::chrono::steady_clock::duration running
+) const
+{
+	const std::chrono::duration<double, std::nano> nanoseconds = running;
+	const auto flags = out.flags();
+	const auto precision = out.precision(3);
+	out << std::fixed;
+	out << "{\n";
+	out << "\t\"cycles\": " << cycles << ",\n";
+	out << "\t\"instructions\": " << instructions << ",\n";
+	out << "\t\"translated_instructions\": " << translated_instructions << ",\n";
+	out << "\t\"bytes_fetched\": " << bytes_fetched << ",\n";
+	out << "\t\"bytes_read\": " << bytes_read << ",\n";
+	out << "\t\"bytes_written\": " << bytes_written << ",\n";
+	out << "\t\"stack_operations\": " << stack_operations << ",\n";
+	out << "\t\"interrupts\": " << interrupts() << ",\n";
+	out << "\t\"double_faults\": " << double_faults << ",\n";
+	out << "\t\"bytes_in\": " << bytes_in << ",\n";
+	out << "\t\"bytes_out\": " << bytes_out << ",\n";
+	out << "\t\"host_seconds\": " << nanoseconds.count() / 1e9 << ",\n";
+	out << "\t\"host_ns_per_instruction\": ";
+	out << (instructions ? nanoseconds.count() / instructions : 0.0) << ",\n";
+	out << "\t\"mips\": ";
+	out << (nanoseconds.count() > 0 ? instructions * 1e3 / nanoseconds.count() : 0.0) << ",\n";
+	out << "\t\"instructions_by_op_code\": ";
+	write_json_counts(out, instructions_by_op_code);
+	out << ",\n";
+	out << "\t\"interrupts_by_code\": ";
+	write_json_counts(out, interrupts_by_code);
+	out << "\n}\n";
+	out.flags(flags);
+	out.precision(precision);
+}
@@ -0,0 +1,132 @@
+#ifndef LVCPU_COUNTERS_HPP_INCLUDED
+#define LVCPU_COUNTERS_HPP_INCLUDED
+
+#include <cstdint>
+#include <array>
+#include <chrono>
+#include <iostream>
+
+#ifndef LVCPU_COUNTERS
+	#define LVCPU_COUNTERS 0
+#endif
+
+// Counts of what the guest did, kept when built with LVCPU_COUNTERS=1 and
+// otherwise compiled away, counting calls becoming empty.
+//
+// Translated code runs without its instructions being looked at, so it adds
+// to the instructions and bytes fetched only, and to bytes written, its
+// writes going through Mem. The counts by op code, and those of reads and
+// stack operations, are of interpreted instructions alone.
+class Counters {
+public:
+	static constexpr bool enabled = LVCPU_COUNTERS;
+
+	std::uint64_t instructions = 0;
+	std::uint64_t translated_instructions = 0;
+	std::array<std::uint64_t, 256> instructions_by_op_code = {};
+	std::uint64_t bytes_fetched = 0;
+	std::uint64_t bytes_read = 0;
+	std::uint64_t bytes_written = 0;
+	std::uint64_t stack_operations = 0;
+	std::array<std::uint64_t, 256> interrupts_by_code = {};
+	std::uint64_t double_faults = 0;
+	std::uint64_t bytes_in = 0;
+	std::uint64_t bytes_out = 0;
+
+	inline void   retired(std::uint8_t op_code);
+	inline void   dispatched(unsigned instructions, unsigned length);
+	inline void   cut_short(unsigned instructions);
+	inline void   translated(unsigned instructions, unsigned length);
+	inline void   read(unsigned bytes);
+	inline void   wrote(unsigned bytes);
+	inline void   stack_operation(unsigned count = 1);
+	inline void   interrupt(std::uint8_t interrupt_code, bool double_fault);
+	inline void   input();
+	inline void   output();
+	std::uint64_t interrupts() const;
+	void          write_json(
+		std::ostream                        &out,
+		std::uint64_t                       cycles,
+		std::chrono::steady_clock::duration running
+	) const;
+};
+
+// An instruction with this op code ran in the interpreter
+void Counters::retired(const std::uint8_t op_code)
+{
+	if constexpr (enabled) {
+		++instructions_by_op_code[op_code];
+	}
+}
+
+// The interpreter ran instructions taking up length bytes in one dispatch
+void Counters::dispatched(const unsigned instructions, const unsigned length)
+{
+	if constexpr (enabled) {
+		this->instructions += instructions;
+		bytes_fetched += length;
+	}
+}
+
+// A dispatch stopped short of instructions counted in it, to be run again
+void Counters::cut_short(const unsigned instructions)
+{
+	if constexpr (enabled) {
+		this->instructions -= instructions;
+	}
+}
+
+void Counters::translated(const unsigned instructions, const unsigned length)
+{
+	if constexpr (enabled) {
+		this->instructions += instructions;
+		translated_instructions += instructions;
+		bytes_fetched += length;
+	}
+}
+
+void Counters::read(const unsigned bytes)
+{
+	if constexpr (enabled) {
+		bytes_read += bytes;
+	}
+}
+
+void Counters::wrote(const unsigned bytes)
+{
+	if constexpr (enabled) {
+		bytes_written += bytes;
+	}
+}
+
+// A push or pop, RET counting as a pop
+void Counters::stack_operation(const unsigned count)
+{
+	if constexpr (enabled) {
+		stack_operations += count;
+	}
+}
+
+void Counters::interrupt(const std::uint8_t interrupt_code, const bool double_fault)
+{
+	if constexpr (enabled) {
+		++interrupts_by_code[interrupt_code];
+		double_faults += double_fault;
+	}
+}
+
+void Counters::input()
+{
+	if constexpr (enabled) {
+		++bytes_in;
+	}
+}
+
+void Counters::output()
+{
+	if constexpr (enabled) {
+		++bytes_out;
+	}
+}
+
+#endif // LVCPU_COUNTERS_HPP_INCLUDED
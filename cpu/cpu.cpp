@@ -1,46 +1,15 @@
 #include "cpu.hpp"
 #include "bin_utils.hpp"
 
-#include <cmath>
 #include <algorithm>
+#include <cstring>
 #include <utility>
 #include <stdexcept>
-#include <thread>
 #include <vector>
 #include <array>
 #include <unordered_set>
 #include <unordered_map>
 
-namespace {
-	inline void sometimes_yield()
-	{
-		//TODO
-	}
-}
-
-void CPU::clock_tick()
-{
-	if (_clock_multiplier_stage != _clock_multiplier - 1) {
-		++_clock_multiplier_stage;
-	} else {
-		_clock_multiplier_stage = 0;
-		auto now = std::chrono::high_resolution_clock::now();
-		while (now < _next_tick) {
-			sometimes_yield();
-			now = std::chrono::high_resolution_clock::now();
-		}
-		_next_tick += _clock_period;
-	}
-}
-
-std::uint8_t CPU::instruction_fetch()
-{
-	clock_tick();
-	const auto fetched_byte = _mem->read(_ip);
-	++_ip;
-	return fetched_byte;
-}
-
 namespace {
 	bool is_interrupt_code_error(const std::uint8_t interrupt_code)
 	{
@@ -56,6 +25,10 @@ void CPU::raise_interrupt(const std::uint8_t interrupt_code)
 	if (_interrupt_handling) {
 		if (_interrupt_level == 2) {
 			_power_on = false;
+			_counters.interrupt(interrupt_code, true);
+			if (_trace) {
+				trace_interrupt(interrupt_code, true);
+			}
 			return;
 		}
 		_shadow.a = _ip;
@@ -65,95 +38,112 @@ void CPU::raise_interrupt(const std::uint8_t interrupt_code)
 			_ip = 16u * interrupt_code + 2048u * _t;
 		}
 		++_interrupt_level;
+		_counters.interrupt(interrupt_code, false);
+		if (_trace) {
+			trace_interrupt(interrupt_code, false);
+		}
+		if (_profiler) {
+			_profiler->interrupted(interrupt_code);
+		}
 	}
 }
 
-void CPU::bad_op_code()
+void CPU::trace_interrupt(const std::uint8_t interrupt_code, const bool double_fault)
+{
+	_trace->raised_interrupt(
+		_pacer.cycles(),
+		interrupt_code,
+		double_fault,
+		_ip,
+		_primary.a,
+		_primary.c,
+		_primary.sp,
+		_primary.bp,
+		_primary.f
+	);
+}
+
+void CPU::bad_op_code(const Decoded_instruction &)
 {
 	raise_interrupt(0x0);
 }
 
-void CPU::bad_parameter()
+void CPU::bad_parameter(const Decoded_instruction &)
 {
 	raise_interrupt(0x0);
 }
 
 namespace {
-	inline bool is_g8(const std::uint8_t code)
+	constexpr bool is_g8(const std::uint8_t code)
 	{
 		return code < 0x4u;
 	}
 
-	inline bool is_g16(const std::uint8_t code)
+	constexpr bool is_g16(const std::uint8_t code)
 	{
 		return code < 0x2u;
 	}
 
-	inline bool is_r16(const std::uint8_t code)
+	constexpr bool is_r16(const std::uint8_t code)
 	{
 		return code < 0x4u;
 	}
 }
 
-void CPU::set_g8(const std::uint8_t code, const std::uint8_t value)
+template <std::uint8_t code>
+void CPU::set_g8(const std::uint8_t value)
 {
-	switch (code) {
-	case 0x0:
+	static_assert(is_g8(code), "set_g8() instantiated with invalid register code");
+	if constexpr (code == 0x0) {
 		_primary.a = make_word(value, get_high_byte(_primary.a));
-		break;
-	case 0x1:
+	} else if constexpr (code == 0x1) {
 		_primary.a = make_word(get_low_byte(_primary.a), value);
-		break;
-	case 0x2:
+	} else if constexpr (code == 0x2) {
 		_primary.c = make_word(value, get_high_byte(_primary.c));
-		break;
-	case 0x3:
+	} else {
 		_primary.c = make_word(get_low_byte(_primary.c), value);
-		break;
-	default:
-		throw std::domain_error{"set_g8() called with invalid register code"};
 	}
 }
 
-std::uint8_t CPU::get_g8(const std::uint8_t code)
+template <std::uint8_t code>
+std::uint8_t CPU::get_g8()
 {
-	switch (code) {
-	case 0x0:
+	static_assert(is_g8(code), "get_g8() instantiated with invalid register code");
+	if constexpr (code == 0x0) {
 		return get_low_byte(_primary.a);
-	case 0x1:
+	} else if constexpr (code == 0x1) {
 		return get_high_byte(_primary.a);
-	case 0x2:
+	} else if constexpr (code == 0x2) {
 		return get_low_byte(_primary.c);
-	case 0x3:
+	} else {
 		return get_high_byte(_primary.a);
 	}
-	throw std::domain_error{"get_g8() called with invalid register code"};
 }
 
-std::uint16_t & CPU::get_g16(const std::uint8_t code)
+template <std::uint8_t code>
+std::uint16_t & CPU::get_g16()
 {
-	switch (code) {
-	case 0x0:
+	static_assert(is_g16(code), "get_g16() instantiated with invalid register code");
+	if constexpr (code == 0x0) {
 		return _primary.a;
-	case 0x1:
+	} else {
 		return _primary.c;
 	}
-	throw std::domain_error{"get_g16() called with invalid register code"};
 }
 
-std::uint16_t & CPU::get_r16(const std::uint8_t code)
+template <std::uint8_t code>
+std::uint16_t & CPU::get_r16()
 {
-	switch (code) {
-	case 0x0:
+	static_assert(is_r16(code), "get_r16() instantiated with invalid register code");
+	if constexpr (code == 0x0) {
 		return _primary.a;
-	case 0x1:
+	} else if constexpr (code == 0x1) {
 		return _primary.c;
-	case 0x2:
+	} else if constexpr (code == 0x2) {
 		return _primary.sp;
-	case 0x3:
+	} else {
 		return _primary.bp;
 	}
-	throw std::domain_error{"get_g16() called with invalid register code"};
 }
 
 void CPU::set_zero_flag(const bool state)
@@ -184,7 +174,27 @@ bool CPU::get_carry_flag()
 	return _primary.f & 2u;
 }
 
-void CPU::byte_op_nop()
+void CPU::set_flags(const bool zero, const bool carry)
+{
+	_primary.f = (_primary.f & (0xFFu ^ 3u)) | zero | carry << 1;
+}
+
+template <std::uint8_t jump_op_code>
+bool CPU::jump_condition()
+{
+	if constexpr (jump_op_code == 0x41) {
+		return get_zero_flag();
+	} else if constexpr (jump_op_code == 0x42) {
+		return get_carry_flag();
+	} else if constexpr (jump_op_code == 0x43) {
+		return !get_zero_flag();
+	} else {
+		static_assert(jump_op_code == 0x44, "jump_condition() instantiated with invalid op code");
+		return !get_carry_flag();
+	}
+}
+
+void CPU::byte_op_nop(const Decoded_instruction &)
 {
 }
 
@@ -200,232 +210,150 @@ namespace {
 	}
 }
 
-void CPU::byte_op_add_g8()
+template <std::uint8_t p1_code, std::uint8_t p2_code>
+void CPU::byte_op_add_g8(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_code = get_high_nibble(params);
-	const auto p2_code = get_low_nibble(params);
-	if (is_g8(p1_code) && is_g8(p2_code)) {
-		set_carry_flag(n8_carry(get_g8(p1_code), get_g8(p2_code)));
-		set_g8(p1_code, get_g8(p1_code) + get_g8(p2_code));
-		set_zero_flag(get_g8(p1_code) == 0);
-	} else {
-		bad_parameter();
-	}
+	set_carry_flag(n8_carry(get_g8<p1_code>(), get_g8<p2_code>()));
+	set_g8<p1_code>(get_g8<p1_code>() + get_g8<p2_code>());
+	set_zero_flag(get_g8<p1_code>() == 0);
 }
 
-void CPU::byte_op_add_r16()
+template <std::uint8_t p1_code, std::uint8_t p2_code>
+void CPU::byte_op_add_r16(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_code = get_high_nibble(params);
-	const auto p2_code = get_low_nibble(params);
-	if (is_r16(p1_code) && is_r16(p2_code)) {
-		set_carry_flag(n16_carry(get_r16(p1_code), get_r16(p2_code)));
-		get_r16(p1_code) += get_r16(p2_code);
-		set_zero_flag(get_r16(p1_code) == 0);
-	} else {
-		bad_parameter();
-	}
+	set_carry_flag(n16_carry(get_r16<p1_code>(), get_r16<p2_code>()));
+	get_r16<p1_code>() += get_r16<p2_code>();
+	set_zero_flag(get_r16<p1_code>() == 0);
 }
 
-void CPU::byte_op_sub_g8()
+template <std::uint8_t p1_code, std::uint8_t p2_code>
+void CPU::byte_op_sub_g8(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_code = get_high_nibble(params);
-	const auto p2_code = get_low_nibble(params);
-	if (is_g8(p1_code) && is_g8(p2_code)) {
-		set_g8(p1_code, get_g8(p1_code) - get_g8(p2_code));
-		set_zero_flag(get_g8(p1_code) == 0);
-	} else {
-		bad_parameter();
-	}
+	set_g8<p1_code>(get_g8<p1_code>() - get_g8<p2_code>());
+	set_zero_flag(get_g8<p1_code>() == 0);
 }
 
-void CPU::byte_op_sub_r16()
+template <std::uint8_t p1_code, std::uint8_t p2_code>
+void CPU::byte_op_sub_r16(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_code = get_high_nibble(params);
-	const auto p2_code = get_low_nibble(params);
-	if (is_r16(p1_code) && is_r16(p2_code)) {
-		get_r16(p1_code) -= get_r16(p2_code);
-		set_zero_flag(get_r16(p1_code) == 0);
-	} else {
-		bad_parameter();
-	}
+	get_r16<p1_code>() -= get_r16<p2_code>();
+	set_zero_flag(get_r16<p1_code>() == 0);
 }
 
-void CPU::byte_op_inc()
+void CPU::byte_op_inc(const Decoded_instruction &)
 {
 	++_primary.c;
 }
 
-void CPU::byte_op_dec()
+void CPU::byte_op_dec(const Decoded_instruction &)
 {
 	--_primary.c;
 }
 
-void CPU::byte_op_neg()
+template <std::uint8_t p2_code>
+void CPU::byte_op_neg_g8(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_mode = get_high_nibble(params);
-	const auto p2_code = get_low_nibble(params);
-	if (p1_mode == 0) {
-		if (is_g8(p2_code)) {
-			set_g8(p2_code, -get_g8(p2_code));
-		} else {
-			bad_parameter();
-		}
-	} else if (p1_mode == 1) {
-		if (is_g16(p2_code)) {
-			get_g16(p2_code) *= -1;
-		} else {
-			bad_parameter();
-		}
-	} else {
-		bad_parameter();
-	}
+	set_g8<p2_code>(-get_g8<p2_code>());
 }
 
-void CPU::byte_op_and()
+template <std::uint8_t p2_code>
+void CPU::byte_op_neg_g16(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_code = get_high_nibble(params);
-	const auto p2_code = get_low_nibble(params);
-	if (is_g8(p1_code) && is_g8(p2_code)) {
-		const auto p1 = get_g8(p1_code);
-		const auto p2 = get_g8(p2_code);
-		set_g8(p1_code, p1 & p2);
-	} else {
-		bad_parameter();
-	}
+	get_g16<p2_code>() *= -1;
 }
 
-void CPU::byte_op_or()
+template <std::uint8_t p1_code, std::uint8_t p2_code>
+void CPU::byte_op_and(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_code = get_high_nibble(params);
-	const auto p2_code = get_low_nibble(params);
-	if (is_g8(p1_code) && is_g8(p2_code)) {
-		const auto p1 = get_g8(p1_code);
-		const auto p2 = get_g8(p2_code);
-		set_g8(p1_code, p1 | p2);
-	} else {
-		bad_parameter();
-	}
+	const auto p1 = get_g8<p1_code>();
+	const auto p2 = get_g8<p2_code>();
+	set_g8<p1_code>(p1 & p2);
 }
 
-void CPU::byte_op_xor()
+template <std::uint8_t p1_code, std::uint8_t p2_code>
+void CPU::byte_op_or(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_code = get_high_nibble(params);
-	const auto p2_code = get_low_nibble(params);
-	if (is_g8(p1_code) && is_g8(p2_code)) {
-		const auto p1 = get_g8(p1_code);
-		const auto p2 = get_g8(p2_code);
-		set_g8(p1_code, p1 ^ p2);
-	} else {
-		bad_parameter();
-	}
+	const auto p1 = get_g8<p1_code>();
+	const auto p2 = get_g8<p2_code>();
+	set_g8<p1_code>(p1 | p2);
 }
 
-void CPU::byte_op_shift()
+template <std::uint8_t p1_code, std::uint8_t p2_code>
+void CPU::byte_op_xor(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_code = get_high_nibble(params);
-	const auto p2_val = get_low_nibble(params);
-	if (is_g8(p1_code)) {
-		const auto p1 = get_g8(p1_code);
-		if (p2_val > 7) {
-			bad_parameter();
-		} else {
-			set_g8(p1_code, (p1 << p2_val) | (p1 >> (8 - p2_val)));
-		}
-	} else {
-		bad_parameter();
-	}
+	const auto p1 = get_g8<p1_code>();
+	const auto p2 = get_g8<p2_code>();
+	set_g8<p1_code>(p1 ^ p2);
 }
 
-void CPU::byte_op_rotate()
+template <std::uint8_t p1_code, std::uint8_t p2_val>
+void CPU::byte_op_shift(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_code = get_high_nibble(params);
-	const auto p2_val = get_low_nibble(params);
-	if (is_g8(p1_code)) {
-		const auto p1 = get_g8(p1_code);
-		if (p2_val > 7) {
-			set_g8(p1_code, p1 >> (16 - p2_val));
-		} else {
-			set_g8(p1_code, p1 << p2_val);
-		}
-	} else {
-		bad_parameter();
-	}
+	const auto p1 = get_g8<p1_code>();
+	set_g8<p1_code>((p1 << p2_val) | (p1 >> (8 - p2_val)));
 }
 
-void CPU::byte_op_mul()
+template <std::uint8_t p1_code, std::uint8_t p2_val>
+void CPU::byte_op_rotate(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_code = get_high_nibble(params);
-	const auto p2_code = get_low_nibble(params);
-	if (is_g8(p1_code) && is_g8(p2_code)) {
-		set_carry_flag(get_g8(p1_code) * get_g8(p2_code) > 0xFF);
-		set_g8(p1_code, get_g8(p1_code) * get_g8(p2_code));
-	} else if (is_g8(p1_code) && p2_code == 0x4) {
-		set_carry_flag(static_cast<std::uint32_t>(_primary.a) * get_g8(p1_code) > 0xFFFF);
-		_primary.a *= p1_code;
+	const auto p1 = get_g8<p1_code>();
+	if (p2_val > 7) {
+		set_g8<p1_code>(p1 >> (16 - p2_val));
 	} else {
-		bad_parameter();
+		set_g8<p1_code>(p1 << p2_val);
 	}
 }
 
-void CPU::byte_op_mov_g8_g8()
+template <std::uint8_t p1_code, std::uint8_t p2_code>
+void CPU::byte_op_mul_g8(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_code = get_high_nibble(params);
-	const auto p2_code = get_low_nibble(params);
-	if (is_g8(p1_code) && is_g8(p2_code)) {
-		set_g8(p1_code, get_g8(p2_code));
-	} else {
-		bad_parameter();
-	}
+	set_carry_flag(get_g8<p1_code>() * get_g8<p2_code>() > 0xFF);
+	set_g8<p1_code>(get_g8<p1_code>() * get_g8<p2_code>());
 }
 
-void CPU::byte_op_mov_r16_r16()
+template <std::uint8_t p1_code>
+void CPU::byte_op_mul_a(const Decoded_instruction &)
 {
-	const auto params = instruction_fetch();
-	const auto p1_code = get_high_nibble(params);
-	const auto p2_code = get_low_nibble(params);
-	if (is_r16(p1_code) && is_r16(p2_code)) {
-		get_r16(p1_code) = get_r16(p2_code);
-	} else {
-		bad_parameter();
-	}
+	set_carry_flag(static_cast<std::uint32_t>(_primary.a) * get_g8<p1_code>() > 0xFFFF);
+	_primary.a *= p1_code;
 }
 
-void CPU::byte_op_mov_getmisc()
+template <std::uint8_t p1_code, std::uint8_t p2_code>
+void CPU::byte_op_mov_g8_g8(const Decoded_instruction &)
 {
-	const auto param = instruction_fetch();
-	if (param == 0x01) {
-		_primary.a = make_word(_primary.f, get_high_byte(_primary.a));
-	} else if (param == 0x02) {
-		_primary.a = make_word(_ic, get_high_byte(_primary.a));
-	} else if (param == 0x03) {
-		_primary.a = _ip;
-	} else {
-		bad_parameter();
-	}
+	set_g8<p1_code>(get_g8<p2_code>());
+}
+
+template <std::uint8_t p1_code, std::uint8_t p2_code>
+void CPU::byte_op_mov_r16_r16(const Decoded_instruction &)
+{
+	get_r16<p1_code>() = get_r16<p2_code>();
+}
+
+void CPU::byte_op_mov_al_f(const Decoded_instruction &)
+{
+	_primary.a = make_word(_primary.f, get_high_byte(_primary.a));
+}
+
+void CPU::byte_op_mov_al_ic(const Decoded_instruction &)
+{
+	_primary.a = make_word(_ic, get_high_byte(_primary.a));
+}
+
+void CPU::byte_op_mov_a_ip(const Decoded_instruction &)
+{
+	_primary.a = _ip;
 }
 
-void CPU::byte_op_mov_al_bp_ptr()
+void CPU::byte_op_mov_al_bp_ptr(const Decoded_instruction &instruction)
 {
-	const auto value = instruction_fetch();
 	_primary.a = make_word(
-		_mem->read(_primary.bp + static_cast<std::int8_t>(value)),
+		_mem->read(_primary.bp + instruction.value),
 		get_high_byte(_primary.a)
 	);
 }
 
-void CPU::byte_op_mov_al_c_ptr()
+void CPU::byte_op_mov_al_c_ptr(const Decoded_instruction &)
 {
 	_primary.a = make_word(
 		_mem->read(_primary.c),
@@ -433,283 +361,351 @@ void CPU::byte_op_mov_al_c_ptr()
 	);
 }
 
-void CPU::byte_op_mov_bp_ptr_al()
+void CPU::byte_op_mov_bp_ptr_al(const Decoded_instruction &instruction)
 {
-	const auto value = instruction_fetch();
 	_mem->write(
-		_primary.bp + static_cast<std::int8_t>(value),
+		_primary.bp + instruction.value,
 		get_low_byte(_primary.a)
 	);
 }
 
-void CPU::byte_op_mov_c_ptr_al()
+void CPU::byte_op_mov_c_ptr_al(const Decoded_instruction &)
 {
 	_mem->write(_primary.c, get_low_byte(_primary.a));
 }
 
-void CPU::byte_op_mov_a_bp_ptr()
+void CPU::byte_op_mov_a_bp_ptr(const Decoded_instruction &instruction)
 {
-	const auto value = instruction_fetch();
-	_primary.a = make_word(
-		_mem->read(_primary.bp + static_cast<std::int8_t>(value)),
-		_mem->read(_primary.bp + static_cast<std::int8_t>(value) + 1)
-	);
+	_primary.a = _mem->read_word(_primary.bp + instruction.value);
 }
 
-void CPU::byte_op_mov_a_c_ptr()
+void CPU::byte_op_mov_a_c_ptr(const Decoded_instruction &)
 {
-	_primary.a = make_word(
-		_mem->read(_primary.c),
-		_mem->read(_primary.c + 1)
-	);
+	_primary.a = _mem->read_word(_primary.c);
 }
 
-void CPU::byte_op_mov_al_t()
+void CPU::byte_op_mov_al_t(const Decoded_instruction &)
 {
 	_primary.a = make_word(_t, get_high_byte(_primary.a));
 }
 
-void CPU::byte_op_mov_t_al()
+void CPU::byte_op_mov_t_al(const Decoded_instruction &)
 {
 	_t = get_low_byte(_primary.a);
 }
 
-void CPU::byte_op_mov_bp_ptr_a()
+void CPU::byte_op_mov_bp_ptr_a(const Decoded_instruction &instruction)
 {
-	const auto value = instruction_fetch();
-	_mem->write(
-		_primary.bp + static_cast<std::int8_t>(value),
-		get_low_byte(_primary.a)
-	);
-	_mem->write(
-		_primary.bp + static_cast<std::int8_t>(value) + 1,
-		get_high_byte(_primary.a)
-	);
+	_mem->write_word(_primary.bp + instruction.value, _primary.a);
 }
 
-void CPU::byte_op_mov_c_ptr_a()
+void CPU::byte_op_mov_c_ptr_a(const Decoded_instruction &)
 {
-	_mem->write(_primary.c, get_low_byte(_primary.a));
-	_mem->write(_primary.c + 1, get_high_byte(_primary.a));
+	_mem->write_word(_primary.c, _primary.a);
 }
 
-void CPU::byte_op_swp()
+void CPU::byte_op_swp(const Decoded_instruction &)
 {
 	std::swap(_primary, _shadow);
 }
 
-void CPU::byte_op_jp()
+void CPU::byte_op_jp(const Decoded_instruction &instruction)
 {
-	const auto b1 = instruction_fetch();
-	const auto b2 = instruction_fetch();
-	const auto addr = make_word(b1, b2);
-	_ip = addr;
+	_ip = instruction.value;
 }
 
-void CPU::byte_op_jz()
+void CPU::byte_op_jz(const Decoded_instruction &instruction)
 {
-	const auto b1 = instruction_fetch();
-	const auto b2 = instruction_fetch();
-	const auto addr = make_word(b1, b2);
-	if (get_zero_flag()) _ip = addr;
+	if (get_zero_flag()) _ip = instruction.value;
 }
 
-void CPU::byte_op_jc()
+void CPU::byte_op_jc(const Decoded_instruction &instruction)
 {
-	const auto b1 = instruction_fetch();
-	const auto b2 = instruction_fetch();
-	const auto addr = make_word(b1, b2);
-	if (get_carry_flag()) _ip = addr;
+	if (get_carry_flag()) _ip = instruction.value;
 }
 
-void CPU::byte_op_jnz()
+void CPU::byte_op_jnz(const Decoded_instruction &instruction)
 {
-	const auto b1 = instruction_fetch();
-	const auto b2 = instruction_fetch();
-	const auto addr = make_word(b1, b2);
-	if (!get_zero_flag()) _ip = addr;
+	if (!get_zero_flag()) _ip = instruction.value;
 }
 
-void CPU::byte_op_jnc()
+void CPU::byte_op_jnc(const Decoded_instruction &instruction)
 {
-	const auto b1 = instruction_fetch();
-	const auto b2 = instruction_fetch();
-	const auto addr = make_word(b1, b2);
-	if (!get_carry_flag()) _ip = addr;
+	if (!get_carry_flag()) _ip = instruction.value;
 }
 
-void CPU::byte_op_call_n16()
+void CPU::byte_op_call_n16(const Decoded_instruction &instruction)
 {
-	const auto b1 = instruction_fetch();
-	const auto b2 = instruction_fetch();
-	const auto addr = make_word(b1, b2);
-	_ip = addr;
+	_ip = instruction.value;
+	if (_profiler) {
+		_profiler->called(_ip);
+	}
 }
 
-void CPU::byte_op_call_a()
+void CPU::byte_op_call_a(const Decoded_instruction &)
 {
 	_ip = _primary.a;
+	if (_profiler) {
+		_profiler->called(_ip);
+	}
 }
 
-void CPU::byte_op_interrupt()
+void CPU::byte_op_interrupt(const Decoded_instruction &instruction)
 {
-	const auto interrupt_code = instruction_fetch();
-	raise_interrupt(interrupt_code);
+	raise_interrupt(instruction.value);
 }
 
-void CPU::byte_op_ret()
+void CPU::byte_op_ret(const Decoded_instruction &)
 {
-	_ip = make_word(_mem->read(_primary.sp), _mem->read(_primary.sp + 1));
+	_ip = _mem->read_word(_primary.sp);
 	_primary.sp += 2;
+	_counters.stack_operation();
+	if (_profiler) {
+		_profiler->returned();
+	}
 }
 
-void CPU::byte_op_reti()
+void CPU::byte_op_reti(const Decoded_instruction &instruction)
 {
 	_ip = _shadow.a;
 	if (_interrupt_level > 0) {
 		--_interrupt_level;
+		_next_event = 0;
+		if (_profiler) {
+			_profiler->returned_from_interrupt();
+		}
 	} else {
-		bad_parameter();
+		bad_parameter(instruction);
 	}
 }
 
-void CPU::byte_op_eih()
+void CPU::byte_op_eih(const Decoded_instruction &)
 {
 	_interrupt_handling = true;
+	_next_event = 0;
 }
 
-void CPU::byte_op_dih()
+void CPU::byte_op_dih(const Decoded_instruction &)
 {
 	_interrupt_handling = false;
 }
 
-void CPU::byte_op_eci()
+void CPU::byte_op_eci(const Decoded_instruction &)
 {
 	_clock_interrupt = true;
+	_clock_deadline = 0;
+	_next_event = 0;
 }
 
-void CPU::byte_op_dci()
+void CPU::byte_op_dci(const Decoded_instruction &)
 {
 	_clock_interrupt = false;
 }
 
-void CPU::byte_op_esi()
+void CPU::byte_op_esi(const Decoded_instruction &)
 {
 	// not implemented
 }
 
-void CPU::byte_op_dsi()
+void CPU::byte_op_dsi(const Decoded_instruction &)
 {
 	// not implemented
 }
 
-void CPU::byte_op_in()
+void CPU::byte_op_in(const Decoded_instruction &)
 {
-	char input_char;
-	_input->get(input_char);
+	// Waiting only makes sense while something else can happen meanwhile
+	const bool events =
+		!_timers.empty() || _clock_interrupt || _input_interrupt
+		|| std::any_of(_port_timers.begin(), _port_timers.end(), [](const Port_timer &timer) {
+			return timer.running;
+		});
+	if (_input_waits && events && _input->rdbuf()->in_avail() == 0) {
+		if (_input->tie()) {
+			_input->tie()->flush();
+		}
+		_ip -= 1;
+		return;
+	}
+	// At the end of input, IN reads 0, as the input port's data register does
+	char input_char = 0;
+	if (_input->get(input_char)) {
+		_counters.input();
+	}
 	_primary.a = make_word(input_char, get_high_byte(_primary.a));
 }
 
-void CPU::byte_op_out()
+// Straight to the stream buffer, without the sentry ostream::put sets up for
+// each character
+void CPU::byte_op_out(const Decoded_instruction &)
 {
-	_output->put(get_low_byte(_primary.a));
+	const auto put = _output->rdbuf()->sputc(static_cast<char>(get_low_byte(_primary.a)));
+	if (std::ostream::traits_type::eq_int_type(put, std::ostream::traits_type::eof())) {
+		_output->setstate(std::ios::badbit);
+	} else {
+		_counters.output();
+	}
 }
 
-void CPU::byte_op_stop()
+void CPU::byte_op_stop(const Decoded_instruction &)
 {
 	_power_on = false;
+	_output->flush();
 }
 
-void CPU::nibble_op_mov_g8(const std::uint8_t op_param)
+// Decoded in place of the instruction at a breakpoint: stops there, unless
+// resuming from it, when the instruction runs instead
+void CPU::break_point(const Decoded_instruction &)
 {
-	const auto param = instruction_fetch();
-	if (is_g8(op_param)) {
-		set_g8(op_param, param);
-	} else {
-		bad_parameter();
+	if (!_breakpoints->continues_at(_ip)) {
+		_breakpoints->stopped_at(_ip);
+		return;
 	}
+	const auto instruction = decode(_ip);
+	_counters.dispatched(1, instruction.length);
+	_pacer.tick(instruction.length);
+	_ip += instruction.length;
+	(this->*instruction.execute)(instruction);
+	++_ic;
 }
 
-void CPU::nibble_op_mov_r16(const std::uint8_t op_param)
+template <std::uint8_t op_param>
+void CPU::nibble_op_mov_g8(const Decoded_instruction &instruction)
 {
-	const auto p1 = instruction_fetch();
-	const auto p2 = instruction_fetch();
-	if (is_r16(op_param)) {
-		get_r16(op_param) = make_word(p1, p2);
-	} else {
-		bad_parameter();
-	}
+	set_g8<op_param>(instruction.value);
 }
 
-void CPU::nibble_op_push_g8(const std::uint8_t op_param)
+template <std::uint8_t op_param>
+void CPU::nibble_op_mov_r16(const Decoded_instruction &instruction)
 {
-	if (is_g8(op_param)) {
-		_primary.sp -= 1;
-		_mem->write(_primary.sp, get_g8(op_param));
-	} else {
-		bad_parameter();
-	}
+	get_r16<op_param>() = instruction.value;
 }
 
-void CPU::nibble_op_push_r16(const std::uint8_t op_param)
+template <std::uint8_t op_param>
+void CPU::nibble_op_push_g8(const Decoded_instruction &)
 {
-	if (is_r16(op_param)) {
-		_primary.sp -= 2;
-		const auto &reg = get_r16(op_param);
-		_mem->write(_primary.sp, get_low_byte(reg));
-		_mem->write(_primary.sp + 1, get_high_byte(reg));
-	} else {
-		bad_parameter();
-	}
+	_primary.sp -= 1;
+	_mem->write(_primary.sp, get_g8<op_param>());
+	_counters.stack_operation();
 }
 
-void CPU::nibble_op_pop_g8(const std::uint8_t op_param)
+template <std::uint8_t op_param>
+void CPU::nibble_op_push_r16(const Decoded_instruction &)
 {
-	if (is_g8(op_param)) {
-		set_g8(op_param, _mem->read(_primary.sp));
-		_primary.sp += 1;
-	} else {
-		bad_parameter();
-	}
+	_primary.sp -= 2;
+	_mem->write_word(_primary.sp, get_r16<op_param>());
+	_counters.stack_operation();
 }
 
-void CPU::nibble_op_pop_r16(const std::uint8_t op_param)
+template <std::uint8_t op_param>
+void CPU::nibble_op_pop_g8(const Decoded_instruction &)
 {
-	if (is_r16(op_param)) {
-		get_r16(op_param) = make_word(
-			_mem->read(_primary.sp),
-			_mem->read(_primary.sp + 1)
-		);
-		_primary.sp += 2;
-	} else {
-		bad_parameter();
-	}
+	set_g8<op_param>(_mem->read(_primary.sp));
+	_primary.sp += 1;
+	_counters.stack_operation();
+}
+
+template <std::uint8_t op_param>
+void CPU::nibble_op_pop_r16(const Decoded_instruction &)
+{
+	get_r16<op_param>() = _mem->read_word(_primary.sp);
+	_primary.sp += 2;
+	_counters.stack_operation();
+}
+
+template <std::uint8_t op_param>
+void CPU::nibble_op_add_g8(const Decoded_instruction &instruction)
+{
+	const auto value = static_cast<std::uint8_t>(instruction.value);
+	set_carry_flag(n8_carry(get_g8<op_param>(), value));
+	set_g8<op_param>(get_g8<op_param>() + value);
+	set_zero_flag(get_g8<op_param>() == 0);
 }
 
-void CPU::nibble_op_add_g8(const std::uint8_t op_param)
+template <std::uint8_t op_param>
+void CPU::nibble_op_add_r16(const Decoded_instruction &instruction)
 {
-	if (is_g8(op_param)) {
-		const auto value = instruction_fetch();
-		set_carry_flag(n8_carry(get_g8(op_param), value));
-		set_g8(op_param, get_g8(op_param) + value);
-		set_zero_flag(get_g8(op_param) == 0);
+	const auto value = instruction.value;
+	auto &reg = get_r16<op_param>();
+	set_carry_flag(n16_carry(reg, value));
+	reg += value;
+	set_zero_flag(reg == 0);
+}
+
+// ADD g8,n8 or ADD r16,n16 followed by a conditional jump
+template <std::uint8_t add_op_code, std::uint8_t jump_op_code>
+void CPU::fused_add_jump(const Decoded_instruction &instruction)
+{
+	constexpr std::uint8_t op_param = get_low_nibble(add_op_code);
+	if constexpr (get_high_nibble(add_op_code) == 0xE) {
+		const auto p1 = get_g8<op_param>();
+		const auto value = static_cast<std::uint8_t>(instruction.value);
+		set_g8<op_param>(p1 + value);
+		set_flags(get_g8<op_param>() == 0, n8_carry(p1, value));
 	} else {
-		bad_parameter();
+		auto &reg = get_r16<op_param>();
+		const bool carry = n16_carry(reg, instruction.value);
+		reg += instruction.value;
+		set_flags(reg == 0, carry);
 	}
+	if (jump_condition<jump_op_code>()) {
+		_ip = instruction.target;
+	}
+	++_fusions[fusion_add_jump];
+	_counters.retired(jump_op_code);
 }
 
-void CPU::nibble_op_add_r16(const std::uint8_t op_param)
+// MOV AL,[C], ADD AL,n8 and a conditional jump, as when scanning a string
+template <std::uint8_t jump_op_code>
+void CPU::fused_load_add_jump(const Decoded_instruction &instruction)
 {
-	if (is_r16(op_param)) {
-		const auto value_low = instruction_fetch();
-		const auto value_high = instruction_fetch();
-		const auto value = make_word(value_low, value_high);
-		auto &reg = get_r16(op_param);
-		set_carry_flag(n16_carry(get_r16(op_param), value));
-		reg += value;
-		set_zero_flag(reg == 0);
-	} else {
-		bad_parameter();
+	const auto p1 = _mem->read(_primary.c);
+	const auto value = static_cast<std::uint8_t>(instruction.value);
+	const std::uint8_t sum = p1 + value;
+	_primary.a = make_word(sum, get_high_byte(_primary.a));
+	set_flags(sum == 0, n8_carry(p1, value));
+	if (jump_condition<jump_op_code>()) {
+		_ip = instruction.target;
+	}
+	++_fusions[fusion_load_add_jump];
+	_counters.retired(0xE0);
+	_counters.retired(jump_op_code);
+}
+
+// PUSH BP, MOV BP,SP
+void CPU::fused_enter(const Decoded_instruction &instruction)
+{
+	_primary.sp -= 2;
+	_mem->write_word(_primary.sp, _primary.bp);
+	_counters.stack_operation();
+	// MOV BP,SP is the last two bytes of the sequence: when the push wrote
+	// over either of them, MOV is decoded again, and its cycles given back
+	const std::uint16_t mov_address = _ip - 2;
+	if (static_cast<std::uint16_t>(_primary.sp + 1 - mov_address) < 3) {
+		_ip = mov_address;
+		--_ic;
+		_pacer.refund(instruction.length - 1);
+		_counters.cut_short(1);
+		return;
+	}
+	_primary.bp = _primary.sp;
+	++_fusions[fusion_enter];
+	_counters.retired(0x21);
+}
+
+// MOV SP,BP, POP BP, RET
+void CPU::fused_leave(const Decoded_instruction &)
+{
+	_primary.sp = _primary.bp;
+	_primary.bp = _mem->read_word(_primary.sp);
+	_ip = _mem->read_word(_primary.sp + 2);
+	_primary.sp += 4;
+	++_fusions[fusion_leave];
+	_counters.stack_operation(2);
+	_counters.retired(0xD3);
+	_counters.retired(0x4B);
+	if (_profiler) {
+		_profiler->returned();
 	}
 }
 
@@ -719,219 +715,695 @@ CPU::CPU(
 	std::istream &input,
 	std::ostream &output
 ) :
-	_clock_period(
-		std::max(
-			static_cast<std::chrono::microseconds::rep>(
-				1'000'000/clock_rate - std::fmod(1'000'000/clock_rate, 20000.)
-			),
-			std::chrono::microseconds::rep{20'000}
-		)
-	),
-	_clock_multiplier(std::max(1., clock_rate / 50)),
-	_next_tick(std::chrono::high_resolution_clock::now()),
+	CPU(mem, clock_rate, input, output, Options{})
+{}
+
+CPU::CPU(
+	Mem           &mem,
+	const double  clock_rate,
+	std::istream  &input,
+	std::ostream  &output,
+	const Options &options
+) :
+	_pacer(clock_rate, options.pacing_quantum, options.clock_mode),
+	_pacing_report(options.pacing_report),
 	_mem(&mem),
 	_input(&input),
-	_output(&output)
-{
-	if (clock_rate <= 0) {
-		throw std::out_of_range{"CPU clock_rate given not positive"};
+	_output(&output),
+	_input_waits(options.input_waits),
+	_input_interrupt(options.input_interrupt),
+	_input_poll_period(options.pacing_quantum),
+	_fusion(options.fusion),
+	_profile_interval(options.profile_interval)
+{
+	if (_input_interrupt && (_input_interrupt < 0x10 || _input_interrupt > 0x3F)) {
+		throw std::out_of_range{"CPU input_interrupt not a hardware interrupt"};
+	}
+	_mem->attach(&_decode_cache);
+	if constexpr (Counters::enabled) {
+		_mem->attach(&_counters);
+	}
+	if (options.engine == Engine::jit && !_profile_interval) {
+		_jit = std::make_unique<Jit>(*_mem);
+	}
+	if (options.opcode_profile) {
+		_opcode_profile = std::make_unique<Opcode_profile>();
+	}
+	if (options.trace_records) {
+		_trace = std::make_unique<Trace>(options.trace_records);
+		_mem->attach(_trace.get());
+	}
+	if (options.breakpoints) {
+		_breakpoints = options.breakpoints;
+		_mem->attach(_breakpoints.get());
 	}
+	for (const auto &settings : options.timers) {
+		_timers.emplace_back(settings);
+		_scheduler.schedule(_timers.size() - 1, settings.period);
+	}
+	if (_input_interrupt) {
+		_scheduler.schedule(_timers.size(), _input_poll_period);
+	}
+	if (_profile_interval) {
+		_profiler = std::make_unique<Profiler>(options.profile_symbols);
+		_scheduler.schedule(_timers.size() + 1, _profile_interval);
+	}
+	update_next_event();
 }
 
-void CPU::byte_op(const std::uint8_t op_code)
+CPU::~CPU()
 {
-	switch(op_code) {
+	_mem->attach(static_cast<Decode_cache *>(nullptr));
+	if (_trace) {
+		_mem->attach(static_cast<Trace *>(nullptr));
+	}
+	if constexpr (Counters::enabled) {
+		_mem->attach(static_cast<Counters *>(nullptr));
+	}
+	if (_breakpoints) {
+		_mem->attach(static_cast<Breakpoints *>(nullptr));
+	}
+}
+
+// Picks the handler specialized for a byte op and its register parameter
+// byte, or bad_parameter when the parameter byte does not encode a valid
+// operand combination.
+template <std::uint8_t op_code, std::uint8_t param>
+constexpr Decoded_instruction::Handler CPU::param_op_handler()
+{
+	constexpr std::uint8_t p1 = get_high_nibble(param);
+	constexpr std::uint8_t p2 = get_low_nibble(param);
+	constexpr bool g8_g8 = is_g8(p1) && is_g8(p2);
+	constexpr bool r16_r16 = is_r16(p1) && is_r16(p2);
+
+	if constexpr (op_code == 0x01 && g8_g8) {
+		return &CPU::byte_op_add_g8<p1, p2>;
+	} else if constexpr (op_code == 0x02 && r16_r16) {
+		return &CPU::byte_op_add_r16<p1, p2>;
+	} else if constexpr (op_code == 0x03 && g8_g8) {
+		return &CPU::byte_op_sub_g8<p1, p2>;
+	} else if constexpr (op_code == 0x04 && r16_r16) {
+		return &CPU::byte_op_sub_r16<p1, p2>;
+	} else if constexpr (op_code == 0x07 && p1 == 0 && is_g8(p2)) {
+		return &CPU::byte_op_neg_g8<p2>;
+	} else if constexpr (op_code == 0x07 && p1 == 1 && is_g16(p2)) {
+		return &CPU::byte_op_neg_g16<p2>;
+	} else if constexpr (op_code == 0x08 && g8_g8) {
+		return &CPU::byte_op_and<p1, p2>;
+	} else if constexpr (op_code == 0x09 && g8_g8) {
+		return &CPU::byte_op_or<p1, p2>;
+	} else if constexpr (op_code == 0x0A && g8_g8) {
+		return &CPU::byte_op_xor<p1, p2>;
+	} else if constexpr (op_code == 0x0B && is_g8(p1) && p2 <= 7) {
+		return &CPU::byte_op_shift<p1, p2>;
+	} else if constexpr (op_code == 0x0C && is_g8(p1)) {
+		return &CPU::byte_op_rotate<p1, p2>;
+	} else if constexpr (op_code == 0x0D && g8_g8) {
+		return &CPU::byte_op_mul_g8<p1, p2>;
+	} else if constexpr (op_code == 0x0D && is_g8(p1) && p2 == 0x4) {
+		return &CPU::byte_op_mul_a<p1>;
+	} else if constexpr (op_code == 0x20 && g8_g8) {
+		return &CPU::byte_op_mov_g8_g8<p1, p2>;
+	} else if constexpr (op_code == 0x21 && r16_r16) {
+		return &CPU::byte_op_mov_r16_r16<p1, p2>;
+	} else {
+		return &CPU::bad_parameter;
+	}
+}
+
+template <std::uint8_t op_code, std::size_t... params>
+constexpr std::array<Decoded_instruction::Handler, 256> CPU::make_param_op_handlers(
+	std::index_sequence<params...>
+)
+{
+	return {{param_op_handler<op_code, params>()...}};
+}
+
+template <std::uint8_t op_code>
+const std::array<Decoded_instruction::Handler, 256> & CPU::param_op_handlers()
+{
+	static constexpr auto handlers =
+		make_param_op_handlers<op_code>(std::make_index_sequence<256>{});
+	return handlers;
+}
+
+// Picks the handler specialized for a nibble op and the register encoded in
+// its low nibble.
+template <std::uint8_t op_code>
+constexpr Decoded_instruction::Handler CPU::nibble_op_handler()
+{
+	constexpr std::uint8_t op_nibble = get_high_nibble(op_code);
+	constexpr std::uint8_t op_param = get_low_nibble(op_code);
+
+	if constexpr (op_nibble < 0x8) {
+		return &CPU::bad_op_code;
+	} else if constexpr (op_nibble == 0x8 && is_g8(op_param)) {
+		return &CPU::nibble_op_mov_g8<op_param>;
+	} else if constexpr (op_nibble == 0x9 && is_r16(op_param)) {
+		return &CPU::nibble_op_mov_r16<op_param>;
+	} else if constexpr (op_nibble == 0xA && is_g8(op_param)) {
+		return &CPU::nibble_op_push_g8<op_param>;
+	} else if constexpr (op_nibble == 0xB && is_r16(op_param)) {
+		return &CPU::nibble_op_push_r16<op_param>;
+	} else if constexpr (op_nibble == 0xC && is_g8(op_param)) {
+		return &CPU::nibble_op_pop_g8<op_param>;
+	} else if constexpr (op_nibble == 0xD && is_r16(op_param)) {
+		return &CPU::nibble_op_pop_r16<op_param>;
+	} else if constexpr (op_nibble == 0xE && is_g8(op_param)) {
+		return &CPU::nibble_op_add_g8<op_param>;
+	} else if constexpr (op_nibble == 0xF && is_r16(op_param)) {
+		return &CPU::nibble_op_add_r16<op_param>;
+	} else {
+		return &CPU::bad_parameter;
+	}
+}
+
+template <std::size_t... op_codes>
+constexpr std::array<Decoded_instruction::Handler, 256> CPU::make_nibble_op_handlers(
+	std::index_sequence<op_codes...>
+)
+{
+	return {{nibble_op_handler<op_codes>()...}};
+}
+
+const std::array<Decoded_instruction::Handler, 256> & CPU::nibble_op_handlers()
+{
+	static constexpr auto handlers =
+		make_nibble_op_handlers(std::make_index_sequence<256>{});
+	return handlers;
+}
+
+Decoded_instruction CPU::decode(const std::uint16_t address)
+{
+	// Operands are fetched with the op code from RAM, but from a device
+	// only once the op code calls for them, so that code next to a device
+	// does not read it
+	std::array<std::uint8_t, 3> bytes;
+	const auto ahead = _mem->is_ram(address + 1) && _mem->is_ram(address + 2);
+	_mem->fetch(address, bytes.data(), ahead ? bytes.size() : 1);
+	const auto fetch_byte = [&](const std::uint16_t byte_address) {
+		std::uint8_t byte;
+		_mem->fetch(byte_address, &byte, 1);
+		return byte;
+	};
+	const auto op_code = bytes[0];
+	const auto byte_1 = [&] { return ahead ? bytes[1] : fetch_byte(address + 1); };
+	const auto byte_2 = [&] { return ahead ? bytes[2] : fetch_byte(address + 2); };
+	const auto n16 = [&] {
+		const auto low_byte = byte_1();
+		return make_word(low_byte, byte_2());
+	};
+
+	// Operands are fetched even when they turn out to be invalid, so
+	// length does not depend on validity unless noted otherwise.
+	const auto op = [](const Handler handler, const std::uint8_t length) {
+		return Decoded_instruction{handler, length};
+	};
+	const auto op_i8 = [&](const Handler handler) {
+		return Decoded_instruction{
+			handler, 2, static_cast<std::uint16_t>(static_cast<std::int8_t>(byte_1()))
+		};
+	};
+	const auto op_n16 = [&](const Handler handler) {
+		return Decoded_instruction{handler, 3, n16()};
+	};
+
+	switch (op_code) {
 	case 0x00:
-		byte_op_nop();
-		break;
+		return op(&CPU::byte_op_nop, 1);
 	case 0x01:
-		byte_op_add_g8();
-		break;
+		return op(param_op_handlers<0x01>()[byte_1()], 2);
 	case 0x02:
-		byte_op_add_r16();
-		break;
+		return op(param_op_handlers<0x02>()[byte_1()], 2);
 	case 0x03:
-		byte_op_sub_g8();
-		break;
+		return op(param_op_handlers<0x03>()[byte_1()], 2);
 	case 0x04:
-		byte_op_sub_r16();
-		break;
+		return op(param_op_handlers<0x04>()[byte_1()], 2);
 	case 0x05:
-		byte_op_inc();
-		break;
+		return op(&CPU::byte_op_inc, 1);
 	case 0x06:
-		byte_op_dec();
-		break;
+		return op(&CPU::byte_op_dec, 1);
 	case 0x07:
-		byte_op_neg();
-		break;
+		return op(param_op_handlers<0x07>()[byte_1()], 2);
 	case 0x08:
-		byte_op_and();
-		break;
+		return op(param_op_handlers<0x08>()[byte_1()], 2);
 	case 0x09:
-		byte_op_or();
-		break;
+		return op(param_op_handlers<0x09>()[byte_1()], 2);
 	case 0x0A:
-		byte_op_xor();
-		break;
+		return op(param_op_handlers<0x0A>()[byte_1()], 2);
 	case 0x0B:
-		byte_op_shift();
-		break;
+		return op(param_op_handlers<0x0B>()[byte_1()], 2);
 	case 0x0C:
-		byte_op_rotate();
-		break;
+		return op(param_op_handlers<0x0C>()[byte_1()], 2);
 	case 0x0D:
-		byte_op_mul();
-		break;
+		return op(param_op_handlers<0x0D>()[byte_1()], 2);
 	case 0x20:
-		byte_op_mov_g8_g8();
-		break;
+		return op(param_op_handlers<0x20>()[byte_1()], 2);
 	case 0x21:
-		byte_op_mov_r16_r16();
-		break;
+		return op(param_op_handlers<0x21>()[byte_1()], 2);
 	case 0x22:
-		byte_op_mov_getmisc();
-		break;
+		switch (byte_1()) {
+		case 0x01:
+			return op(&CPU::byte_op_mov_al_f, 2);
+		case 0x02:
+			return op(&CPU::byte_op_mov_al_ic, 2);
+		case 0x03:
+			return op(&CPU::byte_op_mov_a_ip, 2);
+		}
+		return op(&CPU::bad_parameter, 2);
 	case 0x23:
-		byte_op_mov_al_bp_ptr();
-		break;
+		return op_i8(&CPU::byte_op_mov_al_bp_ptr);
 	case 0x24:
-		byte_op_mov_al_c_ptr();
-		break;
+		return op(&CPU::byte_op_mov_al_c_ptr, 1);
 	case 0x25:
-		byte_op_mov_bp_ptr_al();
-		break;
+		return op_i8(&CPU::byte_op_mov_bp_ptr_al);
 	case 0x26:
-		byte_op_mov_c_ptr_al();
-		break;
+		return op(&CPU::byte_op_mov_c_ptr_al, 1);
 	case 0x28:
-		byte_op_swp();
-		break;
+		return op(&CPU::byte_op_swp, 1);
 	case 0x29:
-		byte_op_mov_a_bp_ptr();
-		break;
+		return op_i8(&CPU::byte_op_mov_a_bp_ptr);
 	case 0x2A:
-		byte_op_mov_a_c_ptr();
-		break;
+		return op(&CPU::byte_op_mov_a_c_ptr, 1);
 	case 0x2B:
-		byte_op_mov_al_t();
-		break;
+		return op(&CPU::byte_op_mov_al_t, 1);
 	case 0x2C:
-		byte_op_mov_t_al();
-		break;
+		return op(&CPU::byte_op_mov_t_al, 1);
 	case 0x2D:
-		byte_op_mov_bp_ptr_a();
-		break;
+		return op_i8(&CPU::byte_op_mov_bp_ptr_a);
 	case 0x2E:
-		byte_op_mov_c_ptr_a();
-		break;
+		return op(&CPU::byte_op_mov_c_ptr_a, 1);
 	case 0x40:
-		byte_op_jp();
-		break;
+		return op_n16(&CPU::byte_op_jp);
 	case 0x41:
-		byte_op_jz();
-		break;
+		return op_n16(&CPU::byte_op_jz);
 	case 0x42:
-		byte_op_jc();
-		break;
+		return op_n16(&CPU::byte_op_jc);
 	case 0x43:
-		byte_op_jnz();
-		break;
+		return op_n16(&CPU::byte_op_jnz);
 	case 0x44:
-		byte_op_jnc();
-		break;
+		return op_n16(&CPU::byte_op_jnc);
 	case 0x48:
-		byte_op_call_n16();
-		break;
+		return op_n16(&CPU::byte_op_call_n16);
 	case 0x49:
-		byte_op_call_a();
-		break;
+		return op(&CPU::byte_op_call_a, 1);
 	case 0x4A:
-		byte_op_interrupt();
-		break;
+		return Decoded_instruction{&CPU::byte_op_interrupt, 2, byte_1()};
 	case 0x4B:
-		byte_op_ret();
-		break;
+		return op(&CPU::byte_op_ret, 1);
 	case 0x4C:
-		byte_op_reti();
-		break;
+		return op(&CPU::byte_op_reti, 1);
 	case 0x50:
-		byte_op_eih();
-		break;
+		return op(&CPU::byte_op_eih, 1);
 	case 0x51:
-		byte_op_dih();
-		break;
+		return op(&CPU::byte_op_dih, 1);
 	case 0x52:
-		byte_op_eci();
-		break;
+		return op(&CPU::byte_op_eci, 1);
 	case 0x53:
-		byte_op_dci();
-		break;
+		return op(&CPU::byte_op_dci, 1);
 	case 0x54:
-		byte_op_esi();
-		break;
+		return op(&CPU::byte_op_esi, 1);
 	case 0x55:
-		byte_op_dsi();
-		break;
+		return op(&CPU::byte_op_dsi, 1);
 	case 0x60:
-		byte_op_in();
-		break;
+		return op(&CPU::byte_op_in, 1);
 	case 0x61:
-		byte_op_out();
-		break;
+		return op(&CPU::byte_op_out, 1);
 	case 0x70:
-		byte_op_stop();
-		break;
-	default:
-		bad_op_code();
-		break;
+		return op(&CPU::byte_op_stop, 1);
 	}
-}
 
-void CPU::nibble_op(const std::uint8_t op_nibble, const std::uint8_t op_param)
-{
-	switch (op_nibble) {
+	const auto handler = nibble_op_handlers()[op_code];
+	const auto op_param = get_low_nibble(op_code);
+	switch (get_high_nibble(op_code)) {
 	case 0x8:
-		nibble_op_mov_g8(op_param);
-		break;
+		return Decoded_instruction{handler, 2, byte_1()};
 	case 0x9:
-		nibble_op_mov_r16(op_param);
-		break;
-	case 0xA:
-		nibble_op_push_g8(op_param);
-		break;
-	case 0xB:
-		nibble_op_push_r16(op_param);
-		break;
-	case 0xC:
-		nibble_op_pop_g8(op_param);
-		break;
-	case 0xD:
-		nibble_op_pop_r16(op_param);
-		break;
+		return Decoded_instruction{handler, 3, n16()};
 	case 0xE:
-		nibble_op_add_g8(op_param);
-		break;
+		// Immediate is only fetched once the register is known to be valid
+		if (is_g8(op_param)) {
+			return Decoded_instruction{handler, 2, byte_1()};
+		}
+		return op(handler, 1);
 	case 0xF:
-		nibble_op_add_r16(op_param);
-		break;
+		if (is_r16(op_param)) {
+			return Decoded_instruction{handler, 3, n16()};
+		}
+		return op(handler, 1);
 	default:
-		throw std::domain_error{"select_nibble_op() called with bad op code"};
+		return op(handler, 1);
+	}
+}
+
+// Fused handlers for ADD g8,n8 (E0-E3) then ADD r16,n16 (F0-F3), each
+// followed by JZ, JC, JNZ or JNC.
+template <std::size_t... indices>
+constexpr std::array<Decoded_instruction::Handler, sizeof...(indices)> CPU::make_fused_add_jump_handlers(
+	std::index_sequence<indices...>
+)
+{
+	return {{
+		&CPU::fused_add_jump<
+			(indices / 16 ? 0xF0 : 0xE0) + indices / 4 % 4,
+			0x41 + indices % 4
+		>...
+	}};
+}
+
+template <std::size_t... indices>
+constexpr std::array<Decoded_instruction::Handler, sizeof...(indices)> CPU::make_fused_load_add_jump_handlers(
+	std::index_sequence<indices...>
+)
+{
+	return {{&CPU::fused_load_add_jump<0x41 + indices>...}};
+}
+
+namespace {
+	constexpr bool is_conditional_jump(const std::uint8_t op_code)
+	{
+		return op_code >= 0x41 && op_code <= 0x44;
+	}
+
+	constexpr bool has_param_byte(const std::uint8_t op_code)
+	{
+		return
+			(op_code >= 0x01 && op_code <= 0x0D && op_code != 0x05 && op_code != 0x06)
+			|| (op_code >= 0x20 && op_code <= 0x22);
+	}
+}
+
+// Decodes the instruction at address, fused with the instructions after it
+// when they form one of the sequences that have a fused handler.
+Decoded_instruction CPU::decode_fused(const std::uint16_t address)
+{
+	static constexpr auto add_jump_handlers =
+		make_fused_add_jump_handlers(std::make_index_sequence<32>{});
+	static constexpr auto load_add_jump_handlers =
+		make_fused_load_add_jump_handlers(std::make_index_sequence<4>{});
+
+	if (!_mem->is_ram(address + 5) || (_breakpoints && _breakpoints->breaks_in(address + 1, 5))) {
+		return decode(address);
+	}
+	std::array<std::uint8_t, 6> bytes;
+	_mem->fetch(address, bytes.data(), bytes.size());
+	const auto op_code = bytes[0];
+	const auto op_param = get_low_nibble(op_code);
+
+	if (get_high_nibble(op_code) == 0xE && is_g8(op_param) && is_conditional_jump(bytes[2])) {
+		return Decoded_instruction{
+			add_jump_handlers[op_param * 4 + bytes[2] - 0x41],
+			5, bytes[1], 2, make_word(bytes[3], bytes[4])
+		};
+	}
+	if (get_high_nibble(op_code) == 0xF && is_r16(op_param) && is_conditional_jump(bytes[3])) {
+		return Decoded_instruction{
+			add_jump_handlers[16 + op_param * 4 + bytes[3] - 0x41],
+			6, make_word(bytes[1], bytes[2]), 2, make_word(bytes[4], bytes[5])
+		};
+	}
+	if (op_code == 0x24 && bytes[1] == 0xE0 && is_conditional_jump(bytes[3])) {
+		return Decoded_instruction{
+			load_add_jump_handlers[bytes[3] - 0x41],
+			6, bytes[2], 3, make_word(bytes[4], bytes[5])
+		};
+	}
+	if (op_code == 0xB3 && bytes[1] == 0x21 && bytes[2] == 0x32) {
+		return Decoded_instruction{&CPU::fused_enter, 3, 0, 2};
+	}
+	if (op_code == 0x21 && bytes[1] == 0x23 && bytes[2] == 0xD3 && bytes[3] == 0x4B) {
+		return Decoded_instruction{&CPU::fused_leave, 4, 0, 3};
+	}
+	return decode(address);
+}
+
+// Raises the interrupts that are due: the clock interrupt when IC has
+// wrapped to zero, and hardware interrupts from expired timers, one at a
+// time and only outside of interrupt handlers. Polls input and takes
+// profile samples when due.
+void CPU::run_events()
+{
+	const auto now = _pacer.cycles();
+	if (_clock_interrupt && now >= _clock_deadline) {
+		if (_ic == 0) {
+			raise_interrupt(0x01);
+		}
+		_clock_deadline = now + (256u - _ic);
+	}
+
+	Scheduler::Event event;
+	while (_scheduler.pop_due(now, event)) {
+		if (event.id == _timers.size()) {
+			poll_input(event.deadline);
+			continue;
+		}
+		if (event.id == _timers.size() + 1) {
+			_profiler->sample(_ip);
+			_scheduler.schedule(event.id, event.deadline + _profile_interval);
+			continue;
+		}
+		if (event.id >= port_timer_id(0)) {
+			const auto index = event.id - port_timer_id(0);
+			auto &timer = _port_timers[index];
+			_pending_hardware |= std::uint64_t{1} << (timer.interrupt_code - 0x10u);
+			if (timer.periodic) {
+				_port_timer_deadlines[index] = event.deadline + timer.period;
+				_scheduler.schedule(event.id, _port_timer_deadlines[index]);
+			} else {
+				timer.running = false;
+			}
+			continue;
+		}
+		const auto &timer = _timers[event.id];
+		_pending_hardware |= std::uint64_t{1} << (timer.interrupt_code() - 0x10u);
+		if (timer.periodic()) {
+			_scheduler.schedule(event.id, event.deadline + timer.period());
+		}
+	}
+	if (_pending_hardware && _interrupt_handling && _interrupt_level == 0) {
+		unsigned code = 0;
+		while (!(_pending_hardware >> code & 1u)) {
+			++code;
+		}
+		_pending_hardware &= ~(std::uint64_t{1} << code);
+		raise_interrupt(0x10 + code);
+	}
+	update_next_event();
+}
+
+// Raises the input interrupt if input is ready, or has newly ended, and
+// looks again a pacing quantum on. Interrupts are raised for as long as
+// input is ready, so none is lost to input arriving while one is handled.
+void CPU::poll_input(const std::uint64_t deadline)
+{
+	const auto available = _input->rdbuf()->in_avail();
+	if (available > 0 || (available < 0 && !_input_end_raised)) {
+		_pending_hardware |= std::uint64_t{1} << (_input_interrupt - 0x10u);
+	}
+	_input_end_raised = available < 0;
+	_scheduler.schedule(_timers.size(), deadline + _input_poll_period);
+}
+
+// Scheduler ids are the timers', then input polling's, then profiling's,
+// then the guest's timers'
+unsigned CPU::port_timer_id(const unsigned index) const
+{
+	return _timers.size() + 2 + index;
+}
+
+void CPU::update_next_event()
+{
+	_next_event = std::min(_scheduler.next_deadline(), _cycle_limit);
+	if (_clock_interrupt) {
+		_next_event = std::min(_next_event, _clock_deadline);
+	}
+	if (_pending_hardware && _interrupt_handling && _interrupt_level == 0) {
+		_next_event = 0;
+	}
+}
+
+// Runs translated code from IP until the budget runs out or it reaches an
+// instruction left to the interpreter. Returns the instructions run, 0 if
+// nothing ran.
+unsigned CPU::run_translated()
+{
+	const auto code = _jit->translation(_ip);
+	if (!code) {
+		return 0;
+	}
+	// Stop by the end of the pacing quantum, the next timer and the cycle
+	// limit, instructions being at most 3 cycles, and before IC wraps to
+	// zero when the clock interrupt has to be raised there
+	auto budget = std::max(1u, _pacer.cycles_left() / 3);
+	const auto timer_deadline = std::min(_scheduler.next_deadline(), _cycle_limit);
+	if (timer_deadline - _pacer.cycles() < 3u * budget) {
+		budget = std::max<unsigned>(1u, (timer_deadline - _pacer.cycles()) / 3);
+	}
+	if (_clock_interrupt) {
+		budget = std::min(budget, 256u - _ic);
 	}
+
+	auto &context = _jit->context();
+	context.a = _primary.a;
+	context.c = _primary.c;
+	context.f = _primary.f;
+	context.sp = _primary.sp;
+	context.bp = _primary.bp;
+	context.shadow_a = _shadow.a;
+	context.shadow_c = _shadow.c;
+	context.shadow_f = _shadow.f;
+	context.shadow_sp = _shadow.sp;
+	context.shadow_bp = _shadow.bp;
+	context.ip = _ip;
+	context.t = _t;
+	context.budget = budget;
+	context.cycles = 0;
+	_translating = true;
+	_jit->run(code);
+	_translating = false;
+	_primary.a = context.a;
+	_primary.c = context.c;
+	_primary.f = context.f;
+	_primary.sp = context.sp;
+	_primary.bp = context.bp;
+	_shadow.a = context.shadow_a;
+	_shadow.c = context.shadow_c;
+	_shadow.f = context.shadow_f;
+	_shadow.sp = context.shadow_sp;
+	_shadow.bp = context.shadow_bp;
+	_ip = context.ip;
+	_t = context.t;
+
+	const auto executed = budget - context.budget;
+	_ic += executed;
+	_pacer.tick(context.cycles);
+	return executed;
 }
 
 void CPU::step()
 {
-	if (_clock_interrupt && _ic == 0) {
-		raise_interrupt(0x01);
+	if (_pacer.cycles() >= _next_event) {
+		run_events();
 	}
-	const auto op_code = instruction_fetch();
-	if (op_code <= 0x70) {
-		byte_op(op_code);
+	if (_jit && _power_on) {
+		const auto ip = _ip;
+		const auto cycles = _pacer.cycles();
+		if (const auto executed = run_translated()) {
+			_counters.translated(executed, _pacer.cycles() - cycles);
+			if (_trace) {
+				const std::uint8_t count[3] = {
+					static_cast<std::uint8_t>(executed),
+					static_cast<std::uint8_t>(executed >> 8),
+					static_cast<std::uint8_t>(executed >> 16)
+				};
+				_trace->begin(Trace::block, cycles, ip, count);
+				_trace->end(_primary.a, _primary.c, _primary.sp, _primary.bp, _primary.f);
+			}
+			return;
+		}
+	}
+	auto &cached = _decode_cache[_ip];
+	Decoded_instruction single;
+	const auto *instruction = &cached;
+	if (!cached.execute) {
+		// Device pages can change without being written, so code fetched
+		// from them is not cached
+		if (_breakpoints && _breakpoints->breaks_at(_ip)) {
+			cached = Decoded_instruction{&CPU::break_point, 0, 0, 0};
+		} else if (_mem->is_ram(_ip) && _mem->is_ram(_ip + 2)) {
+			cached = _fusion ? decode_fused(_ip) : decode(_ip);
+		} else {
+			single = decode(_ip);
+			instruction = &single;
+		}
+	}
+	// A fused sequence must not run past an event, so then its first
+	// instruction runs alone
+	if (instruction->count > 1 && _pacer.cycles() + instruction->length > _next_event) {
+		single = decode(_ip);
+		instruction = &single;
+	}
+	if (_opcode_profile && _mem->is_ram(_ip) && _mem->is_ram(_ip + 1)) {
+		std::uint8_t bytes[2];
+		_mem->fetch(_ip, bytes, 2);
+		const auto op_code = bytes[0];
+		_opcode_profile->record(
+			Opcode_profile::key(
+				op_code,
+				bytes[1],
+				has_param_byte(op_code),
+				instruction->count
+			),
+			instruction->count
+		);
+	}
+	if (_trace) {
+		std::uint8_t bytes[3] = {};
+		if (_mem->is_ram(_ip) && _mem->is_ram(_ip + 2)) {
+			_mem->fetch(_ip, bytes, 3);
+		}
+		_trace->begin(Trace::instruction, _pacer.cycles(), _ip, bytes);
+	}
+	if constexpr (Counters::enabled) {
+		if (_mem->is_ram(_ip)) {
+			std::uint8_t op_code;
+			_mem->fetch(_ip, &op_code, 1);
+			_counters.retired(op_code);
+		}
+		_counters.dispatched(instruction->count, instruction->length);
+	}
+	_pacer.tick(instruction->length);
+	_ip += instruction->length;
+	(this->*instruction->execute)(*instruction);
+	_ic += instruction->count;
+	if (_trace) {
+		_trace->end(_primary.a, _primary.c, _primary.sp, _primary.bp, _primary.f);
+	}
+}
+
+// Raises a hardware interrupt, 0x10 to 0x3F, as a timer would, for it to be
+// delivered once interrupts are handled and none is being
+void CPU::interrupt(const std::uint8_t interrupt_code)
+{
+	if (interrupt_code < 0x10 || interrupt_code > 0x3F) {
+		throw std::out_of_range{"CPU::interrupt() given an interrupt code not for hardware"};
+	}
+	_pending_hardware |= std::uint64_t{1} << (interrupt_code - 0x10u);
+	update_next_event();
+}
+
+// Makes step() stop short of running a fused sequence or translated block
+// past cycles, so that a run to a cycle budget ends where running one
+// instruction at a time would. Scheduler::never lifts the limit.
+void CPU::set_cycle_limit(const std::uint64_t cycles)
+{
+	_cycle_limit = cycles;
+	_next_event = 0;
+}
+
+// A timer the guest programs, as it stands
+const Port_timer & CPU::port_timer(const unsigned index) const
+{
+	return _port_timers.at(index);
+}
+
+// Sets a timer the guest programs, starting it over from now if it is to
+// run, which it only does given a period and a hardware interrupt code
+void CPU::set_port_timer(const unsigned index, const Port_timer &timer)
+{
+	auto &port_timer = _port_timers.at(index);
+	port_timer = timer;
+	port_timer.running =
+		timer.running && timer.period
+		&& timer.interrupt_code >= 0x10 && timer.interrupt_code <= 0x3F;
+	if (port_timer.running) {
+		const auto now = _pacer.cycles() + (_translating ? _jit->context().cycles : 0);
+		_port_timer_deadlines[index] = now + timer.period;
+		_scheduler.schedule(port_timer_id(index), _port_timer_deadlines[index]);
 	} else {
-		nibble_op(get_high_nibble(op_code), get_low_nibble(op_code));
+		_scheduler.cancel(port_timer_id(index));
 	}
-	++_ic;
+	update_next_event();
 }
 
 bool CPU::is_on() const
@@ -939,6 +1411,216 @@ bool CPU::is_on() const
 	return _power_on;
 }
 
+// Total cycles run
+std::uint64_t CPU::cycles() const
+{
+	return _pacer.cycles();
+}
+
+// Reads a register as it stands, without running events.
+unsigned CPU::reg(const Register name) const
+{
+	switch (name) {
+	case Register::a:  return _primary.a;
+	case Register::c:  return _primary.c;
+	case Register::sp: return _primary.sp;
+	case Register::bp: return _primary.bp;
+	case Register::ip: return _ip;
+	case Register::f:  return _primary.f;
+	case Register::ic: return _ic;
+	case Register::t:  return _t;
+	case Register::al: return get_low_byte(_primary.a);
+	case Register::ah: return get_high_byte(_primary.a);
+	case Register::cl: return get_low_byte(_primary.c);
+	default:           return get_high_byte(_primary.c);
+	}
+}
+
+// Sets a register in place, leaving the rest of the machine as it is, on or
+// stopped. Events are not run: a changed IC is only looked at by the clock
+// interrupt at the next step.
+void CPU::set_reg(const Register name, const unsigned value)
+{
+	switch (name) {
+	case Register::a:  _primary.a = value; break;
+	case Register::c:  _primary.c = value; break;
+	case Register::sp: _primary.sp = value; break;
+	case Register::bp: _primary.bp = value; break;
+	case Register::ip: _ip = value; break;
+	case Register::f:  _primary.f = value; break;
+	case Register::ic:
+		_ic = value;
+		_clock_deadline = 0;
+		_next_event = 0;
+		break;
+	case Register::t:  _t = value; break;
+	case Register::al: _primary.a = make_word(value, get_high_byte(_primary.a)); break;
+	case Register::ah: _primary.a = make_word(get_low_byte(_primary.a), value); break;
+	case Register::cl: _primary.c = make_word(value, get_high_byte(_primary.c)); break;
+	default:           _primary.c = make_word(get_low_byte(_primary.c), value); break;
+	}
+}
+
+// Takes the state between two steps. Events due now are handled first, as
+// the next step would, so that every timer is due later than now and can be
+// rescheduled from the cycle count alone.
+CPU::State CPU::save()
+{
+	if (_pacer.cycles() >= _next_event) {
+		run_events();
+	}
+	State state;
+	std::memset(&state, 0, sizeof state);
+	state.a = _primary.a;
+	state.c = _primary.c;
+	state.sp = _primary.sp;
+	state.bp = _primary.bp;
+	state.shadow_a = _shadow.a;
+	state.shadow_c = _shadow.c;
+	state.shadow_sp = _shadow.sp;
+	state.shadow_bp = _shadow.bp;
+	state.f = _primary.f;
+	state.shadow_f = _shadow.f;
+	state.ip = _ip;
+	state.ic = _ic;
+	state.t = _t;
+	state.interrupt_level = _interrupt_level;
+	state.interrupt_handling = _interrupt_handling;
+	state.clock_interrupt = _clock_interrupt;
+	state.cycles = _pacer.cycles();
+	state.clock_deadline = _clock_deadline;
+	state.pending_hardware = _pending_hardware;
+	for (unsigned index = 0; index < Port_timer::count; ++index) {
+		const auto &timer = _port_timers[index];
+		state.port_timer_deadlines[index] = timer.running ? _port_timer_deadlines[index] : 0;
+		state.port_timer_periods[index] = timer.period;
+		state.port_timer_codes[index] = timer.interrupt_code;
+		state.port_timer_flags[index] = timer.running | timer.periodic << 1;
+	}
+	return state;
+}
+
+// Continues from a saved state, powered on even if it was saved at STOP.
+// Timers carry on from the cycle count, as if they had been running since
+// cycle 0, and the guest's from where they were due.
+void CPU::restore(const State &state)
+{
+	_primary.a = state.a;
+	_primary.c = state.c;
+	_primary.sp = state.sp;
+	_primary.bp = state.bp;
+	_shadow.a = state.shadow_a;
+	_shadow.c = state.shadow_c;
+	_shadow.sp = state.shadow_sp;
+	_shadow.bp = state.shadow_bp;
+	_primary.f = state.f;
+	_shadow.f = state.shadow_f;
+	_ip = state.ip;
+	_ic = state.ic;
+	_t = state.t;
+	_interrupt_level = state.interrupt_level;
+	_interrupt_handling = state.interrupt_handling;
+	_clock_interrupt = state.clock_interrupt;
+	_pacer.restore(state.cycles);
+	_clock_deadline = state.clock_deadline;
+	_pending_hardware = state.pending_hardware;
+	for (std::size_t id = 0; id < _timers.size(); ++id) {
+		const auto period = _timers[id].period();
+		if (_timers[id].periodic()) {
+			_scheduler.schedule(id, (state.cycles / period + 1) * period);
+		} else if (state.cycles < period) {
+			_scheduler.schedule(id, period);
+		} else {
+			_scheduler.cancel(id);
+		}
+	}
+	for (unsigned index = 0; index < Port_timer::count; ++index) {
+		auto &timer = _port_timers[index];
+		timer.period = state.port_timer_periods[index];
+		timer.interrupt_code = state.port_timer_codes[index];
+		timer.running = state.port_timer_flags[index] & 1u;
+		timer.periodic = state.port_timer_flags[index] & 2u;
+		_port_timer_deadlines[index] = state.port_timer_deadlines[index];
+		if (timer.running) {
+			_scheduler.schedule(port_timer_id(index), _port_timer_deadlines[index]);
+		} else {
+			_scheduler.cancel(port_timer_id(index));
+		}
+	}
+	if (_input_interrupt) {
+		_scheduler.schedule(_timers.size(), (state.cycles / _input_poll_period + 1) * _input_poll_period);
+	}
+	if (_profiler) {
+		_profiler->clear_stack();
+		_scheduler.schedule(_timers.size() + 1, (state.cycles / _profile_interval + 1) * _profile_interval);
+	}
+	_power_on = true;
+	_next_event = 0;
+}
+
+// Starts over from power on, to run whatever the Mem holds now. What
+// report() shows keeps counting across resets.
+void CPU::reset()
+{
+	State state;
+	std::memset(&state, 0, sizeof state);
+	restore(state);
+}
+
+void CPU::report(std::ostream &out) const
+{
+	if (_fusion) {
+		static const char *const names[fusion_kinds] = {
+			"ADD, Jcc",
+			"MOV AL,[C], ADD AL, Jcc",
+			"PUSH BP, MOV BP,SP",
+			"MOV SP,BP, POP BP, RET"
+		};
+		out << "fusions fired:\n";
+		for (std::size_t i = 0; i < fusion_kinds; ++i) {
+			out << "\t" << names[i] << ": " << _fusions[i] << "\n";
+		}
+	}
+	if (_opcode_profile) {
+		_opcode_profile->report(out);
+	}
+	if (_profiler) {
+		_profiler->report(out);
+	}
+	if (_pacing_report) {
+		_pacer.report(out);
+	}
+}
+
+// The trace of the last steps, or null when not tracing
+const Trace * CPU::trace() const
+{
+	return _trace.get();
+}
+
+// What the guest has done so far, all zero unless built with counters
+const Counters & CPU::counters() const
+{
+	return _counters;
+}
+
+// Host time spent running, less time slept to keep to the clock rate
+Pacer::Clock::duration CPU::running() const
+{
+	return _pacer.running();
+}
+
+void CPU::write_counters(std::ostream &out) const
+{
+	_counters.write_json(out, _pacer.cycles(), running());
+}
+
+// The profile of the guest so far, or null when not profiling
+const Profiler * CPU::profiler() const
+{
+	return _profiler.get();
+}
+
 std::ostream & operator << (std::ostream &out, const CPU &cpu)
 {
 	out << "REGISTERS\n";
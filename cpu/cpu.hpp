@@ -1,90 +1,179 @@
 #ifndef LVCPU_CPU_HPP_INCLUDED
 #define LVCPU_CPU_HPP_INCLUDED
 
+#include <cstddef>
 #include <cstdint>
-#include <chrono>
 #include <iostream>
+#include <array>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "mem.hpp"
+#include "breakpoints.hpp"
+#include "decode_cache.hpp"
+#include "jit.hpp"
+#include "opcode_profile.hpp"
+#include "pacer.hpp"
+#include "profiler.hpp"
+#include "scheduler.hpp"
+#include "timer.hpp"
+#include "trace.hpp"
 
-class CPU {
-	void         clock_tick();
-	std::uint8_t instruction_fetch();
+class CPU final {
+	typedef Decoded_instruction::Handler Handler;
+
+	Decoded_instruction decode(std::uint16_t address);
+	Decoded_instruction decode_fused(std::uint16_t address);
+	unsigned run_translated();
+
+	template <std::uint8_t op_code, std::uint8_t param>
+	static constexpr Handler param_op_handler();
+	template <std::uint8_t op_code, std::size_t... params>
+	static constexpr std::array<Handler, 256> make_param_op_handlers(
+		std::index_sequence<params...>
+	);
+	template <std::uint8_t op_code>
+	static const std::array<Handler, 256> & param_op_handlers();
+
+	template <std::uint8_t op_code>
+	static constexpr Handler nibble_op_handler();
+	template <std::size_t... op_codes>
+	static constexpr std::array<Handler, 256> make_nibble_op_handlers(
+		std::index_sequence<op_codes...>
+	);
+	static const std::array<Handler, 256> & nibble_op_handlers();
+
+	template <std::size_t... indices>
+	static constexpr std::array<Handler, sizeof...(indices)> make_fused_add_jump_handlers(
+		std::index_sequence<indices...>
+	);
+	template <std::size_t... indices>
+	static constexpr std::array<Handler, sizeof...(indices)> make_fused_load_add_jump_handlers(
+		std::index_sequence<indices...>
+	);
 
 	void raise_interrupt(std::uint8_t interrupt_code);
+	void trace_interrupt(std::uint8_t interrupt_code, bool double_fault);
+	void poll_input(std::uint64_t deadline);
+	unsigned port_timer_id(unsigned index) const;
+	void run_events();
+	void update_next_event();
 
-	void bad_op_code();
-	void bad_parameter();
+	void bad_op_code(const Decoded_instruction &instruction);
+	void bad_parameter(const Decoded_instruction &instruction);
 
-	std::uint8_t    get_g8(std::uint8_t code);
-	void            set_g8(std::uint8_t code, std::uint8_t value);
-	std::uint16_t & get_g16(std::uint8_t code);
-	std::uint16_t & get_r16(std::uint8_t code);
+	template <std::uint8_t code> std::uint8_t    get_g8();
+	template <std::uint8_t code> void            set_g8(std::uint8_t value);
+	template <std::uint8_t code> std::uint16_t & get_g16();
+	template <std::uint8_t code> std::uint16_t & get_r16();
 
 	void set_zero_flag(bool state = true);
 	void set_carry_flag(bool state = true);
 	bool get_zero_flag();
 	bool get_carry_flag();
+	void set_flags(bool zero, bool carry);
+	template <std::uint8_t jump_op_code> bool jump_condition();
+
+	void byte_op_nop(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code, std::uint8_t p2_code>
+	void byte_op_add_g8(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code, std::uint8_t p2_code>
+	void byte_op_add_r16(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code, std::uint8_t p2_code>
+	void byte_op_sub_g8(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code, std::uint8_t p2_code>
+	void byte_op_sub_r16(const Decoded_instruction &instruction);
+	void byte_op_inc(const Decoded_instruction &instruction);
+	void byte_op_dec(const Decoded_instruction &instruction);
+	template <std::uint8_t p2_code>
+	void byte_op_neg_g8(const Decoded_instruction &instruction);
+	template <std::uint8_t p2_code>
+	void byte_op_neg_g16(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code, std::uint8_t p2_code>
+	void byte_op_and(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code, std::uint8_t p2_code>
+	void byte_op_or(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code, std::uint8_t p2_code>
+	void byte_op_xor(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code, std::uint8_t p2_val>
+	void byte_op_shift(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code, std::uint8_t p2_val>
+	void byte_op_rotate(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code, std::uint8_t p2_code>
+	void byte_op_mul_g8(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code>
+	void byte_op_mul_a(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code, std::uint8_t p2_code>
+	void byte_op_mov_g8_g8(const Decoded_instruction &instruction);
+	template <std::uint8_t p1_code, std::uint8_t p2_code>
+	void byte_op_mov_r16_r16(const Decoded_instruction &instruction);
+	void byte_op_mov_al_f(const Decoded_instruction &instruction);
+	void byte_op_mov_al_ic(const Decoded_instruction &instruction);
+	void byte_op_mov_a_ip(const Decoded_instruction &instruction);
+	void byte_op_mov_al_bp_ptr(const Decoded_instruction &instruction);
+	void byte_op_mov_al_c_ptr(const Decoded_instruction &instruction);
+	void byte_op_mov_bp_ptr_al(const Decoded_instruction &instruction);
+	void byte_op_mov_c_ptr_al(const Decoded_instruction &instruction);
+	void byte_op_mov_a_bp_ptr(const Decoded_instruction &instruction);
+	void byte_op_mov_a_c_ptr(const Decoded_instruction &instruction);
+	void byte_op_mov_al_t(const Decoded_instruction &instruction);
+	void byte_op_mov_t_al(const Decoded_instruction &instruction);
+	void byte_op_mov_bp_ptr_a(const Decoded_instruction &instruction);
+	void byte_op_mov_c_ptr_a(const Decoded_instruction &instruction);
+	void byte_op_swp(const Decoded_instruction &instruction);
+	void byte_op_jp(const Decoded_instruction &instruction);
+	void byte_op_jz(const Decoded_instruction &instruction);
+	void byte_op_jc(const Decoded_instruction &instruction);
+	void byte_op_jnz(const Decoded_instruction &instruction);
+	void byte_op_jnc(const Decoded_instruction &instruction);
+	void byte_op_call_n16(const Decoded_instruction &instruction);
+	void byte_op_call_a(const Decoded_instruction &instruction);
+	void byte_op_interrupt(const Decoded_instruction &instruction);
+	void byte_op_ret(const Decoded_instruction &instruction);
+	void byte_op_reti(const Decoded_instruction &instruction);
+	void byte_op_eih(const Decoded_instruction &instruction);
+	void byte_op_dih(const Decoded_instruction &instruction);
+	void byte_op_eci(const Decoded_instruction &instruction);
+	void byte_op_dci(const Decoded_instruction &instruction);
+	void byte_op_esi(const Decoded_instruction &instruction);
+	void byte_op_dsi(const Decoded_instruction &instruction);
+	void byte_op_in(const Decoded_instruction &instruction);
+	void byte_op_out(const Decoded_instruction &instruction);
+	void byte_op_stop(const Decoded_instruction &instruction);
+	void break_point(const Decoded_instruction &instruction);
+
+	template <std::uint8_t op_param>
+	void nibble_op_mov_g8(const Decoded_instruction &instruction);
+	template <std::uint8_t op_param>
+	void nibble_op_mov_r16(const Decoded_instruction &instruction);
+	template <std::uint8_t op_param>
+	void nibble_op_push_g8(const Decoded_instruction &instruction);
+	template <std::uint8_t op_param>
+	void nibble_op_push_r16(const Decoded_instruction &instruction);
+	template <std::uint8_t op_param>
+	void nibble_op_pop_g8(const Decoded_instruction &instruction);
+	template <std::uint8_t op_param>
+	void nibble_op_pop_r16(const Decoded_instruction &instruction);
+	template <std::uint8_t op_param>
+	void nibble_op_add_g8(const Decoded_instruction &instruction);
+	template <std::uint8_t op_param>
+	void nibble_op_add_r16(const Decoded_instruction &instruction);
 
-	void byte_op_nop();
-	void byte_op_add_g8();
-	void byte_op_add_r16();
-	void byte_op_sub_g8();
-	void byte_op_sub_r16();
-	void byte_op_inc();
-	void byte_op_dec();
-	void byte_op_neg();
-	void byte_op_and();
-	void byte_op_or();
-	void byte_op_xor();
-	void byte_op_shift();
-	void byte_op_rotate();
-	void byte_op_mul();
-	void byte_op_mov_g8_g8();
-	void byte_op_mov_r16_r16();
-	void byte_op_mov_getmisc();
-	void byte_op_mov_al_bp_ptr();
-	void byte_op_mov_al_c_ptr();
-	void byte_op_mov_bp_ptr_al();
-	void byte_op_mov_c_ptr_al();
-	void byte_op_mov_a_bp_ptr();
-	void byte_op_mov_a_c_ptr();
-	void byte_op_mov_al_t();
-	void byte_op_mov_t_al();
-	void byte_op_mov_bp_ptr_a();
-	void byte_op_mov_c_ptr_a();
-	void byte_op_swp();
-	void byte_op_jp();
-	void byte_op_jz();
-	void byte_op_jc();
-	void byte_op_jnz();
-	void byte_op_jnc();
-	void byte_op_call_n16();
-	void byte_op_call_a();
-	void byte_op_interrupt();
-	void byte_op_ret();
-	void byte_op_reti();
-	void byte_op_eih();
-	void byte_op_dih();
-	void byte_op_eci();
-	void byte_op_dci();
-	void byte_op_esi();
-	void byte_op_dsi();
-	void byte_op_in();
-	void byte_op_out();
-	void byte_op_stop();
-
-	void nibble_op_mov_g8(std::uint8_t op_param);
-	void nibble_op_mov_r16(std::uint8_t op_param);
-	void nibble_op_push_g8(std::uint8_t op_param);
-	void nibble_op_push_r16(std::uint8_t op_param);
-	void nibble_op_pop_g8(std::uint8_t op_param);
-	void nibble_op_pop_r16(std::uint8_t op_param);
-	void nibble_op_add_g8(std::uint8_t op_param);
-	void nibble_op_add_r16(std::uint8_t op_param);
-
-	void byte_op(std::uint8_t op_code);
-	void nibble_op(std::uint8_t op_nibble, std::uint8_t op_param);
+	template <std::uint8_t add_op_code, std::uint8_t jump_op_code>
+	void fused_add_jump(const Decoded_instruction &instruction);
+	template <std::uint8_t jump_op_code>
+	void fused_load_add_jump(const Decoded_instruction &instruction);
+	void fused_enter(const Decoded_instruction &instruction);
+	void fused_leave(const Decoded_instruction &instruction);
+
+	enum Fusion {
+		fusion_add_jump,
+		fusion_load_add_jump,
+		fusion_enter,
+		fusion_leave,
+		fusion_kinds
+	};
 
 	struct General_registers {
 		std::uint16_t a = 0, c = 0;
@@ -96,21 +185,149 @@ class CPU {
 	std::uint8_t _interrupt_level = 0;
 	bool _interrupt_handling = false;
 	bool _clock_interrupt = false;
-	std::chrono::microseconds _clock_period;
-	unsigned _clock_multiplier;
-	unsigned _clock_multiplier_stage = 0;
-	std::chrono::high_resolution_clock::time_point _next_tick;
+	Pacer _pacer;
+	bool _pacing_report;
+	// Cycle count at which step() next has to look at events. The clock
+	// interrupt is due no earlier than _clock_deadline, IC not being able to
+	// wrap in fewer cycles than it has instructions left to go.
+	std::uint64_t _next_event = 0;
+	std::uint64_t _clock_deadline = 0;
+	// Cycle count that step() lands on rather than running past it in one
+	// fused sequence or translated block
+	std::uint64_t _cycle_limit = Scheduler::never;
+	Scheduler _scheduler;
+	std::vector<Timer> _timers;
+	std::array<Port_timer, Port_timer::count> _port_timers = {};
+	std::array<std::uint64_t, Port_timer::count> _port_timer_deadlines = {};
+	// Raised hardware interrupts not delivered yet, by code from 0x10
+	std::uint64_t _pending_hardware = 0;
 	bool _power_on = true;
+	Decode_cache _decode_cache;
 	Mem *_mem;
 	std::istream *_input;
 	std::ostream *_output;
+	bool _input_waits;
+	std::uint8_t _input_interrupt;
+	unsigned _input_poll_period;
+	bool _input_end_raised = false;
+	std::unique_ptr<Jit> _jit;
+	// Whether translated code is running, counting its cycles in the JIT's
+	// context rather than the pacer
+	bool _translating = false;
+	bool _fusion;
+	std::array<std::uint64_t, fusion_kinds> _fusions = {};
+	std::unique_ptr<Opcode_profile> _opcode_profile;
+	std::unique_ptr<Trace> _trace;
+	std::unique_ptr<Profiler> _profiler;
+	unsigned _profile_interval;
+	Counters _counters;
+	std::shared_ptr<Breakpoints> _breakpoints;
 
 	friend std::ostream & operator << (std::ostream &out, const CPU &cpu);
+	// Runs instructions for groups of CPUs, taking and handing back their
+	// registers, IP, IC and cycle count
+	friend class Lockstep;
 
 public:
-	CPU(Mem &mem, double rate, std::istream &input, std::ostream &output);
-	void step();
-	bool is_on() const;
+	enum class Engine {
+		interpreter,
+		jit
+	};
+
+	struct Options {
+		Engine engine = Engine::interpreter;
+		// Run common instruction sequences as one dispatch
+		bool fusion = false;
+		// Count dispatched instructions, pairs and triples for report()
+		bool opcode_profile = false;
+		// Cycles run between sleeps to keep to the clock rate
+		unsigned pacing_quantum = 1000;
+		// Whether to keep to the clock rate, and what guest time follows
+		Pacer::Mode clock_mode = Pacer::Mode::paced;
+		// Report the achieved clock rate and pacing lag from report()
+		bool pacing_report = false;
+		std::vector<Timer::Settings> timers;
+		// While no input is ready, run IN again, with time passing and
+		// events firing, rather than block; for input streams that tell
+		// what is ready through in_avail()
+		bool input_waits = false;
+		// Hardware interrupt raised while input is ready, and once at its
+		// end, or 0 for none; input is looked at every pacing quantum
+		std::uint8_t input_interrupt = 0;
+		// Steps to keep a trace of, the last ones run, or 0 for none
+		std::size_t trace_records = 0;
+		// Cycles between samples of where the guest is, or 0 to not
+		// profile. Profiling runs the interpreter, whatever the engine, as
+		// translated code runs calls and returns unseen.
+		unsigned profile_interval = 0;
+		// Names for what the profiler reports, or null to name addresses
+		std::shared_ptr<const Symbol_map> profile_symbols;
+		// Breakpoints and watchpoints to stop at, attached to the Mem while
+		// the CPU is; step() returns once they are hit, and until they are
+		// resumed from does not run the instruction of a breakpoint
+		std::shared_ptr<Breakpoints> breakpoints;
+	};
+
+	// Machine state apart from memory, as kept in snapshots. Fields are laid
+	// out without implicit padding, so the struct can be copied as bytes.
+	struct State {
+		std::uint16_t a, c, sp, bp;
+		std::uint16_t shadow_a, shadow_c, shadow_sp, shadow_bp;
+		std::uint8_t  f, shadow_f;
+		std::uint16_t ip;
+		std::uint8_t  ic, t;
+		std::uint8_t  interrupt_level;
+		std::uint8_t  interrupt_handling;
+		std::uint8_t  clock_interrupt;
+		std::uint8_t  reserved[7];
+		std::uint64_t cycles;
+		std::uint64_t clock_deadline;
+		std::uint64_t pending_hardware;
+		// Timers the guest programs: when each running one is next due, and
+		// flags, bit 0 running and bit 1 periodic
+		std::uint64_t port_timer_deadlines[Port_timer::count];
+		std::uint32_t port_timer_periods[Port_timer::count];
+		std::uint8_t  port_timer_codes[Port_timer::count];
+		std::uint8_t  port_timer_flags[Port_timer::count];
+	};
+
+	// Registers as seen from outside the machine, between steps
+	enum class Register { a, c, sp, bp, ip, f, ic, t, al, ah, cl, ch };
+
+	CPU(
+		Mem          &mem,
+		double       rate,
+		std::istream &input,
+		std::ostream &output
+	);
+	CPU(
+		Mem           &mem,
+		double        rate,
+		std::istream  &input,
+		std::ostream  &output,
+		const Options &options
+	);
+	~CPU();
+	CPU(const CPU &) = delete;
+	CPU & operator = (const CPU &) = delete;
+	void                   step();
+	void                   interrupt(std::uint8_t interrupt_code);
+	void                   set_cycle_limit(std::uint64_t cycles);
+	bool                   is_on() const;
+	std::uint64_t          cycles() const;
+	unsigned               reg(Register name) const;
+	void                   set_reg(Register name, unsigned value);
+	const Port_timer &     port_timer(unsigned index) const;
+	void                   set_port_timer(unsigned index, const Port_timer &timer);
+	State                  save();
+	void                   restore(const State &state);
+	void                   reset();
+	void                   report(std::ostream &out) const;
+	const Trace *          trace() const;
+	const Profiler *       profiler() const;
+	const Counters &       counters() const;
+	Pacer::Clock::duration running() const;
+	void                   write_counters(std::ostream &out) const;
 };
 
 std::ostream & operator << (std::ostream &out, const CPU &cpu);
@@ -0,0 +1,194 @@
+#include "debug_console.hpp"
+
+#include <cstdio>
+#include <sstream>
+#include <utility>
+
+Debug_console::Debug_console(
+	CPU                               &cpu,
+	Mem                               &mem,
+	Breakpoints                       &breakpoints,
+	std::shared_ptr<const Symbol_map> symbols,
+	std::istream                      &in,
+	std::ostream                      &out
+) :
+	_cpu(&cpu),
+	_mem(&mem),
+	_breakpoints(&breakpoints),
+	_symbols(std::move(symbols)),
+	_in(&in),
+	_out(&out)
+{}
+
+// Reads an address in hex, or a label's
+bool Debug_console::parse_address(const std::string &text, std::uint16_t &address) const
+{
+	if (_symbols) {
+		if (const auto label = _symbols->find(text)) {
+			address = label->address;
+			return true;
+		}
+	}
+	unsigned value;
+	char rest;
+	if (std::sscanf(text.c_str(), "%x%c", &value, &rest) != 1 || value > 0xFFFF) {
+		return false;
+	}
+	address = value;
+	return true;
+}
+
+// The address in hex, with the label it is at, or is in the code after
+std::string Debug_console::name(const std::uint16_t address) const
+{
+	char hex[8];
+	std::snprintf(hex, sizeof hex, "%04X", address);
+	std::string result = hex;
+	const auto label = _symbols ? _symbols->label_at(address) : nullptr;
+	if (label && (label->address == address || _symbols->line_at(address))) {
+		result += " <" + label->name;
+		if (label->address != address) {
+			result += "+" + std::to_string(address - label->address);
+		}
+		result += ">";
+	}
+	return result;
+}
+
+// Tells what was hit and the state stopped in
+void Debug_console::print_stop()
+{
+	const auto &hit = _breakpoints->hit();
+	char value[4];
+	std::snprintf(value, sizeof value, "%02X", hit.value);
+	switch (hit.kind) {
+	case Breakpoints::Hit::breakpoint:
+		*_out << "breakpoint at " << name(hit.address) << "\n";
+		break;
+	case Breakpoints::Hit::read:
+		*_out << "read " << value << " from " << name(hit.address) << "\n";
+		break;
+	case Breakpoints::Hit::write:
+		*_out << "wrote " << value << " to " << name(hit.address) << "\n";
+		break;
+	}
+	*_out << *_cpu << std::endl;
+}
+
+// Steps from where the run stopped, and stops early at a hit
+void Debug_console::step(const unsigned count)
+{
+	for (unsigned i = 0; i < count && _cpu->is_on(); ++i) {
+		_breakpoints->resume();
+		_cpu->step();
+		if (_breakpoints->stopped()) {
+			print_stop();
+			return;
+		}
+	}
+	*_out << *_cpu << std::endl;
+}
+
+// Prints the RAM, not reading devices mapped over it
+void Debug_console::dump(const std::uint16_t address, const unsigned count)
+{
+	char text[8];
+	for (unsigned i = 0; i < count; ++i) {
+		const std::uint16_t at = address + i;
+		if (i % 16 == 0) {
+			std::snprintf(text, sizeof text, "%s%04X:", i ? "\n" : "", at);
+			*_out << text;
+		}
+		std::snprintf(text, sizeof text, " %02X", _mem->ram_page(at >> 8)[at & 0xFF]);
+		*_out << text;
+	}
+	*_out << std::endl;
+}
+
+void Debug_console::list()
+{
+	for (const auto address : _breakpoints->breakpoints()) {
+		*_out << "break " << name(address) << "\n";
+	}
+	const auto &watchpoints = _breakpoints->watchpoints();
+	for (std::size_t i = 0; i < watchpoints.size(); ++i) {
+		const auto &watchpoint = watchpoints[i];
+		*_out << "watch " << i << ": " << name(watchpoint.first);
+		*_out << " size " << watchpoint.last - watchpoint.first + 1 << " ";
+		*_out << (watchpoint.access & Breakpoints::reads ? "r" : "");
+		*_out << (watchpoint.access & Breakpoints::writes ? "w" : "") << "\n";
+	}
+	std::flush(*_out);
+}
+
+// Prints the stop, then takes commands until told to continue or to quit.
+// Gives whether the run is to go on, having resumed from the hit.
+bool Debug_console::run()
+{
+	print_stop();
+	std::string line;
+	while (*_out << "> " << std::flush, std::getline(*_in, line)) {
+		std::istringstream words{line};
+		std::string command, first, second, third;
+		words >> command >> first >> second >> third;
+		std::uint16_t address;
+		const auto number = [](const std::string &text, const unsigned default_value) {
+			unsigned value;
+			char rest;
+			if (text.empty()) {
+				return default_value;
+			}
+			return std::sscanf(text.c_str(), "%u%c", &value, &rest) == 1 ? value : 0u;
+		};
+		if (command.empty()) {
+			continue;
+		} else if (command == "c") {
+			_breakpoints->resume();
+			return true;
+		} else if (command == "s") {
+			step(number(first, 1));
+			if (!_cpu->is_on()) {
+				return false;
+			}
+		} else if (command == "r") {
+			*_out << *_cpu << std::endl;
+		} else if (command == "x" && parse_address(first, address)) {
+			dump(address, number(second, 64));
+		} else if (command == "b" && parse_address(first, address)) {
+			_breakpoints->add_breakpoint(address);
+			_mem->breakpoints_changed();
+		} else if (command == "db" && parse_address(first, address)) {
+			if (!_breakpoints->remove_breakpoint(address)) {
+				*_out << "no breakpoint at " << name(address) << std::endl;
+			}
+			_mem->breakpoints_changed();
+		} else if (command == "w" && parse_address(first, address)) {
+			const auto size = number(second, 1);
+			const auto &access = third.empty() ? "w" : third;
+			if (size == 0 || address + size > 0x10000 || (access != "r" && access != "w" && access != "rw")) {
+				*_out << "usage: w address [size] [r|w|rw]" << std::endl;
+				continue;
+			}
+			_breakpoints->add_watchpoint(Breakpoints::Watchpoint{
+				address,
+				static_cast<std::uint16_t>(address + size - 1),
+				(access != "w" ? Breakpoints::reads : 0u) | (access != "r" ? Breakpoints::writes : 0u)
+			});
+			_mem->breakpoints_changed();
+		} else if (command == "dw" && !first.empty()) {
+			const auto index = number(first, 0);
+			if (first != std::to_string(index) || !_breakpoints->remove_watchpoint(index)) {
+				*_out << "no watchpoint " << first << std::endl;
+			}
+			_mem->breakpoints_changed();
+		} else if (command == "l") {
+			list();
+		} else if (command == "q") {
+			return false;
+		} else {
+			*_out << "commands: c, s [count], r, x address [count], b address, db address,\n";
+			*_out << "          w address [size] [r|w|rw], dw index, l, q" << std::endl;
+		}
+	}
+	return false;
+}
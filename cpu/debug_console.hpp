@@ -0,0 +1,55 @@
+#ifndef LVCPU_DEBUG_CONSOLE_HPP_INCLUDED
+#define LVCPU_DEBUG_CONSOLE_HPP_INCLUDED
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "breakpoints.hpp"
+#include "cpu.hpp"
+#include "mem.hpp"
+#include "symbol_map.hpp"
+
+// Commands for a run stopped at a breakpoint or watchpoint, read a line at a
+// time. Addresses are in hex, or labels when there is a symbol map:
+//
+//   c               continue
+//   s [count]       step count times, default 1, and print the state
+//   r               print the state
+//   x address [n]   dump n bytes of RAM from address, default 64
+//   b address       set a breakpoint
+//   db address      delete a breakpoint
+//   w address [size] [r|w|rw]
+//                   watch size bytes, default 1, for writes by default
+//   dw index        delete a watchpoint, by its index in l
+//   l               list breakpoints and watchpoints
+//   q               end the run
+class Debug_console {
+	CPU *_cpu;
+	Mem *_mem;
+	Breakpoints *_breakpoints;
+	std::shared_ptr<const Symbol_map> _symbols;
+	std::istream *_in;
+	std::ostream *_out;
+
+	bool        parse_address(const std::string &text, std::uint16_t &address) const;
+	std::string name(std::uint16_t address) const;
+	void        step(unsigned count);
+	void        dump(std::uint16_t address, unsigned count);
+	void        list();
+
+public:
+	Debug_console(
+		CPU                               &cpu,
+		Mem                               &mem,
+		Breakpoints                       &breakpoints,
+		std::shared_ptr<const Symbol_map> symbols,
+		std::istream                      &in,
+		std::ostream                      &out
+	);
+	void print_stop();
+	bool run();
+};
+
+#endif // LVCPU_DEBUG_CONSOLE_HPP_INCLUDED
@@ -0,0 +1,62 @@
+#ifndef LVCPU_DECODE_CACHE_HPP_INCLUDED
+#define LVCPU_DECODE_CACHE_HPP_INCLUDED
+
+#include <cstdint>
+#include <vector>
+
+class CPU;
+
+// An instruction as it was decoded at some guest address, with the operands
+// already validated and extracted so it can be executed without refetching.
+// Register operands are part of the handler, which is specialized for them.
+// A fused entry runs a sequence of count instructions, whose second operand
+// if any is in target.
+struct Decoded_instruction {
+	typedef void (CPU::*Handler)(const Decoded_instruction &instruction);
+
+	Handler       execute = nullptr;
+	std::uint8_t  length = 0;
+	std::uint16_t value = 0;
+	std::uint8_t  count = 1;
+	std::uint16_t target = 0;
+};
+
+// One decoded instruction slot per guest address. An entry with no handler
+// has not been decoded yet, or was written over since it was decoded.
+class Decode_cache {
+	std::vector<Decoded_instruction> _entries;
+public:
+	inline                       Decode_cache();
+	inline Decoded_instruction & operator [] (std::uint16_t address);
+	inline void                  invalidate(std::uint16_t address, unsigned length = 1);
+	inline void                  clear();
+};
+
+Decode_cache::Decode_cache() :
+	_entries(0x10000)
+{}
+
+Decoded_instruction & Decode_cache::operator [] (const std::uint16_t address)
+{
+	return _entries[address];
+}
+
+// Forgets the entries that the length bytes written at address belong to
+void Decode_cache::invalidate(const std::uint16_t address, const unsigned length)
+{
+	// Fused sequences are at most 6 bytes long, so a written byte can belong
+	// to an entry starting up to 5 bytes before it.
+	const std::uint16_t last = address + length - 1;
+	for (unsigned offset = 0; offset < length + 5; ++offset) {
+		_entries[static_cast<std::uint16_t>(last - offset)].execute = nullptr;
+	}
+}
+
+void Decode_cache::clear()
+{
+	for (auto &entry : _entries) {
+		entry.execute = nullptr;
+	}
+}
+
+#endif // LVCPU_DECODE_CACHE_HPP_INCLUDED
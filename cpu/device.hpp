@@ -0,0 +1,15 @@
+#ifndef LVCPU_DEVICE_HPP_INCLUDED
+#define LVCPU_DEVICE_HPP_INCLUDED
+
+#include <cstdint>
+
+// Something on the memory bus other than RAM, answering reads and writes to
+// the pages it is mapped at. Addresses are full guest addresses.
+class Device {
+public:
+	virtual ~Device() = default;
+	virtual std::uint8_t read(std::uint16_t address) = 0;
+	virtual void         write(std::uint16_t address, std::uint8_t value) = 0;
+};
+
+#endif // LVCPU_DEVICE_HPP_INCLUDED
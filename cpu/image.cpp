@@ -0,0 +1,150 @@
+#include "image.hpp"
+#include "mapped_file.hpp"
+
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+	constexpr char segmented_magic[4] = {'L', 'V', 'S', 'I'};
+	constexpr std::uint8_t segmented_version = 1;
+	constexpr std::size_t header_size = 12;
+	constexpr std::size_t segment_entry_size = 12;
+
+	std::uint32_t read_u16(const std::uint8_t *const bytes)
+	{
+		return bytes[0] | bytes[1] << 8;
+	}
+
+	std::uint32_t read_u32(const std::uint8_t *const bytes)
+	{
+		return read_u16(bytes) | read_u16(bytes + 2) << 16;
+	}
+
+	std::uint32_t adler32(const std::uint8_t *const bytes, const std::size_t size)
+	{
+		std::uint32_t a = 1;
+		std::uint32_t b = 0;
+		for (std::size_t i = 0; i < size; ++i) {
+			a = (a + bytes[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		return b << 16 | a;
+	}
+
+	bool is_segmented(const std::uint8_t *const bytes, const std::size_t size)
+	{
+		return size >= sizeof segmented_magic
+			&& std::memcmp(bytes, segmented_magic, sizeof segmented_magic) == 0;
+	}
+
+	std::vector<Image::Segment> read_segments(const std::uint8_t *const bytes, const std::size_t size)
+	{
+		if (size < header_size) {
+			throw std::runtime_error{"Segmented image header truncated"};
+		}
+		if (bytes[4] != segmented_version) {
+			throw std::runtime_error{"Segmented image version not supported"};
+		}
+		const std::size_t count = read_u16(bytes + 6);
+		const auto table = bytes + header_size;
+		const auto table_size = count * segment_entry_size;
+		if (size - header_size < table_size) {
+			throw std::runtime_error{"Segmented image segment table truncated"};
+		}
+		if (adler32(table, table_size) != read_u32(bytes + 8)) {
+			throw std::runtime_error{"Segmented image segment table checksum mismatch"};
+		}
+
+		std::vector<Image::Segment> segments;
+		std::size_t offset = header_size + table_size;
+		for (std::size_t i = 0; i < count; ++i) {
+			const auto entry = table + i * segment_entry_size;
+			const Image::Segment segment{
+				static_cast<std::uint16_t>(read_u16(entry)),
+				bytes + offset,
+				read_u32(entry + 4)
+			};
+			if (segment.size == 0 || segment.size > 0x10000) {
+				throw std::runtime_error{"Segmented image segment size out of range"};
+			}
+			if (size - offset < segment.size) {
+				throw std::runtime_error{"Segmented image segment truncated"};
+			}
+			if (adler32(segment.bytes, segment.size) != read_u32(entry + 8)) {
+				throw std::runtime_error{"Segmented image segment checksum mismatch"};
+			}
+			segments.push_back(segment);
+			offset += segment.size;
+		}
+		if (offset != size) {
+			throw std::runtime_error{"Segmented image has bytes after its segments"};
+		}
+		return segments;
+	}
+}
+
+// Loads each segment in order, so later segments overwrite earlier ones
+// where they overlap
+Image::Image(const std::vector<Segment> &segments)
+{
+	std::vector<std::uint8_t> flat(0x10000, 0);
+	for (const auto &segment : segments) {
+		for (std::size_t i = 0; i < segment.size; ++i) {
+			flat[(segment.address + i) & 0xFFFF] = segment.bytes[i];
+		}
+	}
+	const auto zero = zero_page();
+	const auto is_zero = [&](const unsigned page) {
+		return std::memcmp(&flat[page << 8], zero, 0x100) == 0;
+	};
+	std::size_t stored = 0;
+	for (unsigned page = 0; page < _pages.size(); ++page) {
+		stored += !is_zero(page);
+	}
+	_contents.resize(stored << 8);
+	stored = 0;
+	for (unsigned page = 0; page < _pages.size(); ++page) {
+		if (is_zero(page)) {
+			_pages[page] = zero;
+			continue;
+		}
+		const auto copy = &_contents[stored++ << 8];
+		std::memcpy(copy, &flat[page << 8], 0x100);
+		_pages[page] = copy;
+	}
+}
+
+const std::uint8_t * Image::zero_page()
+{
+	static const std::array<std::uint8_t, 0x100> zero = {};
+	return zero.data();
+}
+
+// Reads a segmented image, or else a flat binary loaded from address 0,
+// whose bytes past 64 KiB wrap around to the start
+std::shared_ptr<const Image> Image::parse(const std::uint8_t *const bytes, const std::size_t size)
+{
+	if (is_segmented(bytes, size)) {
+		return std::make_shared<const Image>(read_segments(bytes, size));
+	}
+	return std::make_shared<const Image>(std::vector<Segment>{Segment{0, bytes, size}});
+}
+
+// Reads an image from the rest of the stream
+std::shared_ptr<const Image> Image::load(std::istream &in)
+{
+	const std::vector<char> bytes{std::istreambuf_iterator<char>{in}, {}};
+	return parse(reinterpret_cast<const std::uint8_t *>(bytes.data()), bytes.size());
+}
+
+// Reads an image from a file, mapped rather than read where possible.
+// Gives null if the file cannot be opened.
+std::shared_ptr<const Image> Image::load_file(const std::string &path)
+{
+	const Mapped_file file{path};
+	if (!file.is_open()) {
+		return nullptr;
+	}
+	return parse(file.data(), file.size());
+}
@@ -0,0 +1,61 @@
+#ifndef LVCPU_IMAGE_HPP_INCLUDED
+#define LVCPU_IMAGE_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A read-only memory image, whose pages any number of Mems can share until
+// they first write to them. Pages that are all zero are not stored, and
+// share one zero page instead.
+//
+// Images load from flat binaries, holding every byte from address 0 on, or
+// from segmented images, holding only populated address ranges. All fields
+// of a segmented image are little-endian:
+//
+//   header, 12 bytes
+//     0   4  magic "LVSI"
+//     4   1  version, 1
+//     5   1  reserved, 0
+//     6   2  segment count
+//     8   4  Adler-32 of the segment table
+//   segment table, 12 bytes per segment
+//     0   2  load address
+//     2   2  reserved, 0
+//     4   4  size, 1 to 65536, wrapping past 0xFFFF to 0
+//     8   4  Adler-32 of the segment's bytes
+//   the bytes of each segment in table order, with nothing after them
+class Image {
+public:
+	struct Segment {
+		std::uint16_t      address;
+		const std::uint8_t *bytes;
+		std::size_t        size;
+	};
+
+private:
+	std::vector<std::uint8_t> _contents;
+	std::array<const std::uint8_t *, 256> _pages;
+
+public:
+	explicit                    Image(const std::vector<Segment> &segments);
+	Image(const Image &) = delete;
+	Image & operator = (const Image &) = delete;
+	inline const std::uint8_t * page(std::uint8_t page) const;
+	static const std::uint8_t * zero_page();
+
+	static std::shared_ptr<const Image> parse(const std::uint8_t *bytes, std::size_t size);
+	static std::shared_ptr<const Image> load(std::istream &in);
+	static std::shared_ptr<const Image> load_file(const std::string &path);
+};
+
+const std::uint8_t * Image::page(const std::uint8_t page) const
+{
+	return _pages[page];
+}
+
+#endif // LVCPU_IMAGE_HPP_INCLUDED
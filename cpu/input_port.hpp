@@ -0,0 +1,49 @@
+#ifndef LVCPU_INPUT_PORT_HPP_INCLUDED
+#define LVCPU_INPUT_PORT_HPP_INCLUDED
+
+#include <cstdint>
+#include <istream>
+
+#include "device.hpp"
+
+// The guest's input stream as a device, for guests that poll for input
+// rather than wait in IN. Even addresses read as the status register, odd
+// ones as the data register, throughout the pages it is mapped at. Reading
+// either flushes the output tied to the stream, as IN does. Writes are
+// ignored.
+class Input_port final : public Device {
+	std::istream *_input;
+
+public:
+	// Status register bits
+	static constexpr std::uint8_t ready = 0x01;
+	static constexpr std::uint8_t end = 0x02;
+
+	inline explicit      Input_port(std::istream &input);
+	inline std::uint8_t  read(std::uint16_t address) override;
+	inline void          write(std::uint16_t address, std::uint8_t value) override;
+};
+
+Input_port::Input_port(std::istream &input) :
+	_input(&input)
+{}
+
+// Status is ready while input is ready without blocking, and end once it
+// has all been read. Data is the next character, taken from the input, or
+// 0 when none is ready.
+std::uint8_t Input_port::read(const std::uint16_t address)
+{
+	if (_input->tie()) {
+		_input->tie()->flush();
+	}
+	const auto available = _input->rdbuf()->in_avail();
+	if (address & 1u) {
+		return available > 0 ? static_cast<std::uint8_t>(_input->rdbuf()->sbumpc()) : 0;
+	}
+	return available > 0 ? ready : available < 0 ? end : 0;
+}
+
+void Input_port::write(std::uint16_t, std::uint8_t)
+{}
+
+#endif // LVCPU_INPUT_PORT_HPP_INCLUDED
@@ -0,0 +1,1336 @@
+#include "jit.hpp"
+#include "mem.hpp"
+#include "bin_utils.hpp"
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__x86_64__) && defined(__linux__)
+	#include <sys/mman.h>
+	#define LVCPU_JIT_SUPPORTED
+#endif
+
+namespace {
+	constexpr std::size_t code_buffer_size = std::size_t{32} << 20;
+
+	// Room for the largest translation of a block, checked before each one
+	constexpr std::ptrdiff_t max_block_code = 16 << 10;
+
+	constexpr std::size_t max_block_instructions = 64;
+
+	enum Reg : std::uint8_t {
+		rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+		r8, r9, r10, r11, r12, r13, r14, r15
+	};
+
+	// Guest registers live in callee-saved host registers for a whole run.
+	// The remaining budget, cycle count and memory base are only kept in
+	// caller-saved registers, which are saved around calls out of the
+	// translated code.
+	constexpr Reg reg_a = rbx;
+	constexpr Reg reg_c = rbp;
+	constexpr Reg reg_sp = r12;
+	constexpr Reg reg_bp = r13;
+	constexpr Reg reg_f = r14;
+	constexpr Reg reg_context = r15;
+	constexpr Reg reg_budget = r8;
+	constexpr Reg reg_cycles = r9;
+	constexpr Reg reg_memory = r10;
+
+	constexpr Reg callee_saved[] = {rbx, rbp, r12, r13, r14, r15};
+	constexpr Reg call_saved[] = {r8, r9, r10, r11};
+
+	enum Alu : std::uint8_t {
+		alu_add = 0, alu_or = 1, alu_and = 4, alu_sub = 5, alu_xor = 6, alu_cmp = 7
+	};
+
+	enum Shift : std::uint8_t {
+		shift_rol = 0, shift_shl = 4, shift_shr = 5
+	};
+
+	enum Cond : std::uint8_t {
+		cond_c = 0x2, cond_z = 0x4, cond_nz = 0x5, cond_a = 0x7
+	};
+
+	// Emits the handful of x86-64 instructions translations are built from.
+	// Sizes are operand sizes in bits, two byte opcodes include their 0x0F.
+	class Assembler {
+		std::uint8_t *_code;
+
+		static bool needs_rex_for_byte(const unsigned reg)
+		{
+			// Without a REX prefix these encode AH, CH, DH and BH
+			return reg >= rsp && reg <= rdi;
+		}
+
+		void prefix(
+			const unsigned size,
+			const unsigned reg,
+			const unsigned index,
+			const unsigned base,
+			const bool     force_rex)
+		{
+			if (size == 16) {
+				byte(0x66);
+			}
+			const std::uint8_t rex =
+				(size == 64 ? 0x08 : 0)
+				| (reg & 8 ? 0x04 : 0)
+				| (index & 8 ? 0x02 : 0)
+				| (base & 8 ? 0x01 : 0);
+			if (rex || force_rex) {
+				byte(0x40 | rex);
+			}
+		}
+
+		void opcode(const unsigned op)
+		{
+			if (op > 0xFF) {
+				byte(op >> 8);
+			}
+			byte(op);
+		}
+
+		void immediate(const unsigned size, const std::uint32_t value)
+		{
+			if (size == 8) {
+				byte(value);
+			} else if (size == 16) {
+				byte(value);
+				byte(value >> 8);
+			} else {
+				dword(value);
+			}
+		}
+
+	public:
+		explicit Assembler(std::uint8_t *const code) :
+			_code(code)
+		{}
+
+		std::uint8_t * position() const
+		{
+			return _code;
+		}
+
+		void byte(const std::uint8_t value)
+		{
+			*_code++ = value;
+		}
+
+		void dword(const std::uint32_t value)
+		{
+			std::memcpy(_code, &value, sizeof value);
+			_code += sizeof value;
+		}
+
+		void qword(const std::uint64_t value)
+		{
+			std::memcpy(_code, &value, sizeof value);
+			_code += sizeof value;
+		}
+
+		// op reg, rm with both operands registers
+		void rr(const unsigned size, const unsigned op, const unsigned reg, const unsigned rm, const bool byte_regs)
+		{
+			prefix(size, reg, 0, rm, byte_regs && (needs_rex_for_byte(reg) || needs_rex_for_byte(rm)));
+			opcode(op);
+			byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+		}
+
+		// op reg, [base + disp]
+		void rm(const unsigned size, const unsigned op, const unsigned reg, const unsigned base, const std::int32_t disp)
+		{
+			prefix(size, reg, 0, base, size == 8 && needs_rex_for_byte(reg));
+			opcode(op);
+			byte(0x80 | (reg & 7) << 3 | (base & 7));
+			if ((base & 7) == rsp) {
+				byte(0x24);
+			}
+			dword(disp);
+		}
+
+		// op reg, [base + index << scale]
+		void rx(
+			const unsigned size,
+			const unsigned op,
+			const unsigned reg,
+			const unsigned base,
+			const unsigned index,
+			const unsigned scale)
+		{
+			prefix(size, reg, index, base, size == 8 && needs_rex_for_byte(reg));
+			opcode(op);
+			const std::uint8_t sib = scale << 6 | (index & 7) << 3 | (base & 7);
+			if ((base & 7) == rbp) {
+				byte(0x44 | (reg & 7) << 3);
+				byte(sib);
+				byte(0);
+			} else {
+				byte(0x04 | (reg & 7) << 3);
+				byte(sib);
+			}
+		}
+
+		// op reg, [base + index + disp]
+		void rxd(
+			const unsigned     size,
+			const unsigned     op,
+			const unsigned     reg,
+			const unsigned     base,
+			const unsigned     index,
+			const std::int32_t disp)
+		{
+			prefix(size, reg, index, base, size == 8 && needs_rex_for_byte(reg));
+			opcode(op);
+			byte(0x84 | (reg & 7) << 3);
+			byte((index & 7) << 3 | (base & 7));
+			dword(disp);
+		}
+
+		void mov(const unsigned size, const Reg dst, const Reg src)
+		{
+			rr(size, size == 8 ? 0x88 : 0x89, src, dst, size == 8);
+		}
+
+		void mov_imm(const Reg dst, const std::uint32_t value)
+		{
+			prefix(32, 0, 0, dst, false);
+			byte(0xB8 | (dst & 7));
+			dword(value);
+		}
+
+		void mov_imm64(const Reg dst, const std::uint64_t value)
+		{
+			prefix(64, 0, 0, dst, false);
+			byte(0xB8 | (dst & 7));
+			qword(value);
+		}
+
+		void movzx8(const Reg dst, const Reg src)
+		{
+			rr(32, 0x0FB6, dst, src, true);
+		}
+
+		void movzx16(const Reg dst, const Reg src)
+		{
+			rr(32, 0x0FB7, dst, src, false);
+		}
+
+		void alu(const unsigned size, const Alu op, const Reg dst, const Reg src)
+		{
+			rr(size, op << 3 | (size == 8 ? 0x0 : 0x1), src, dst, size == 8);
+		}
+
+		void alu_imm(const unsigned size, const Alu op, const Reg dst, const std::uint32_t value)
+		{
+			rr(size, size == 8 ? 0x80 : 0x81, op, dst, size == 8);
+			immediate(size, value);
+		}
+
+		void shift_imm(const unsigned size, const Shift op, const Reg dst, const std::uint8_t count)
+		{
+			rr(size, size == 8 ? 0xC0 : 0xC1, op, dst, size == 8);
+			byte(count);
+		}
+
+		void test(const unsigned size, const Reg dst, const Reg src)
+		{
+			rr(size, size == 8 ? 0x84 : 0x85, src, dst, size == 8);
+		}
+
+		void test_imm(const unsigned size, const Reg dst, const std::uint32_t value)
+		{
+			rr(size, size == 8 ? 0xF6 : 0xF7, 0, dst, size == 8);
+			immediate(size, value);
+		}
+
+		void neg(const unsigned size, const Reg dst)
+		{
+			rr(size, size == 8 ? 0xF6 : 0xF7, 3, dst, size == 8);
+		}
+
+		void imul(const Reg dst, const Reg src)
+		{
+			rr(32, 0x0FAF, dst, src, false);
+		}
+
+		void imul_imm(const Reg dst, const Reg src, const std::uint32_t value)
+		{
+			rr(32, 0x69, dst, src, false);
+			dword(value);
+		}
+
+		void setcc(const Cond cond, const Reg dst)
+		{
+			rr(8, 0x0F90 | cond, 0, dst, true);
+		}
+
+		void load(const unsigned size, const Reg dst, const Reg base, const std::size_t disp)
+		{
+			rm(size, size == 8 ? 0x8A : 0x8B, dst, base, disp);
+		}
+
+		void store(const unsigned size, const Reg base, const std::size_t disp, const Reg src)
+		{
+			rm(size, size == 8 ? 0x88 : 0x89, src, base, disp);
+		}
+
+		void store_imm(const Reg base, const std::size_t disp, const std::uint32_t value)
+		{
+			rm(32, 0xC7, 0, base, disp);
+			dword(value);
+		}
+
+		// movzx dst, byte [base + index]
+		void load_byte(const Reg dst, const Reg base, const Reg index)
+		{
+			rx(32, 0x0FB6, dst, base, index, 0);
+		}
+
+		// cmp byte [base + index + disp], value
+		void cmp_byte_imm(const Reg base, const Reg index, const std::int32_t disp, const std::uint8_t value)
+		{
+			rxd(8, 0x80, alu_cmp, base, index, disp);
+			byte(value);
+		}
+
+		// 32-bit lea dst, [base + disp]
+		void lea(const Reg dst, const Reg base, const std::int32_t disp)
+		{
+			rm(32, 0x8D, dst, base, disp);
+		}
+
+		void push(const Reg reg)
+		{
+			prefix(32, 0, 0, reg, false);
+			byte(0x50 | (reg & 7));
+		}
+
+		void pop(const Reg reg)
+		{
+			prefix(32, 0, 0, reg, false);
+			byte(0x58 | (reg & 7));
+		}
+
+		void call(const Reg reg)
+		{
+			rr(32, 0xFF, 2, reg, false);
+		}
+
+		void jmp(const Reg reg)
+		{
+			rr(32, 0xFF, 4, reg, false);
+		}
+
+		void ret()
+		{
+			byte(0xC3);
+		}
+
+		// Jumps return where their rel32 is, to be patched once the target
+		// is known. Until then they fall through.
+		std::uint8_t * jmp()
+		{
+			byte(0xE9);
+			const auto rel32 = position();
+			dword(0);
+			return rel32;
+		}
+
+		std::uint8_t * jcc(const Cond cond)
+		{
+			opcode(0x0F80 | cond);
+			const auto rel32 = position();
+			dword(0);
+			return rel32;
+		}
+
+		static void patch(std::uint8_t *const rel32, const void *const target)
+		{
+			const std::int32_t offset =
+				static_cast<const std::uint8_t *>(target) - (rel32 + 4);
+			std::memcpy(rel32, &offset, sizeof offset);
+		}
+	};
+
+	constexpr bool is_g8(const std::uint8_t code)
+	{
+		return code < 0x4u;
+	}
+
+	constexpr bool is_g16(const std::uint8_t code)
+	{
+		return code < 0x2u;
+	}
+
+	constexpr bool is_r16(const std::uint8_t code)
+	{
+		return code < 0x4u;
+	}
+
+	constexpr unsigned flag_zero = 1u;
+	constexpr unsigned flag_carry = 2u;
+	constexpr unsigned flag_all = flag_zero | flag_carry;
+
+	struct Guest_instruction {
+		std::uint16_t address;
+		std::uint8_t  op_code;
+		std::uint8_t  param;
+		std::uint16_t value;
+		std::uint8_t  length;
+		unsigned      flags_read;
+		unsigned      flags_written;
+		bool          ends_block;
+	};
+
+	// Decodes the instruction at address, if it is one that translated code
+	// can run. Encodings the interpreter treats as bad parameters are not.
+	bool decode(
+		const std::uint8_t *const memory,
+		const std::uint16_t       address,
+		Guest_instruction         &instruction)
+	{
+		const auto op_code = memory[address];
+		const auto byte_1 = memory[static_cast<std::uint16_t>(address + 1)];
+		const auto byte_2 = memory[static_cast<std::uint16_t>(address + 2)];
+		const auto p1 = get_high_nibble(byte_1);
+		const auto p2 = get_low_nibble(byte_1);
+		const bool g8_g8 = is_g8(p1) && is_g8(p2);
+		const bool r16_r16 = is_r16(p1) && is_r16(p2);
+		const std::uint16_t i8 = static_cast<std::int8_t>(byte_1);
+		const std::uint16_t n16 = make_word(byte_1, byte_2);
+
+		const auto set = [&](
+			const std::uint8_t  length,
+			const std::uint16_t value = 0,
+			const unsigned      flags_read = 0,
+			const unsigned      flags_written = 0,
+			const bool          ends_block = false
+		) {
+			instruction = Guest_instruction{
+				address, op_code, byte_1, value, length,
+				flags_read, flags_written, ends_block
+			};
+			return true;
+		};
+		// Stores may leave translated code early when they hit translated
+		// code, so every flag has to be up to date when they run.
+		const auto store = [&](const std::uint8_t length, const std::uint16_t value = 0) {
+			return set(length, value, flag_all);
+		};
+
+		switch (op_code) {
+		case 0x00:
+		case 0x05:
+		case 0x06:
+		case 0x24:
+		case 0x2A:
+		case 0x2B:
+		case 0x2C:
+			return set(1);
+		case 0x01:
+			return g8_g8 && set(2, 0, 0, flag_all);
+		case 0x02:
+			return r16_r16 && set(2, 0, 0, flag_all);
+		case 0x03:
+			return g8_g8 && set(2, 0, 0, flag_zero);
+		case 0x04:
+			return r16_r16 && set(2, 0, 0, flag_zero);
+		case 0x07:
+			return ((p1 == 0 && is_g8(p2)) || (p1 == 1 && is_g16(p2))) && set(2);
+		case 0x08:
+		case 0x09:
+		case 0x0A:
+		case 0x20:
+			return g8_g8 && set(2);
+		case 0x0B:
+			return is_g8(p1) && p2 <= 7 && set(2);
+		case 0x0C:
+			return is_g8(p1) && set(2);
+		case 0x0D:
+			return (g8_g8 || (is_g8(p1) && p2 == 0x4)) && set(2, 0, 0, flag_carry);
+		case 0x21:
+			return r16_r16 && set(2);
+		case 0x22:
+			if (byte_1 == 0x01) {
+				return set(2, 0, flag_all);
+			}
+			// MOV AL, IC is left to the interpreter, which keeps IC
+			return byte_1 == 0x03 && set(2);
+		case 0x23:
+		case 0x29:
+			return set(2, i8);
+		case 0x25:
+		case 0x2D:
+			return store(2, i8);
+		case 0x26:
+		case 0x2E:
+			return store(1);
+		case 0x28:
+			return set(1, 0, flag_all, flag_all);
+		case 0x40:
+		case 0x48:
+			return set(3, n16, 0, 0, true);
+		case 0x41:
+		case 0x43:
+			return set(3, n16, flag_zero, 0, true);
+		case 0x42:
+		case 0x44:
+			return set(3, n16, flag_carry, 0, true);
+		case 0x49:
+		case 0x4B:
+			return set(1, 0, 0, 0, true);
+		}
+
+		const auto op_param = get_low_nibble(op_code);
+		switch (get_high_nibble(op_code)) {
+		case 0x8:
+			return is_g8(op_param) && set(2, byte_1);
+		case 0x9:
+			return is_r16(op_param) && set(3, n16);
+		case 0xA:
+			return is_g8(op_param) && store(1);
+		case 0xB:
+			return is_r16(op_param) && store(1);
+		case 0xC:
+			return is_g8(op_param) && set(1);
+		case 0xD:
+			return is_r16(op_param) && set(1);
+		case 0xE:
+			return is_g8(op_param) && set(2, byte_1, 0, flag_all);
+		case 0xF:
+			return is_r16(op_param) && set(3, n16, 0, flag_all);
+		}
+		return false;
+	}
+
+	Reg r16_reg(const std::uint8_t code)
+	{
+		static constexpr Reg regs[] = {reg_a, reg_c, reg_sp, reg_bp};
+		return regs[code];
+	}
+
+	// Emits the code for the instructions of one block
+	class Translator {
+		struct Store_exit {
+			std::uint8_t  *jump;
+			std::uint16_t ip;
+			std::uint32_t instructions;
+			std::uint32_t cycles;
+		};
+
+		struct Device_load {
+			std::uint8_t *jump;
+			std::uint8_t *resume;
+			Reg          dst;
+			Reg          address;
+		};
+
+		Assembler                &_as;
+		const bool               _devices_mapped;
+		const std::uintptr_t     _read_byte;
+		const std::uintptr_t     _write_byte;
+		const std::uintptr_t     _write_word;
+		const void *const        _indirect;
+		const void *const        _exit;
+		std::vector<Store_exit>  _store_exits;
+		std::vector<Device_load> _device_loads;
+
+		// Loads the byte at the address in the given register, which is
+		// zero-extended from 16 bits. Once devices are mapped, pages are
+		// checked first, and device pages are read through Mem out of line.
+		void load_byte(const Reg dst, const Reg address)
+		{
+			if (_devices_mapped) {
+				_as.mov(32, r11, address);
+				_as.shift_imm(32, shift_shr, r11, 8);
+				_as.cmp_byte_imm(reg_context, r11, offsetof(Jit::Context, device_pages), 0);
+				const auto jump = _as.jcc(cond_nz);
+				_as.load_byte(dst, reg_memory, address);
+				_device_loads.push_back(Device_load{jump, _as.position(), dst, address});
+				return;
+			}
+			_as.load_byte(dst, reg_memory, address);
+		}
+
+		void load_g8(const Reg dst, const std::uint8_t code)
+		{
+			switch (code) {
+			case 0x0:
+				_as.movzx8(dst, reg_a);
+				break;
+			case 0x2:
+				_as.movzx8(dst, reg_c);
+				break;
+			default:
+				// CH reads AH, as it does in CPU::get_g8()
+				_as.mov(32, dst, reg_a);
+				_as.shift_imm(32, shift_shr, dst, 8);
+			}
+		}
+
+		// Clobbers src and the host flags
+		void store_g8(const std::uint8_t code, const Reg src)
+		{
+			switch (code) {
+			case 0x0:
+				_as.mov(8, reg_a, src);
+				break;
+			case 0x2:
+				_as.mov(8, reg_c, src);
+				break;
+			default:
+				const auto reg = code == 0x1 ? reg_a : reg_c;
+				_as.movzx8(src, src);
+				_as.shift_imm(32, shift_shl, src, 8);
+				_as.movzx8(reg, reg);
+				_as.alu(32, alu_or, reg, src);
+			}
+		}
+
+		// Guest flags are collected in ecx (carry) and esi (zero) from the
+		// host flags, then merged into F.
+		void begin_flags(const unsigned flags)
+		{
+			if (flags & flag_carry) {
+				_as.alu(32, alu_xor, rcx, rcx);
+			}
+			if (flags & flag_zero) {
+				_as.alu(32, alu_xor, rsi, rsi);
+			}
+		}
+
+		void capture_flags(const unsigned flags, const Cond carry = cond_c)
+		{
+			if (flags & flag_carry) {
+				_as.setcc(carry, rcx);
+			}
+			if (flags & flag_zero) {
+				_as.setcc(cond_z, rsi);
+			}
+		}
+
+		// F never has more than its zero and carry bits set, so when both
+		// are written the old value does not matter.
+		void commit_flags(const unsigned flags)
+		{
+			if (flags == flag_all) {
+				_as.rx(32, 0x8D, reg_f, rsi, rcx, 1);
+			} else if (flags & flag_carry) {
+				_as.alu(32, alu_add, rcx, rcx);
+				_as.alu_imm(32, alu_and, reg_f, flag_zero);
+				_as.alu(32, alu_or, reg_f, rcx);
+			} else if (flags & flag_zero) {
+				_as.alu_imm(32, alu_and, reg_f, flag_carry);
+				_as.alu(32, alu_or, reg_f, rsi);
+			}
+		}
+
+		// ADD and SUB on g8, with p2 in edx unless an immediate is given
+		void arithmetic_g8(
+			const Alu           op,
+			const std::uint8_t  p1,
+			const unsigned      flags,
+			const bool          immediate,
+			const std::uint8_t  value = 0)
+		{
+			load_g8(rax, p1);
+			begin_flags(flags);
+			if (immediate) {
+				_as.alu_imm(8, op, rax, value);
+			} else {
+				_as.alu(8, op, rax, rdx);
+			}
+			// The zero flag is taken from get_g8(p1) after the write, which
+			// for CH is AH
+			capture_flags(p1 == 0x3 ? flags & flag_carry : flags);
+			store_g8(p1, rax);
+			if (p1 == 0x3 && (flags & flag_zero)) {
+				load_g8(rax, p1);
+				_as.test(32, rax, rax);
+				capture_flags(flag_zero);
+			}
+			commit_flags(flags);
+		}
+
+		void arithmetic_r16(const Alu op, const Reg p1, const unsigned flags, const Reg p2)
+		{
+			begin_flags(flags);
+			_as.alu(16, op, p1, p2);
+			capture_flags(flags);
+			commit_flags(flags);
+		}
+
+		void arithmetic_r16_imm(const Alu op, const Reg p1, const unsigned flags, const std::uint16_t value)
+		{
+			begin_flags(flags);
+			_as.alu_imm(16, op, p1, value);
+			capture_flags(flags);
+			commit_flags(flags);
+		}
+
+		// Leaves [BP+i8] in dst
+		void address_bp(const Reg dst, const std::uint16_t value)
+		{
+			_as.lea(dst, reg_bp, static_cast<std::int16_t>(value));
+			_as.movzx16(dst, dst);
+		}
+
+		// Loads the word at the address in edx into eax, clobbering ecx
+		void load_word()
+		{
+			load_byte(rax, rdx);
+			_as.lea(rcx, rdx, 1);
+			_as.movzx16(rcx, rcx);
+			load_byte(rcx, rcx);
+			_as.shift_imm(32, shift_shl, rcx, 8);
+			_as.alu(32, alu_or, rax, rcx);
+		}
+
+		// Writes edx to the address in esi through the Jit, and leaves when
+		// that discarded a translation, possibly the one running. Once
+		// devices are mapped, the cycles run so far, up to and including
+		// this instruction, are stored first for them to see.
+		void write(
+			const std::uintptr_t    helper,
+			const Guest_instruction &instruction,
+			const std::uint32_t     instructions_left,
+			const std::uint32_t     cycles_left)
+		{
+			if (_devices_mapped) {
+				_as.mov(32, rax, reg_cycles);
+				_as.alu_imm(32, alu_sub, rax, cycles_left);
+				_as.store(32, reg_context, offsetof(Jit::Context, cycles), rax);
+			}
+			for (const auto reg : call_saved) {
+				_as.push(reg);
+			}
+			_as.mov(64, rdi, reg_context);
+			_as.mov_imm64(rax, helper);
+			_as.call(rax);
+			for (auto i = std::size(call_saved); i-- > 0;) {
+				_as.pop(call_saved[i]);
+			}
+			_as.test(32, rax, rax);
+			_store_exits.push_back(Store_exit{
+				_as.jcc(cond_nz),
+				static_cast<std::uint16_t>(instruction.address + instruction.length),
+				instructions_left,
+				cycles_left
+			});
+		}
+
+		void indirect()
+		{
+			Assembler::patch(_as.jmp(), _indirect);
+		}
+
+		void branch(const unsigned flag, const bool if_set, const Guest_instruction &instruction)
+		{
+			_as.test_imm(32, reg_f, flag);
+			chain_if(if_set ? cond_nz : cond_z, instruction.value);
+			chain(instruction.address + instruction.length);
+		}
+
+		void swap_with_shadow()
+		{
+			const std::pair<Reg, std::size_t> shadows[] = {
+				{reg_a, offsetof(Jit::Context, shadow_a)},
+				{reg_c, offsetof(Jit::Context, shadow_c)},
+				{reg_f, offsetof(Jit::Context, shadow_f)},
+				{reg_sp, offsetof(Jit::Context, shadow_sp)},
+				{reg_bp, offsetof(Jit::Context, shadow_bp)}
+			};
+			for (const auto &shadow : shadows) {
+				_as.load(32, rax, reg_context, shadow.second);
+				_as.store(32, reg_context, shadow.second, shadow.first);
+				_as.mov(32, shadow.first, rax);
+			}
+		}
+
+	public:
+		struct Exit {
+			std::uint16_t target;
+			std::uint8_t  *jump;
+			std::uint8_t  *stub;
+		};
+
+		// Exits to other blocks, with where their jumps are and the stub
+		// those jump to until they are linked
+		std::vector<Exit> exits;
+
+		Translator(
+			Assembler            &as,
+			const bool           devices_mapped,
+			const std::uintptr_t read_byte,
+			const std::uintptr_t write_byte,
+			const std::uintptr_t write_word,
+			const void *const    indirect,
+			const void *const    exit
+		) :
+			_as(as),
+			_devices_mapped(devices_mapped),
+			_read_byte(read_byte),
+			_write_byte(write_byte),
+			_write_word(write_word),
+			_indirect(indirect),
+			_exit(exit)
+		{}
+
+		// Jumps to the block at target, through the indirect lookup until
+		// the jump is linked to it.
+		void chain(const std::uint16_t target)
+		{
+			const auto jump = _as.jmp();
+			exits.push_back(Exit{target, jump, _as.position()});
+			_as.mov_imm(rax, target);
+			indirect();
+		}
+
+		// Like chain(), if cond holds. The stub is emitted by finish().
+		void chain_if(const Cond cond, const std::uint16_t target)
+		{
+			exits.push_back(Exit{target, _as.jcc(cond), nullptr});
+		}
+
+		// Emits one instruction, computing only the flags in live that it
+		// writes. Stores need what is left of the block in case they leave.
+		void translate(
+			const Guest_instruction &instruction,
+			const unsigned          live,
+			const std::uint32_t     instructions_left,
+			const std::uint32_t     cycles_left)
+		{
+			const auto p1 = get_high_nibble(instruction.param);
+			const auto p2 = get_low_nibble(instruction.param);
+			const auto flags = instruction.flags_written & live;
+			const auto next_ip = static_cast<std::uint16_t>(instruction.address + instruction.length);
+
+			switch (instruction.op_code) {
+			case 0x00:
+				return;
+			case 0x01:
+				load_g8(rdx, p2);
+				return arithmetic_g8(alu_add, p1, flags, false);
+			case 0x02:
+				return arithmetic_r16(alu_add, r16_reg(p1), flags, r16_reg(p2));
+			case 0x03:
+				load_g8(rdx, p2);
+				return arithmetic_g8(alu_sub, p1, flags, false);
+			case 0x04:
+				return arithmetic_r16(alu_sub, r16_reg(p1), flags, r16_reg(p2));
+			case 0x05:
+				return _as.alu_imm(16, alu_add, reg_c, 1);
+			case 0x06:
+				return _as.alu_imm(16, alu_sub, reg_c, 1);
+			case 0x07:
+				if (p1 == 0x1) {
+					return _as.neg(16, r16_reg(p2));
+				}
+				load_g8(rax, p2);
+				_as.neg(32, rax);
+				return store_g8(p2, rax);
+			case 0x08:
+			case 0x09:
+			case 0x0A: {
+				static constexpr Alu ops[] = {alu_and, alu_or, alu_xor};
+				load_g8(rax, p1);
+				load_g8(rdx, p2);
+				_as.alu(32, ops[instruction.op_code - 0x08], rax, rdx);
+				return store_g8(p1, rax);
+			}
+			case 0x0B:
+				load_g8(rax, p1);
+				if (p2 != 0) {
+					_as.shift_imm(8, shift_rol, rax, p2);
+				}
+				return store_g8(p1, rax);
+			case 0x0C:
+				load_g8(rax, p1);
+				if (p2 > 7) {
+					_as.shift_imm(32, shift_shr, rax, 16 - p2);
+				} else if (p2 != 0) {
+					_as.shift_imm(32, shift_shl, rax, p2);
+				}
+				return store_g8(p1, rax);
+			case 0x0D:
+				if (p2 == 0x4) {
+					// MUL A, g8 sets the carry from A * g8, but then
+					// multiplies A by the register code, as the interpreter
+					_as.movzx16(rax, reg_a);
+					load_g8(rdx, p1);
+					_as.imul(rax, rdx);
+					begin_flags(flags);
+					_as.alu_imm(32, alu_cmp, rax, 0xFFFF);
+					capture_flags(flags, cond_a);
+					commit_flags(flags);
+					_as.imul_imm(reg_a, reg_a, p1);
+					return _as.movzx16(reg_a, reg_a);
+				}
+				load_g8(rax, p1);
+				load_g8(rdx, p2);
+				_as.imul(rax, rdx);
+				begin_flags(flags);
+				_as.alu_imm(32, alu_cmp, rax, 0xFF);
+				capture_flags(flags, cond_a);
+				store_g8(p1, rax);
+				return commit_flags(flags);
+			case 0x20:
+				load_g8(rax, p2);
+				return store_g8(p1, rax);
+			case 0x21:
+				return _as.mov(32, r16_reg(p1), r16_reg(p2));
+			case 0x22:
+				if (instruction.param == 0x01) {
+					return _as.mov(8, reg_a, reg_f);
+				}
+				return _as.mov_imm(reg_a, next_ip);
+			case 0x23:
+				address_bp(rdx, instruction.value);
+				load_byte(rax, rdx);
+				return _as.mov(8, reg_a, rax);
+			case 0x24:
+				load_byte(rax, reg_c);
+				return _as.mov(8, reg_a, rax);
+			case 0x25:
+				address_bp(rsi, instruction.value);
+				_as.movzx8(rdx, reg_a);
+				return write(_write_byte, instruction, instructions_left, cycles_left);
+			case 0x26:
+				_as.mov(32, rsi, reg_c);
+				_as.movzx8(rdx, reg_a);
+				return write(_write_byte, instruction, instructions_left, cycles_left);
+			case 0x28:
+				return swap_with_shadow();
+			case 0x29:
+				address_bp(rdx, instruction.value);
+				load_word();
+				return _as.mov(32, reg_a, rax);
+			case 0x2A:
+				_as.mov(32, rdx, reg_c);
+				load_word();
+				return _as.mov(32, reg_a, rax);
+			case 0x2B:
+				_as.load(32, rax, reg_context, offsetof(Jit::Context, t));
+				return _as.mov(8, reg_a, rax);
+			case 0x2C:
+				_as.movzx8(rax, reg_a);
+				return _as.store(32, reg_context, offsetof(Jit::Context, t), rax);
+			case 0x2D:
+				address_bp(rsi, instruction.value);
+				_as.mov(32, rdx, reg_a);
+				return write(_write_word, instruction, instructions_left, cycles_left);
+			case 0x2E:
+				_as.mov(32, rsi, reg_c);
+				_as.mov(32, rdx, reg_a);
+				return write(_write_word, instruction, instructions_left, cycles_left);
+			case 0x40:
+			case 0x48:
+				// CALL does not push a return address, so it is a plain jump
+				return chain(instruction.value);
+			case 0x41:
+				return branch(flag_zero, true, instruction);
+			case 0x42:
+				return branch(flag_carry, true, instruction);
+			case 0x43:
+				return branch(flag_zero, false, instruction);
+			case 0x44:
+				return branch(flag_carry, false, instruction);
+			case 0x49:
+				_as.mov(32, rax, reg_a);
+				return indirect();
+			case 0x4B:
+				_as.mov(32, rdx, reg_sp);
+				load_word();
+				_as.alu_imm(16, alu_add, reg_sp, 2);
+				return indirect();
+			}
+
+			const auto op_param = get_low_nibble(instruction.op_code);
+			switch (get_high_nibble(instruction.op_code)) {
+			case 0x8:
+				_as.mov_imm(rax, instruction.value);
+				return store_g8(op_param, rax);
+			case 0x9:
+				return _as.mov_imm(r16_reg(op_param), instruction.value);
+			case 0xA:
+				_as.alu_imm(16, alu_sub, reg_sp, 1);
+				_as.mov(32, rsi, reg_sp);
+				load_g8(rdx, op_param);
+				return write(_write_byte, instruction, instructions_left, cycles_left);
+			case 0xB:
+				_as.alu_imm(16, alu_sub, reg_sp, 2);
+				_as.mov(32, rsi, reg_sp);
+				_as.mov(32, rdx, r16_reg(op_param));
+				return write(_write_word, instruction, instructions_left, cycles_left);
+			case 0xC:
+				load_byte(rax, reg_sp);
+				store_g8(op_param, rax);
+				return _as.alu_imm(16, alu_add, reg_sp, 1);
+			case 0xD:
+				_as.mov(32, rdx, reg_sp);
+				load_word();
+				_as.mov(32, r16_reg(op_param), rax);
+				return _as.alu_imm(16, alu_add, reg_sp, 2);
+			case 0xE:
+				return arithmetic_g8(alu_add, op_param, flags, true, instruction.value);
+			case 0xF:
+				return arithmetic_r16_imm(alu_add, r16_reg(op_param), flags, instruction.value);
+			}
+		}
+
+		// Emits the stubs of conditional exits, the exits taken by stores
+		// that discarded translated code, handing back the budget and cycles
+		// of the instructions skipped, and the calls for loads from devices.
+		void finish()
+		{
+			for (const auto &load : _device_loads) {
+				Assembler::patch(load.jump, _as.position());
+				std::vector<Reg> saved;
+				for (const auto reg : {rax, rcx, rdx, rsi, r8, r9, r10, r11}) {
+					if (reg != load.dst) {
+						saved.push_back(reg);
+					}
+				}
+				// Keeps the stack 16-byte aligned for the call
+				if (saved.size() % 2) {
+					saved.push_back(rdi);
+				}
+				for (const auto reg : saved) {
+					_as.push(reg);
+				}
+				_as.mov(32, rsi, load.address);
+				_as.mov(64, rdi, reg_context);
+				_as.mov_imm64(rax, _read_byte);
+				_as.call(rax);
+				_as.mov(32, load.dst, rax);
+				for (auto reg = saved.rbegin(); reg != saved.rend(); ++reg) {
+					_as.pop(*reg);
+				}
+				Assembler::patch(_as.jmp(), load.resume);
+			}
+			for (auto &exit : exits) {
+				if (!exit.stub) {
+					exit.stub = _as.position();
+					Assembler::patch(exit.jump, exit.stub);
+					_as.mov_imm(rax, exit.target);
+					indirect();
+				}
+			}
+			for (const auto &store_exit : _store_exits) {
+				Assembler::patch(store_exit.jump, _as.position());
+				_as.alu_imm(32, alu_add, reg_budget, store_exit.instructions);
+				_as.alu_imm(32, alu_sub, reg_cycles, store_exit.cycles);
+				_as.store_imm(reg_context, offsetof(Jit::Context, ip), store_exit.ip);
+				Assembler::patch(_as.jmp(), _exit);
+			}
+		}
+	};
+
+	const std::pair<Reg, std::size_t> context_registers[] = {
+		{reg_a, offsetof(Jit::Context, a)},
+		{reg_c, offsetof(Jit::Context, c)},
+		{reg_f, offsetof(Jit::Context, f)},
+		{reg_sp, offsetof(Jit::Context, sp)},
+		{reg_bp, offsetof(Jit::Context, bp)},
+		{reg_budget, offsetof(Jit::Context, budget)},
+		{reg_cycles, offsetof(Jit::Context, cycles)}
+	};
+}
+
+Jit::Jit(Mem &mem) :
+	_mem(mem),
+	_block_at(0x10000, nullptr),
+	_entries(0x10000, nullptr)
+{
+#ifdef LVCPU_JIT_SUPPORTED
+	void *const buffer = mmap(
+		nullptr, code_buffer_size,
+		PROT_READ | PROT_WRITE | PROT_EXEC,
+		MAP_PRIVATE | MAP_ANONYMOUS,
+		-1, 0
+	);
+	if (buffer == MAP_FAILED) {
+		throw std::runtime_error{"Could not map memory for JIT code"};
+	}
+	_code_buffer = static_cast<std::uint8_t *>(buffer);
+#else
+	throw std::runtime_error{"JIT engine is only supported on x86-64 Linux"};
+#endif
+	_code_end = _code_buffer + code_buffer_size;
+	_context.memory = _mem.contents();
+	_context.entries = _entries.data();
+	_context.jit = this;
+	emit_runtime();
+	_mem.attach(this);
+	devices_changed();
+}
+
+Jit::~Jit()
+{
+	_mem.attach(static_cast<Jit *>(nullptr));
+#ifdef LVCPU_JIT_SUPPORTED
+	munmap(_code_buffer, code_buffer_size);
+#endif
+}
+
+// Emits the code shared by all translations: entering with the guest state
+// loaded into host registers, leaving with it stored back to the context,
+// and looking up the translation for a guest address in eax.
+void Jit::emit_runtime()
+{
+	Assembler as{_code_buffer};
+
+	_enter = reinterpret_cast<void (*)(Context *, const void *)>(
+		reinterpret_cast<std::uintptr_t>(as.position())
+	);
+	for (const auto reg : callee_saved) {
+		as.push(reg);
+	}
+	as.alu_imm(64, alu_sub, rsp, 8);
+	as.mov(64, reg_context, rdi);
+	for (const auto &reg : context_registers) {
+		as.load(32, reg.first, reg_context, reg.second);
+	}
+	as.load(64, reg_memory, reg_context, offsetof(Context, memory));
+	as.jmp(rsi);
+
+	_exit = as.position();
+	for (const auto &reg : context_registers) {
+		as.store(32, reg_context, reg.second, reg.first);
+	}
+	as.alu_imm(64, alu_add, rsp, 8);
+	for (auto i = std::size(callee_saved); i-- > 0;) {
+		as.pop(callee_saved[i]);
+	}
+	as.ret();
+
+	_indirect = as.position();
+	as.store(32, reg_context, offsetof(Context, ip), rax);
+	as.load(64, rdx, reg_context, offsetof(Context, entries));
+	as.rx(64, 0x8B, rdx, rdx, rax, 3);
+	as.test(64, rdx, rdx);
+	Assembler::patch(as.jcc(cond_z), _exit);
+	as.jmp(rdx);
+
+	_code_start = as.position();
+	_code = _code_start;
+}
+
+// Translates the block starting at address, or returns null when its first
+// instruction has to be left to the interpreter.
+const void * Jit::translate(const std::uint16_t address)
+{
+	const auto memory = _mem.contents();
+	std::vector<Guest_instruction> instructions;
+	std::uint32_t end = address;
+	while (instructions.size() < max_block_instructions) {
+		Guest_instruction instruction;
+		if (!decode(memory, end, instruction) || end + instruction.length > 0x10000) {
+			break;
+		}
+		if (!_mem.is_ram(end) || !_mem.is_ram(end + instruction.length - 1) || _mem.breaks_at(end)) {
+			break;
+		}
+		instructions.push_back(instruction);
+		end += instruction.length;
+		if (instruction.ends_block) {
+			break;
+		}
+	}
+	if (instructions.empty()) {
+		return nullptr;
+	}
+	if (_code_end - _code < max_block_code) {
+		flush();
+	}
+
+	// Flags only need computing if something reads them before they are
+	// written again. Anything after the block might read them.
+	std::vector<unsigned> live(instructions.size());
+	unsigned live_flags = flag_all;
+	for (auto i = instructions.size(); i-- > 0;) {
+		live[i] = live_flags;
+		live_flags = (live_flags & ~instructions[i].flags_written) | instructions[i].flags_read;
+	}
+
+	auto block = std::make_unique<Block>();
+	block->address = address;
+	Assembler as{_code};
+	block->code = as.position();
+
+	// Each block takes its instructions from the budget up front, and
+	// leaves straight away if there are not enough left.
+	const std::uint32_t block_instructions = instructions.size();
+	const std::uint32_t block_cycles = end - address;
+	as.alu_imm(32, alu_sub, reg_budget, block_instructions);
+	const auto over_budget = as.jcc(cond_c);
+	as.alu_imm(32, alu_add, reg_cycles, block_cycles);
+
+	Translator translator{
+		as,
+		_devices_mapped,
+		reinterpret_cast<std::uintptr_t>(&Jit::read_byte),
+		reinterpret_cast<std::uintptr_t>(&Jit::write_byte),
+		reinterpret_cast<std::uintptr_t>(&Jit::write_word),
+		_indirect,
+		_exit
+	};
+	std::uint32_t instructions_left = block_instructions;
+	std::uint32_t cycles_left = block_cycles;
+	for (std::size_t i = 0; i < instructions.size(); ++i) {
+		instructions_left -= 1;
+		cycles_left -= instructions[i].length;
+		translator.translate(instructions[i], live[i], instructions_left, cycles_left);
+	}
+	if (!instructions.back().ends_block) {
+		translator.chain(end);
+	}
+
+	Assembler::patch(over_budget, as.position());
+	as.alu_imm(32, alu_add, reg_budget, block_instructions);
+	as.store_imm(reg_context, offsetof(Context, ip), address);
+	Assembler::patch(as.jmp(), _exit);
+	translator.finish();
+
+	_code = as.position() + (-reinterpret_cast<std::uintptr_t>(as.position()) & 15);
+	for (const auto &exit : translator.exits) {
+		block->exits.push_back(Exit{exit.target, exit.jump, exit.stub});
+	}
+
+	auto &translated = *block;
+	_blocks.push_back(std::move(block));
+	_block_at[address] = &translated;
+	_entries[address] = translated.code;
+	for (std::uint32_t page = address >> 8; page <= (end - 1) >> 8; ++page) {
+		_page_blocks[page].push_back(&translated);
+	}
+	for (std::size_t exit = 0; exit < translated.exits.size(); ++exit) {
+		const auto target = translated.exits[exit].target;
+		if (_block_at[target]) {
+			link(translated, exit, *_block_at[target]);
+		} else {
+			_pending_links[target].push_back(Link{&translated, exit});
+		}
+	}
+	const auto pending = _pending_links.find(address);
+	if (pending != _pending_links.end()) {
+		for (const auto &pending_link : pending->second) {
+			if (pending_link.from->live) {
+				link(*pending_link.from, pending_link.exit, translated);
+			}
+		}
+		_pending_links.erase(pending);
+	}
+	return translated.code;
+}
+
+void Jit::link(Block &from, const std::size_t exit, Block &to)
+{
+	Assembler::patch(from.exits[exit].jump, to.code);
+	to.incoming.push_back(Link{&from, exit});
+}
+
+// Discards every translation with code in the page. Jumps into them fall
+// back to the indirect lookup, and are linked again once the address is
+// translated again.
+void Jit::invalidate_page(const std::uint8_t page)
+{
+	const auto blocks = std::move(_page_blocks[page]);
+	_page_blocks[page].clear();
+	for (const auto block : blocks) {
+		if (!block->live) {
+			continue;
+		}
+		block->live = false;
+		_block_at[block->address] = nullptr;
+		_entries[block->address] = nullptr;
+		for (const auto &incoming : block->incoming) {
+			if (incoming.from->live) {
+				const auto &exit = incoming.from->exits[incoming.exit];
+				Assembler::patch(exit.jump, exit.stub);
+				_pending_links[block->address].push_back(incoming);
+			}
+		}
+		block->incoming.clear();
+		_code_modified = true;
+	}
+}
+
+// Discards all translations to reclaim the code buffer. Discarded blocks
+// are kept until now, as running code may still be in one.
+void Jit::flush()
+{
+	_blocks.clear();
+	std::fill(_block_at.begin(), _block_at.end(), nullptr);
+	std::fill(_entries.begin(), _entries.end(), nullptr);
+	for (auto &blocks : _page_blocks) {
+		blocks.clear();
+	}
+	_pending_links.clear();
+	_code = _code_start;
+}
+
+// Rereads which pages are mapped to devices or watched, discarding all
+// translations made with the old mapping
+void Jit::devices_changed()
+{
+	_devices_mapped = false;
+	for (unsigned page = 0; page < 256; ++page) {
+		_context.device_pages[page] = !_mem.reads_ram(page << 8);
+		_devices_mapped = _devices_mapped || _context.device_pages[page];
+	}
+	flush();
+}
+
+std::uint32_t Jit::read_byte(Context *const context, const std::uint32_t address)
+{
+	return context->jit->_mem.read(address);
+}
+
+std::uint32_t Jit::write_byte(
+	Context             *const context,
+	const std::uint32_t address,
+	const std::uint32_t value)
+{
+	auto &jit = *context->jit;
+	jit._code_modified = false;
+	jit._mem.write(address, value);
+	return jit._code_modified || jit._mem.stopped() || !jit._mem.is_ram(address);
+}
+
+std::uint32_t Jit::write_word(
+	Context             *const context,
+	const std::uint32_t address,
+	const std::uint32_t value)
+{
+	auto &jit = *context->jit;
+	jit._code_modified = false;
+	jit._mem.write_word(address, value);
+	return
+		jit._code_modified || jit._mem.stopped()
+		|| !jit._mem.is_ram(address) || !jit._mem.is_ram(address + 1);
+}
+
+Jit::Context & Jit::context()
+{
+	return _context;
+}
+
+const void * Jit::translation(const std::uint16_t address)
+{
+	if (_entries[address]) {
+		return _entries[address];
+	}
+	return translate(address);
+}
+
+void Jit::run(const void *const code)
+{
+	_enter(&_context, code);
+}
@@ -0,0 +1,109 @@
+#ifndef LVCPU_JIT_HPP_INCLUDED
+#define LVCPU_JIT_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class Mem;
+
+// Translates guest basic blocks into x86-64 code and runs them. A block ends
+// at a jump, CALL or RET, or right before any instruction it cannot
+// translate (INT, IRET, IN, OUT, STOP and the like), which the interpreter
+// then executes. Blocks jump to each other directly once both are
+// translated, and writes to a page holding a translation discard it. Code
+// on device pages is not translated, and loads from them go through Mem, as
+// do loads from watched pages. Blocks end before a breakpoint, and right
+// after a write that hits a watchpoint or a device, which may have
+// scheduled an event.
+class Jit {
+public:
+	// Guest state while translated code runs, copied in and out by the CPU
+	struct Context {
+		std::uint32_t a = 0, c = 0, f = 0, sp = 0, bp = 0;
+		std::uint32_t shadow_a = 0, shadow_c = 0, shadow_f = 0;
+		std::uint32_t shadow_sp = 0, shadow_bp = 0;
+		std::uint32_t ip = 0, t = 0;
+		// Instructions that may still run, and cycles that did run, also
+		// kept up to date for devices that translated code writes to
+		std::uint32_t budget = 0, cycles = 0;
+		const std::uint8_t *memory = nullptr;
+		const void *const *entries = nullptr;
+		Jit *jit = nullptr;
+		// Non-zero for pages mapped to a device or watched for reads, which
+		// loads go through Mem for instead of reading memory
+		std::uint8_t device_pages[256] = {};
+	};
+
+private:
+	struct Block;
+
+	struct Link {
+		Block       *from;
+		std::size_t exit;
+	};
+
+	struct Exit {
+		std::uint16_t target;
+		std::uint8_t  *jump;
+		std::uint8_t  *stub;
+	};
+
+	struct Block {
+		std::uint16_t     address;
+		const void        *code;
+		std::vector<Exit> exits;
+		std::vector<Link> incoming;
+		bool              live = true;
+	};
+
+	Mem &_mem;
+	Context _context;
+	std::uint8_t *_code_buffer = nullptr;
+	std::uint8_t *_code_start = nullptr;
+	std::uint8_t *_code_end = nullptr;
+	std::uint8_t *_code = nullptr;
+	void (*_enter)(Context *context, const void *code) = nullptr;
+	const void *_exit = nullptr;
+	const void *_indirect = nullptr;
+	std::vector<std::unique_ptr<Block>> _blocks;
+	std::vector<Block *> _block_at;
+	std::vector<const void *> _entries;
+	std::array<std::vector<Block *>, 256> _page_blocks;
+	std::unordered_map<std::uint16_t, std::vector<Link>> _pending_links;
+	bool _code_modified = false;
+	bool _devices_mapped = false;
+
+	void emit_runtime();
+	const void * translate(std::uint16_t address);
+	void link(Block &from, std::size_t exit, Block &to);
+	void invalidate_page(std::uint8_t page);
+	void flush();
+
+	static std::uint32_t read_byte(Context *context, std::uint32_t address);
+	static std::uint32_t write_byte(Context *context, std::uint32_t address, std::uint32_t value);
+	static std::uint32_t write_word(Context *context, std::uint32_t address, std::uint32_t value);
+
+public:
+	explicit Jit(Mem &mem);
+	~Jit();
+	Jit(const Jit &) = delete;
+	Jit & operator = (const Jit &) = delete;
+	Context &    context();
+	const void * translation(std::uint16_t address);
+	void         run(const void *code);
+	inline void  invalidate(std::uint16_t address);
+	void         devices_changed();
+};
+
+void Jit::invalidate(const std::uint16_t address)
+{
+	if (!_page_blocks[address >> 8].empty()) {
+		invalidate_page(address >> 8);
+	}
+}
+
+#endif // LVCPU_JIT_HPP_INCLUDED
@@ -0,0 +1,777 @@
+#include "lockstep.hpp"
+#include "bin_utils.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+	typedef std::array<std::uint16_t, Lockstep::max_lanes> Lane_words;
+	typedef std::array<std::uint8_t, Lockstep::max_lanes> Lane_bytes;
+
+	constexpr bool is_g8(const std::uint8_t code)
+	{
+		return code < 0x4u;
+	}
+
+	constexpr bool is_g16(const std::uint8_t code)
+	{
+		return code < 0x2u;
+	}
+
+	constexpr bool is_r16(const std::uint8_t code)
+	{
+		return code < 0x4u;
+	}
+
+	// A byte register of every lane, as a byte of a word register
+	struct G8 {
+		std::uint16_t *words;
+		unsigned      shift;
+	};
+
+	// The register read for a g8 code, which as in CPU::get_g8() is AH for CH
+	G8 source_g8(std::array<Lane_words, 4> &r16, const std::uint8_t code)
+	{
+		return G8{r16[code == 0x2 ? 1 : 0].data(), code == 0x0 || code == 0x2 ? 0u : 8u};
+	}
+
+	// The register written for a g8 code
+	G8 dest_g8(std::array<Lane_words, 4> &r16, const std::uint8_t code)
+	{
+		return G8{r16[code >> 1].data(), code & 1u ? 8u : 0u};
+	}
+
+	std::uint8_t get(const G8 &g8, const unsigned lane)
+	{
+		return static_cast<std::uint8_t>(g8.words[lane] >> g8.shift);
+	}
+
+	void set(const G8 &g8, const unsigned lane, const std::uint8_t value)
+	{
+		g8.words[lane] = (g8.words[lane] & (0xFF00u >> g8.shift)) | value << g8.shift;
+	}
+
+	void set_zero_flag(Lane_bytes &f, const unsigned lane, const bool zero)
+	{
+		f[lane] = (f[lane] & (0xFFu ^ 1u)) | zero;
+	}
+
+	void set_flags(Lane_bytes &f, const unsigned lane, const bool zero, const bool carry)
+	{
+		f[lane] = (f[lane] & (0xFFu ^ 3u)) | zero | carry << 1;
+	}
+
+	bool jump_condition(const std::uint8_t jump_op_code, const std::uint8_t f)
+	{
+		switch (jump_op_code) {
+		case 0x41:
+			return f & 1u;
+		case 0x42:
+			return f & 2u;
+		case 0x43:
+			return !(f & 1u);
+		default:
+			return !(f & 2u);
+		}
+	}
+}
+
+Lockstep::Machine::Machine(std::shared_ptr<const Image> image) :
+	mem(std::move(image))
+{}
+
+Lockstep::Lockstep(
+	const std::vector<Lane> &lanes,
+	const double            clock_rate,
+	const CPU::Options      &options
+)
+{
+	if (lanes.size() > max_lanes) {
+		throw std::out_of_range{"Lockstep given more than max_lanes lanes"};
+	}
+	for (const auto &lane : lanes) {
+		auto machine = std::make_unique<Machine>(lane.image);
+		machine->cpu = std::make_unique<CPU>(
+			machine->mem,
+			clock_rate,
+			*lane.input,
+			*lane.output,
+			options
+		);
+		if (lane.state) {
+			machine->cpu->restore(*lane.state);
+		}
+		machine->until = lane.until;
+		machine->cpu->set_cycle_limit(lane.until);
+		machine->done = is_done(*machine);
+		_machines.push_back(std::move(machine));
+	}
+}
+
+bool Lockstep::is_done(const Machine &machine) const
+{
+	return !machine.cpu->is_on() || machine.cpu->cycles() >= machine.until;
+}
+
+// Whether a lane outside the group is where the group is, in the same state
+// apart from registers. Events depend only on the cycle count and this
+// state, so the lane's timers are in step with the group's.
+bool Lockstep::can_join(const Machine &machine) const
+{
+	if (_members.empty() || machine.grouped || machine.done) {
+		return false;
+	}
+	const auto &cpu = *machine.cpu;
+	const auto &leader = *_machines[_members[0]]->cpu;
+	return
+		cpu.cycles() == _cycles
+		&& cpu._ip == _ip
+		&& cpu._ic == _ic
+		&& cpu._t == leader._t
+		&& cpu._interrupt_level == leader._interrupt_level
+		&& cpu._interrupt_handling == leader._interrupt_handling
+		&& cpu._clock_interrupt == leader._clock_interrupt
+		&& cpu._pending_hardware == leader._pending_hardware
+		&& cpu._port_timers == leader._port_timers
+		&& cpu._port_timer_deadlines == leader._port_timer_deadlines;
+}
+
+// Takes a lane into the group, or starts the group with it
+void Lockstep::join(const unsigned machine_index)
+{
+	auto &machine = *_machines[machine_index];
+	const auto &cpu = *machine.cpu;
+	const auto slot = static_cast<unsigned>(_members.size());
+	if (slot == 0) {
+		_ip = cpu._ip;
+		_ic = cpu._ic;
+		_cycles = cpu.cycles();
+		_deadline = Scheduler::never;
+	}
+	_members.push_back(machine_index);
+	_mems[slot] = &machine.mem;
+	_r16[0][slot] = cpu._primary.a;
+	_r16[1][slot] = cpu._primary.c;
+	_r16[2][slot] = cpu._primary.sp;
+	_r16[3][slot] = cpu._primary.bp;
+	_f[slot] = cpu._primary.f;
+	_shadow_r16[0][slot] = cpu._shadow.a;
+	_shadow_r16[1][slot] = cpu._shadow.c;
+	_shadow_r16[2][slot] = cpu._shadow.sp;
+	_shadow_r16[3][slot] = cpu._shadow.bp;
+	_shadow_f[slot] = cpu._shadow.f;
+	_synced[slot] = _cycles;
+	_deadline = std::min({_deadline, cpu._next_event, machine.until});
+	machine.grouped = true;
+	_shared_page = -1;
+}
+
+// Hands a lane back to its own CPU, to carry on from ip
+void Lockstep::leave(const unsigned slot, const std::uint16_t ip)
+{
+	auto &machine = *_machines[_members[slot]];
+	auto &cpu = *machine.cpu;
+	cpu._primary.a = _r16[0][slot];
+	cpu._primary.c = _r16[1][slot];
+	cpu._primary.sp = _r16[2][slot];
+	cpu._primary.bp = _r16[3][slot];
+	cpu._primary.f = _f[slot];
+	cpu._shadow.a = _shadow_r16[0][slot];
+	cpu._shadow.c = _shadow_r16[1][slot];
+	cpu._shadow.sp = _shadow_r16[2][slot];
+	cpu._shadow.bp = _shadow_r16[3][slot];
+	cpu._shadow.f = _shadow_f[slot];
+	cpu._ip = ip;
+	cpu._ic = _ic;
+	for (auto cycles = _cycles - _synced[slot]; cycles; ) {
+		const auto ticked = static_cast<unsigned>(std::min<std::uint64_t>(cycles, 1u << 30));
+		cpu._pacer.tick(ticked);
+		cycles -= ticked;
+	}
+	machine.grouped = false;
+	machine.done = is_done(machine);
+
+	// The last slot moves into the one left
+	const auto last = _members.size() - 1;
+	_members[slot] = _members[last];
+	_mems[slot] = _mems[last];
+	for (unsigned code = 0; code < 4; ++code) {
+		_r16[code][slot] = _r16[code][last];
+		_shadow_r16[code][slot] = _shadow_r16[code][last];
+	}
+	_f[slot] = _f[last];
+	_shadow_f[slot] = _shadow_f[last];
+	_synced[slot] = _synced[last];
+	_members.pop_back();
+	if (slot == 0) {
+		_shared_page = -1;
+	}
+}
+
+void Lockstep::dissolve()
+{
+	for (auto slot = _members.size(); slot-- > 0; ) {
+		leave(slot, _ip);
+	}
+}
+
+// Sends the lanes whose code at IP differs from the leader's on their own.
+// A lane sharing the page with the leader, as with the image they both
+// started from, has the same code without looking.
+void Lockstep::split_code(const std::array<std::uint8_t, 3> &bytes)
+{
+	const int page = _ip >> 8;
+	const auto next_page = static_cast<std::uint8_t>(page + 1);
+	const bool in_page = (_ip & 0xFF) <= 0xFD;
+	if (in_page && page == _shared_page) {
+		return;
+	}
+	const auto leader_page = _mems[0]->ram_page(page);
+	const auto leader_next_page = _mems[0]->ram_page(next_page);
+	bool shared = true;
+	for (auto slot = _members.size(); slot-- > 1; ) {
+		auto &mem = *_mems[slot];
+		if (
+			mem.ram_page(page) == leader_page
+			&& (in_page || mem.ram_page(next_page) == leader_next_page)
+		) {
+			continue;
+		}
+		shared = false;
+		std::array<std::uint8_t, 3> lane_bytes;
+		mem.fetch(_ip, lane_bytes.data(), lane_bytes.size());
+		if (lane_bytes != bytes) {
+			leave(slot, _ip);
+		}
+	}
+	_shared_page = in_page && shared ? page : -1;
+}
+
+// Keeps the lanes going to the most common of ips in the group, by slot,
+// and sends the rest on their own
+void Lockstep::diverge(const std::array<std::uint16_t, max_lanes> &ips)
+{
+	const auto lanes = _members.size();
+	auto ip = ips[0];
+	std::size_t most = 0;
+	for (std::size_t slot = 0; slot < lanes && most * 2 <= lanes; ++slot) {
+		const auto count = static_cast<std::size_t>(
+			std::count(ips.begin(), ips.begin() + lanes, ips[slot])
+		);
+		if (count > most) {
+			ip = ips[slot];
+			most = count;
+		}
+	}
+	if (most != lanes) {
+		for (auto slot = lanes; slot-- > 0; ) {
+			if (ips[slot] != ip) {
+				leave(slot, ips[slot]);
+			}
+		}
+	}
+	_ip = ip;
+}
+
+// A lane wrote memory, which may be the page its code is read from
+void Lockstep::stored(const std::uint16_t address, const unsigned length)
+{
+	const int last_page = static_cast<std::uint16_t>(address + length - 1) >> 8;
+	if (address >> 8 == _shared_page || last_page == _shared_page) {
+		_shared_page = -1;
+	}
+}
+
+// Runs the group's next instruction on every lane in it. Returns false,
+// having run nothing, when an event is due or the instruction is left to
+// the lanes' own CPUs. Each case does what the CPU handler of the same
+// instruction does, lane by lane.
+bool Lockstep::step_group()
+{
+	if (_cycles >= _deadline) {
+		return false;
+	}
+	std::array<std::uint8_t, 3> bytes;
+	_mems[0]->fetch(_ip, bytes.data(), bytes.size());
+	split_code(bytes);
+
+	const auto lanes = static_cast<unsigned>(_members.size());
+	const auto op_code = bytes[0];
+	const auto p1 = get_high_nibble(bytes[1]);
+	const auto p2 = get_low_nibble(bytes[1]);
+	const auto i8 = static_cast<std::uint16_t>(static_cast<std::int8_t>(bytes[1]));
+	const auto n16 = make_word(bytes[1], bytes[2]);
+	const bool g8_g8 = is_g8(p1) && is_g8(p2);
+	const bool r16_r16 = is_r16(p1) && is_r16(p2);
+	auto &a = _r16[0];
+	auto &c = _r16[1];
+	auto &sp = _r16[2];
+	auto &bp = _r16[3];
+	auto &f = _f;
+	unsigned length = 1;
+	// Where lanes go next when they might not all go to the same place
+	bool branch = false;
+	std::array<std::uint16_t, max_lanes> ips;
+
+	switch (op_code) {
+	case 0x00:
+	case 0x54:
+	case 0x55:
+		break;
+	case 0x01: {
+		if (!g8_g8) {
+			return false;
+		}
+		length = 2;
+		const auto dest = dest_g8(_r16, p1);
+		const auto src1 = source_g8(_r16, p1);
+		const auto src2 = source_g8(_r16, p2);
+		for (unsigned i = 0; i < lanes; ++i) {
+			const unsigned sum = get(src1, i) + get(src2, i);
+			set(dest, i, sum);
+			set_flags(f, i, get(src1, i) == 0, sum > 0xFFu);
+		}
+		break;
+	}
+	case 0x02:
+		if (!r16_r16) {
+			return false;
+		}
+		length = 2;
+		for (unsigned i = 0; i < lanes; ++i) {
+			const unsigned sum = _r16[p1][i] + _r16[p2][i];
+			_r16[p1][i] = sum;
+			set_flags(f, i, _r16[p1][i] == 0, sum > 0xFFFFu);
+		}
+		break;
+	case 0x03: {
+		if (!g8_g8) {
+			return false;
+		}
+		length = 2;
+		const auto dest = dest_g8(_r16, p1);
+		const auto src1 = source_g8(_r16, p1);
+		const auto src2 = source_g8(_r16, p2);
+		for (unsigned i = 0; i < lanes; ++i) {
+			set(dest, i, get(src1, i) - get(src2, i));
+			set_zero_flag(f, i, get(src1, i) == 0);
+		}
+		break;
+	}
+	case 0x04:
+		if (!r16_r16) {
+			return false;
+		}
+		length = 2;
+		for (unsigned i = 0; i < lanes; ++i) {
+			_r16[p1][i] -= _r16[p2][i];
+			set_zero_flag(f, i, _r16[p1][i] == 0);
+		}
+		break;
+	case 0x05:
+		for (unsigned i = 0; i < lanes; ++i) {
+			++c[i];
+		}
+		break;
+	case 0x06:
+		for (unsigned i = 0; i < lanes; ++i) {
+			--c[i];
+		}
+		break;
+	case 0x07:
+		length = 2;
+		if (p1 == 0 && is_g8(p2)) {
+			const auto dest = dest_g8(_r16, p2);
+			const auto src = source_g8(_r16, p2);
+			for (unsigned i = 0; i < lanes; ++i) {
+				set(dest, i, -get(src, i));
+			}
+		} else if (p1 == 1 && is_g16(p2)) {
+			for (unsigned i = 0; i < lanes; ++i) {
+				_r16[p2][i] = -_r16[p2][i];
+			}
+		} else {
+			return false;
+		}
+		break;
+	case 0x08:
+	case 0x09:
+	case 0x0A: {
+		if (!g8_g8) {
+			return false;
+		}
+		length = 2;
+		const auto dest = dest_g8(_r16, p1);
+		const auto src1 = source_g8(_r16, p1);
+		const auto src2 = source_g8(_r16, p2);
+		if (op_code == 0x08) {
+			for (unsigned i = 0; i < lanes; ++i) {
+				set(dest, i, get(src1, i) & get(src2, i));
+			}
+		} else if (op_code == 0x09) {
+			for (unsigned i = 0; i < lanes; ++i) {
+				set(dest, i, get(src1, i) | get(src2, i));
+			}
+		} else {
+			for (unsigned i = 0; i < lanes; ++i) {
+				set(dest, i, get(src1, i) ^ get(src2, i));
+			}
+		}
+		break;
+	}
+	case 0x0B: {
+		if (!is_g8(p1) || p2 > 7) {
+			return false;
+		}
+		length = 2;
+		const auto dest = dest_g8(_r16, p1);
+		const auto src = source_g8(_r16, p1);
+		for (unsigned i = 0; i < lanes; ++i) {
+			const auto value = get(src, i);
+			set(dest, i, (value << p2) | (value >> (8 - p2)));
+		}
+		break;
+	}
+	case 0x0C: {
+		if (!is_g8(p1)) {
+			return false;
+		}
+		length = 2;
+		const auto dest = dest_g8(_r16, p1);
+		const auto src = source_g8(_r16, p1);
+		for (unsigned i = 0; i < lanes; ++i) {
+			const auto value = get(src, i);
+			set(dest, i, p2 > 7 ? value >> (16 - p2) : value << p2);
+		}
+		break;
+	}
+	case 0x0D:
+		length = 2;
+		if (g8_g8) {
+			const auto dest = dest_g8(_r16, p1);
+			const auto src1 = source_g8(_r16, p1);
+			const auto src2 = source_g8(_r16, p2);
+			for (unsigned i = 0; i < lanes; ++i) {
+				const unsigned product = get(src1, i) * get(src2, i);
+				set(dest, i, product);
+				f[i] = (f[i] & (0xFFu ^ 2u)) | (product > 0xFFu) << 1;
+			}
+		} else if (is_g8(p1) && p2 == 0x4) {
+			// Multiplies by the register code, as CPU::byte_op_mul_a() does
+			const auto src = source_g8(_r16, p1);
+			for (unsigned i = 0; i < lanes; ++i) {
+				const bool carry = static_cast<std::uint32_t>(a[i]) * get(src, i) > 0xFFFFu;
+				f[i] = (f[i] & (0xFFu ^ 2u)) | carry << 1;
+				a[i] *= p1;
+			}
+		} else {
+			return false;
+		}
+		break;
+	case 0x20: {
+		if (!g8_g8) {
+			return false;
+		}
+		length = 2;
+		const auto dest = dest_g8(_r16, p1);
+		const auto src = source_g8(_r16, p2);
+		for (unsigned i = 0; i < lanes; ++i) {
+			set(dest, i, get(src, i));
+		}
+		break;
+	}
+	case 0x21:
+		if (!r16_r16) {
+			return false;
+		}
+		length = 2;
+		for (unsigned i = 0; i < lanes; ++i) {
+			_r16[p1][i] = _r16[p2][i];
+		}
+		break;
+	case 0x22: {
+		length = 2;
+		const auto al = dest_g8(_r16, 0x0);
+		if (bytes[1] == 0x01) {
+			for (unsigned i = 0; i < lanes; ++i) {
+				set(al, i, f[i]);
+			}
+		} else if (bytes[1] == 0x02) {
+			for (unsigned i = 0; i < lanes; ++i) {
+				set(al, i, _ic);
+			}
+		} else if (bytes[1] == 0x03) {
+			for (unsigned i = 0; i < lanes; ++i) {
+				a[i] = _ip + length;
+			}
+		} else {
+			return false;
+		}
+		break;
+	}
+	case 0x23:
+	case 0x24: {
+		length = op_code == 0x23 ? 2 : 1;
+		const auto al = dest_g8(_r16, 0x0);
+		for (unsigned i = 0; i < lanes; ++i) {
+			const std::uint16_t address = op_code == 0x23 ? bp[i] + i8 : c[i];
+			set(al, i, _mems[i]->read(address));
+		}
+		break;
+	}
+	case 0x25:
+	case 0x26:
+		length = op_code == 0x25 ? 2 : 1;
+		for (unsigned i = 0; i < lanes; ++i) {
+			const std::uint16_t address = op_code == 0x25 ? bp[i] + i8 : c[i];
+			_mems[i]->write(address, get_low_byte(a[i]));
+			stored(address, 1);
+		}
+		break;
+	case 0x28:
+		for (unsigned code = 0; code < 4; ++code) {
+			std::swap(_r16[code], _shadow_r16[code]);
+		}
+		std::swap(_f, _shadow_f);
+		break;
+	case 0x29:
+	case 0x2A:
+		length = op_code == 0x29 ? 2 : 1;
+		for (unsigned i = 0; i < lanes; ++i) {
+			const std::uint16_t address = op_code == 0x29 ? bp[i] + i8 : c[i];
+			a[i] = _mems[i]->read_word(address);
+		}
+		break;
+	case 0x2B: {
+		const auto al = dest_g8(_r16, 0x0);
+		const auto t = _machines[_members[0]]->cpu->_t;
+		for (unsigned i = 0; i < lanes; ++i) {
+			set(al, i, t);
+		}
+		break;
+	}
+	case 0x2D:
+	case 0x2E:
+		length = op_code == 0x2D ? 2 : 1;
+		for (unsigned i = 0; i < lanes; ++i) {
+			const std::uint16_t address = op_code == 0x2D ? bp[i] + i8 : c[i];
+			_mems[i]->write_word(address, a[i]);
+			stored(address, 2);
+		}
+		break;
+	case 0x40:
+	case 0x48:
+		length = 3;
+		for (unsigned i = 0; i < lanes; ++i) {
+			ips[i] = n16;
+		}
+		branch = true;
+		break;
+	case 0x41:
+	case 0x42:
+	case 0x43:
+	case 0x44:
+		length = 3;
+		for (unsigned i = 0; i < lanes; ++i) {
+			ips[i] = jump_condition(op_code, f[i]) ? n16 : _ip + length;
+		}
+		branch = true;
+		break;
+	case 0x49:
+		for (unsigned i = 0; i < lanes; ++i) {
+			ips[i] = a[i];
+		}
+		branch = true;
+		break;
+	case 0x4B:
+		for (unsigned i = 0; i < lanes; ++i) {
+			ips[i] = _mems[i]->read_word(sp[i]);
+			sp[i] += 2;
+		}
+		branch = true;
+		break;
+	default:
+		switch (get_high_nibble(op_code)) {
+		case 0x8: {
+			if (!is_g8(get_low_nibble(op_code))) {
+				return false;
+			}
+			length = 2;
+			const auto dest = dest_g8(_r16, get_low_nibble(op_code));
+			for (unsigned i = 0; i < lanes; ++i) {
+				set(dest, i, bytes[1]);
+			}
+			break;
+		}
+		case 0x9: {
+			if (!is_r16(get_low_nibble(op_code))) {
+				return false;
+			}
+			length = 3;
+			auto &dest = _r16[get_low_nibble(op_code)];
+			for (unsigned i = 0; i < lanes; ++i) {
+				dest[i] = n16;
+			}
+			break;
+		}
+		case 0xA: {
+			if (!is_g8(get_low_nibble(op_code))) {
+				return false;
+			}
+			const auto src = source_g8(_r16, get_low_nibble(op_code));
+			for (unsigned i = 0; i < lanes; ++i) {
+				sp[i] -= 1;
+				_mems[i]->write(sp[i], get(src, i));
+				stored(sp[i], 1);
+			}
+			break;
+		}
+		case 0xB: {
+			if (!is_r16(get_low_nibble(op_code))) {
+				return false;
+			}
+			const auto &src = _r16[get_low_nibble(op_code)];
+			for (unsigned i = 0; i < lanes; ++i) {
+				sp[i] -= 2;
+				_mems[i]->write_word(sp[i], src[i]);
+				stored(sp[i], 2);
+			}
+			break;
+		}
+		case 0xC: {
+			if (!is_g8(get_low_nibble(op_code))) {
+				return false;
+			}
+			const auto dest = dest_g8(_r16, get_low_nibble(op_code));
+			for (unsigned i = 0; i < lanes; ++i) {
+				set(dest, i, _mems[i]->read(sp[i]));
+				sp[i] += 1;
+			}
+			break;
+		}
+		case 0xD: {
+			if (!is_r16(get_low_nibble(op_code))) {
+				return false;
+			}
+			auto &dest = _r16[get_low_nibble(op_code)];
+			for (unsigned i = 0; i < lanes; ++i) {
+				const auto value = _mems[i]->read_word(sp[i]);
+				dest[i] = value;
+				sp[i] += 2;
+			}
+			break;
+		}
+		case 0xE: {
+			if (!is_g8(get_low_nibble(op_code))) {
+				return false;
+			}
+			length = 2;
+			const auto dest = dest_g8(_r16, get_low_nibble(op_code));
+			const auto src = source_g8(_r16, get_low_nibble(op_code));
+			for (unsigned i = 0; i < lanes; ++i) {
+				const unsigned sum = get(src, i) + bytes[1];
+				set(dest, i, sum);
+				set_flags(f, i, get(src, i) == 0, sum > 0xFFu);
+			}
+			break;
+		}
+		case 0xF: {
+			if (!is_r16(get_low_nibble(op_code))) {
+				return false;
+			}
+			length = 3;
+			auto &dest = _r16[get_low_nibble(op_code)];
+			for (unsigned i = 0; i < lanes; ++i) {
+				const unsigned sum = dest[i] + n16;
+				dest[i] = sum;
+				set_flags(f, i, dest[i] == 0, sum > 0xFFFFu);
+			}
+			break;
+		}
+		default:
+			// Interrupts, IN, OUT, STOP, changes to control state and
+			// invalid op codes run on the lanes' own CPUs
+			return false;
+		}
+	}
+
+	_cycles += length;
+	++_ic;
+	if (branch) {
+		diverge(ips);
+	} else {
+		_ip += length;
+	}
+	return true;
+}
+
+// Runs every lane until it stops or reaches the cycle count it runs until.
+// The group runs up to the next cycle count a lane outside it is at, so the
+// lane can join it there, and lanes behind the group step on their own
+// until they catch up.
+void Lockstep::run()
+{
+	for (;;) {
+		Machine *next = nullptr;
+		unsigned next_index = 0;
+		// Cycle counts of the next lanes ahead of the group and of next
+		std::uint64_t ahead = Scheduler::never;
+		std::uint64_t after_next = Scheduler::never;
+		for (unsigned index = 0; index < _machines.size(); ++index) {
+			auto &machine = *_machines[index];
+			if (machine.grouped || machine.done) {
+				continue;
+			}
+			if (can_join(machine)) {
+				join(index);
+				continue;
+			}
+			const auto cycles = machine.cpu->cycles();
+			if (!_members.empty() && cycles > _cycles) {
+				ahead = std::min(ahead, cycles);
+			}
+			if (!next || cycles < next->cpu->cycles()) {
+				if (next) {
+					after_next = next->cpu->cycles();
+				}
+				next = &machine;
+				next_index = index;
+			} else {
+				after_next = std::min(after_next, cycles);
+			}
+		}
+
+		if (!_members.empty() && (!next || _cycles <= next->cpu->cycles())) {
+			while (_cycles < ahead) {
+				if (!step_group()) {
+					dissolve();
+					break;
+				}
+			}
+			continue;
+		}
+		if (!next) {
+			return;
+		}
+		const auto limit = _members.empty() ? after_next : std::min(after_next, _cycles);
+		do {
+			next->cpu->step();
+			next->done = is_done(*next);
+		} while (!next->done && next->cpu->cycles() < limit && !_members.empty());
+		if (_members.empty() && !next->done) {
+			join(next_index);
+		}
+	}
+}
+
+bool Lockstep::is_on(const std::size_t lane) const
+{
+	return _machines.at(lane)->cpu->is_on();
+}
+
+// Total cycles a lane has run, up to where it stopped
+std::uint64_t Lockstep::cycles(const std::size_t lane) const
+{
+	return _machines.at(lane)->cpu->cycles();
+}
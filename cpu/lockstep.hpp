@@ -0,0 +1,93 @@
+#ifndef LVCPU_LOCKSTEP_HPP_INCLUDED
+#define LVCPU_LOCKSTEP_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "cpu.hpp"
+#include "image.hpp"
+#include "mem.hpp"
+#include "scheduler.hpp"
+
+// Runs one program on many machines, or lanes, at once, as when sweeping
+// it over different inputs. Lanes at the same IP, cycle count and control
+// state form a group, whose registers are kept as a structure of arrays.
+// Each instruction is then decoded once and run for every lane of the group
+// in a loop over the arrays, which the compiler vectorizes.
+//
+// A lane leaves the group when a branch takes it elsewhere, or its code
+// differs from the rest. Events and instructions that go beyond registers
+// and memory, such as IN, OUT and interrupts, are run on each lane's own
+// CPU. Lanes outside the group step on their own CPU, and join the group
+// again on reaching it in the same state. Every lane runs exactly as it
+// would on its own.
+class Lockstep {
+public:
+	static constexpr unsigned max_lanes = 32;
+
+	struct Lane {
+		std::shared_ptr<const Image> image;
+		// State to start from, or null to start from power on
+		const CPU::State *state = nullptr;
+		std::istream *input = nullptr;
+		std::ostream *output = nullptr;
+		// Cycle count at which the lane stops running
+		std::uint64_t until = Scheduler::never;
+	};
+
+private:
+	struct Machine {
+		Mem                  mem;
+		std::unique_ptr<CPU> cpu;
+		std::uint64_t        until;
+		bool                 grouped = false;
+		bool                 done = false;
+
+		explicit Machine(std::shared_ptr<const Image> image);
+	};
+
+	std::vector<std::unique_ptr<Machine>> _machines;
+
+	// The group, by slot, the first slot's machine leading it
+	std::vector<unsigned> _members;
+	std::array<Mem *, max_lanes> _mems;
+	std::array<std::array<std::uint16_t, max_lanes>, 4> _r16, _shadow_r16;
+	std::array<std::uint8_t, max_lanes> _f, _shadow_f;
+	// Cycle count each member's CPU was left at when it joined
+	std::array<std::uint64_t, max_lanes> _synced;
+	std::uint16_t _ip = 0;
+	std::uint8_t _ic = 0;
+	std::uint64_t _cycles = 0;
+	// Earliest cycle count at which a member has an event due or stops
+	std::uint64_t _deadline = 0;
+	// Page that every member shares with the leader, so holds the same code
+	int _shared_page = -1;
+
+	bool is_done(const Machine &machine) const;
+	bool can_join(const Machine &machine) const;
+	void join(unsigned machine_index);
+	void leave(unsigned slot, std::uint16_t ip);
+	void dissolve();
+	void split_code(const std::array<std::uint8_t, 3> &bytes);
+	void diverge(const std::array<std::uint16_t, max_lanes> &ips);
+	void stored(std::uint16_t address, unsigned length);
+	bool step_group();
+
+public:
+	Lockstep(
+		const std::vector<Lane> &lanes,
+		double                  clock_rate,
+		const CPU::Options      &options
+	);
+	Lockstep(const Lockstep &) = delete;
+	Lockstep & operator = (const Lockstep &) = delete;
+	void          run();
+	bool          is_on(std::size_t lane) const;
+	std::uint64_t cycles(std::size_t lane) const;
+};
+
+#endif // LVCPU_LOCKSTEP_HPP_INCLUDED
@@ -72,6 +72,20 @@ namespace lua {
 		);
 	}
 
+	Type State::get_field(const int stack_index, const std::string &name)
+	{
+		return static_cast<Type>(
+			::lua_getfield(_state, stack_index, name.c_str())
+		);
+	}
+
+	Type State::get_index(const int stack_index, const Integer index)
+	{
+		return static_cast<Type>(
+			::lua_geti(_state, stack_index, index)
+		);
+	}
+
 	Number State::to_number(const int stack_index)
 	{
 		return ::lua_tonumber(_state, stack_index);
@@ -101,4 +115,11 @@ namespace lua {
 	{
 		::lua_pop(_state, amount);
 	}
+
+	// Opens a C module, for require() to give without searching for it
+	void State::require(const std::string &name, const ::lua_CFunction open)
+	{
+		::luaL_requiref(_state, name.c_str(), open, 0);
+		::lua_pop(_state, 1);
+	}
 }
@@ -44,12 +44,15 @@ namespace lua {
 		Status call(int n_args, int n_results);
 		Status call(int n_args);
 		Type get_global(const std::string &name);
+		Type get_field(int stack_index, const std::string &name);
+		Type get_index(int stack_index, Integer index);
 		Number to_number(int stack_index);
 		Integer to_integer(int stack_index);
 		bool is_integer(int stack_index);
 		std::string to_string(int stack_index);
 		bool to_boolean(int stack_index);
 		void pop(int amount = 1);
+		void require(const std::string &name, ::lua_CFunction open);
 	};
 }
 
@@ -0,0 +1,414 @@
+#include "lua_module.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+#include "cpu.hpp"
+#include "image.hpp"
+#include "mem.hpp"
+
+namespace {
+	const char machine_type[] = "lvcpu.Machine";
+	const char memory_type[] = "lvcpu.Memory";
+
+	// A machine of a script's, reading input given to it and keeping its
+	// output for the script to take
+	struct Machine {
+		Mem mem;
+		std::stringstream input;
+		std::ostringstream output;
+		CPU cpu;
+
+		Machine(
+			std::shared_ptr<const Image> image,
+			const double                 clock_rate,
+			const CPU::Options           &options
+		) :
+			mem(std::move(image)),
+			cpu(mem, clock_rate, input, output, options)
+		{}
+	};
+
+	// A view of a machine's RAM, keeping the machine's userdata alive as
+	// its user value
+	struct Memory_view {
+		Machine *machine;
+	};
+
+	// Runs body, which must not raise Lua errors, and raises what it throws
+	// as one. Lua errors jump past destructors, so are only raised once the
+	// objects body made are gone.
+	template <typename Body>
+	int guarded(lua_State *const state, const Body &body)
+	{
+		char message[256];
+		try {
+			return body();
+		} catch (const std::exception &exception) {
+			std::snprintf(message, sizeof message, "%s", exception.what());
+		}
+		return luaL_error(state, "%s", message);
+	}
+
+	Machine & check_machine(lua_State *const state, const int index)
+	{
+		const auto machine = static_cast<Machine **>(luaL_checkudata(state, index, machine_type));
+		luaL_argcheck(state, *machine, index, "machine not made");
+		return **machine;
+	}
+
+	Machine & check_memory(lua_State *const state, const int index)
+	{
+		return *static_cast<Memory_view *>(luaL_checkudata(state, index, memory_type))->machine;
+	}
+
+	std::uint16_t check_address(lua_State *const state, const int index)
+	{
+		const auto address = luaL_checkinteger(state, index);
+		luaL_argcheck(state, address >= 0 && address <= 0xFFFF, index, "address out of range");
+		return address;
+	}
+
+	// The named field of the options table at index 1, left on the stack,
+	// or whether it is nil when there is no table
+	bool push_option(lua_State *const state, const char *const name)
+	{
+		if (lua_isnoneornil(state, 1)) {
+			lua_pushnil(state);
+			return false;
+		}
+		return lua_getfield(state, 1, name) != LUA_TNIL;
+	}
+
+	const char * option_string(
+		lua_State *const  state,
+		const char *const name,
+		const char *const default_value,
+		std::size_t       *const length = nullptr)
+	{
+		const char *result = default_value;
+		if (length) {
+			*length = std::strlen(default_value);
+		}
+		if (push_option(state, name)) {
+			if (lua_type(state, -1) != LUA_TSTRING) {
+				luaL_error(state, "option %s must be a string", name);
+			}
+			// Stays valid while the options table holds it
+			result = lua_tolstring(state, -1, length);
+		}
+		lua_pop(state, 1);
+		return result;
+	}
+
+	int lvcpu_new(lua_State *const state)
+	{
+		if (!lua_isnoneornil(state, 1)) {
+			luaL_checktype(state, 1, LUA_TTABLE);
+		}
+		const auto image_path = option_string(state, "image", "");
+		const auto engine_name = option_string(state, "engine", "interpreter");
+		CPU::Engine engine;
+		if (std::strcmp(engine_name, "interpreter") == 0) {
+			engine = CPU::Engine::interpreter;
+		} else if (std::strcmp(engine_name, "jit") == 0) {
+			engine = CPU::Engine::jit;
+		} else {
+			return luaL_error(state, "option engine must be 'interpreter' or 'jit'");
+		}
+		bool fusion = false;
+		if (push_option(state, "fusion")) {
+			luaL_checktype(state, -1, LUA_TBOOLEAN);
+			fusion = lua_toboolean(state, -1);
+		}
+		lua_pop(state, 1);
+		double clock_rate = 1000000.0;
+		if (push_option(state, "clock_rate")) {
+			clock_rate = luaL_checknumber(state, -1);
+			luaL_argcheck(state, clock_rate > 0, 1, "clock_rate must be positive");
+		}
+		lua_pop(state, 1);
+		const auto clock_mode_name = option_string(state, "clock_mode", "virtual");
+		Pacer::Mode clock_mode;
+		if (std::strcmp(clock_mode_name, "virtual") == 0) {
+			clock_mode = Pacer::Mode::virtual_time;
+		} else if (std::strcmp(clock_mode_name, "unthrottled") == 0) {
+			clock_mode = Pacer::Mode::unthrottled;
+		} else if (std::strcmp(clock_mode_name, "paced") == 0) {
+			clock_mode = Pacer::Mode::paced;
+		} else {
+			return luaL_error(state, "option clock_mode must be 'virtual', 'unthrottled' or 'paced'");
+		}
+		std::size_t input_length;
+		const auto input = option_string(state, "input", "", &input_length);
+
+		const auto machine = static_cast<Machine **>(lua_newuserdata(state, sizeof (Machine *)));
+		*machine = nullptr;
+		luaL_setmetatable(state, machine_type);
+		return guarded(state, [&] {
+			std::shared_ptr<const Image> image;
+			if (*image_path) {
+				image = Image::load_file(image_path);
+				if (!image) {
+					throw std::runtime_error{std::string{"could not open image "} + image_path};
+				}
+			}
+			CPU::Options options;
+			options.engine = engine;
+			options.fusion = fusion;
+			options.clock_mode = clock_mode;
+			*machine = new Machine{std::move(image), clock_rate, options};
+			(*machine)->input.write(input, input_length);
+			return 1;
+		});
+	}
+
+	int machine_gc(lua_State *const state)
+	{
+		const auto machine = static_cast<Machine **>(luaL_checkudata(state, 1, machine_type));
+		delete *machine;
+		*machine = nullptr;
+		return 0;
+	}
+
+	int machine_load(lua_State *const state)
+	{
+		auto &machine = check_machine(state, 1);
+		const auto path = luaL_checkstring(state, 2);
+		return guarded(state, [&] {
+			auto image = Image::load_file(path);
+			if (!image) {
+				throw std::runtime_error{std::string{"could not open image "} + path};
+			}
+			machine.mem.reset(std::move(image));
+			machine.cpu.reset();
+			return 0;
+		});
+	}
+
+	int machine_run(lua_State *const state)
+	{
+		auto &machine = check_machine(state, 1);
+		const auto cycles = luaL_checkinteger(state, 2);
+		luaL_argcheck(state, cycles >= 0, 2, "cycles must not be negative");
+		const auto start = machine.cpu.cycles();
+		while (machine.cpu.is_on() && machine.cpu.cycles() - start < static_cast<std::uint64_t>(cycles)) {
+			machine.cpu.step();
+		}
+		lua_pushinteger(state, machine.cpu.cycles() - start);
+		return 1;
+	}
+
+	int machine_step(lua_State *const state)
+	{
+		auto &machine = check_machine(state, 1);
+		if (machine.cpu.is_on()) {
+			machine.cpu.step();
+		}
+		lua_pushboolean(state, machine.cpu.is_on());
+		return 1;
+	}
+
+	int machine_is_on(lua_State *const state)
+	{
+		lua_pushboolean(state, check_machine(state, 1).cpu.is_on());
+		return 1;
+	}
+
+	int machine_cycles(lua_State *const state)
+	{
+		lua_pushinteger(state, check_machine(state, 1).cpu.cycles());
+		return 1;
+	}
+
+	// In the order of CPU::Register
+	const char *const register_names[] = {
+		"a", "c", "sp", "bp", "ip", "f", "ic", "t", "al", "ah", "cl", "ch", nullptr
+	};
+
+	// Registers from f on are a byte wide
+	const int first_byte_register = 5;
+
+	int machine_register(lua_State *const state)
+	{
+		auto &machine = check_machine(state, 1);
+		const auto index = luaL_checkoption(state, 2, nullptr, register_names);
+		lua_pushinteger(state, machine.cpu.reg(static_cast<CPU::Register>(index)));
+		return 1;
+	}
+
+	int machine_set_register(lua_State *const state)
+	{
+		auto &machine = check_machine(state, 1);
+		const auto index = luaL_checkoption(state, 2, nullptr, register_names);
+		const auto value = luaL_checkinteger(state, 3);
+		const auto limit = index < first_byte_register ? 0xFFFF : 0xFF;
+		luaL_argcheck(state, value >= 0 && value <= limit, 3, "value out of range");
+		machine.cpu.set_reg(static_cast<CPU::Register>(index), value);
+		return 0;
+	}
+
+	int machine_interrupt(lua_State *const state)
+	{
+		auto &machine = check_machine(state, 1);
+		const auto code = luaL_checkinteger(state, 2);
+		luaL_argcheck(state, code >= 0x10 && code <= 0x3F, 2, "not a hardware interrupt code");
+		machine.cpu.interrupt(code);
+		return 0;
+	}
+
+	int machine_input(lua_State *const state)
+	{
+		auto &machine = check_machine(state, 1);
+		std::size_t length;
+		const auto text = luaL_checklstring(state, 2, &length);
+		return guarded(state, [&] {
+			// Drops what has been read, once all of it has
+			if (machine.input.rdbuf()->in_avail() <= 0) {
+				machine.input.str(std::string{});
+			}
+			machine.input.clear();
+			machine.input.write(text, length);
+			return 0;
+		});
+	}
+
+	int machine_output(lua_State *const state)
+	{
+		auto &machine = check_machine(state, 1);
+		const auto text = machine.output.str();
+		lua_pushlstring(state, text.data(), text.size());
+		machine.output.str(std::string{});
+		return 1;
+	}
+
+	int machine_memory(lua_State *const state)
+	{
+		auto &machine = check_machine(state, 1);
+		const auto view = static_cast<Memory_view *>(lua_newuserdata(state, sizeof (Memory_view)));
+		view->machine = &machine;
+		luaL_setmetatable(state, memory_type);
+		lua_pushvalue(state, 1);
+		lua_setuservalue(state, -2);
+		return 1;
+	}
+
+	// Bytes by address, or methods by name from the table that is the
+	// function's upvalue
+	int memory_index(lua_State *const state)
+	{
+		auto &machine = check_memory(state, 1);
+		if (lua_type(state, 2) != LUA_TNUMBER) {
+			lua_gettable(state, lua_upvalueindex(1));
+			return 1;
+		}
+		const auto address = check_address(state, 2);
+		lua_pushinteger(state, machine.mem.ram_page(address >> 8)[address & 0xFF]);
+		return 1;
+	}
+
+	int memory_newindex(lua_State *const state)
+	{
+		auto &machine = check_memory(state, 1);
+		const auto address = check_address(state, 2);
+		const auto value = luaL_checkinteger(state, 3);
+		luaL_argcheck(state, value >= 0 && value <= 0xFF, 3, "value out of range");
+		const std::uint8_t byte = value;
+		machine.mem.write_block(address, &byte, 1);
+		return 0;
+	}
+
+	int memory_len(lua_State *const state)
+	{
+		check_memory(state, 1);
+		lua_pushinteger(state, 0x10000);
+		return 1;
+	}
+
+	int memory_read_block(lua_State *const state)
+	{
+		auto &machine = check_memory(state, 1);
+		const auto address = check_address(state, 2);
+		const auto count = luaL_checkinteger(state, 3);
+		luaL_argcheck(state, count >= 0 && count <= 0x10000, 3, "count out of range");
+		luaL_Buffer buffer;
+		const auto bytes = luaL_buffinitsize(state, &buffer, count);
+		machine.mem.read_block(address, reinterpret_cast<std::uint8_t *>(bytes), count);
+		luaL_pushresultsize(&buffer, count);
+		return 1;
+	}
+
+	int memory_write_block(lua_State *const state)
+	{
+		auto &machine = check_memory(state, 1);
+		const auto address = check_address(state, 2);
+		std::size_t count;
+		const auto bytes = luaL_checklstring(state, 3, &count);
+		luaL_argcheck(state, count <= 0x10000, 3, "longer than memory");
+		machine.mem.write_block(address, reinterpret_cast<const std::uint8_t *>(bytes), count);
+		return 0;
+	}
+
+	const luaL_Reg functions[] = {
+		{"new", lvcpu_new},
+		{nullptr, nullptr}
+	};
+
+	const luaL_Reg machine_methods[] = {
+		{"__gc", machine_gc},
+		{"load", machine_load},
+		{"run", machine_run},
+		{"step", machine_step},
+		{"is_on", machine_is_on},
+		{"cycles", machine_cycles},
+		{"register", machine_register},
+		{"set_register", machine_set_register},
+		{"interrupt", machine_interrupt},
+		{"input", machine_input},
+		{"output", machine_output},
+		{"memory", machine_memory},
+		{nullptr, nullptr}
+	};
+
+	const luaL_Reg memory_methods[] = {
+		{"read_block", memory_read_block},
+		{"write_block", memory_write_block},
+		{nullptr, nullptr}
+	};
+
+	const luaL_Reg memory_metamethods[] = {
+		{"__index", memory_index},
+		{"__newindex", memory_newindex},
+		{"__len", memory_len},
+		{nullptr, nullptr}
+	};
+}
+
+extern "C" int luaopen_lvcpu(lua_State *const state)
+{
+	luaL_newmetatable(state, machine_type);
+	lua_pushvalue(state, -1);
+	lua_setfield(state, -2, "__index");
+	luaL_setfuncs(state, machine_methods, 0);
+	lua_pop(state, 1);
+
+	luaL_newmetatable(state, memory_type);
+	luaL_newlib(state, memory_methods);
+	luaL_setfuncs(state, memory_metamethods, 1);
+	lua_pop(state, 1);
+
+	luaL_newlib(state, functions);
+	return 1;
+}
@@ -0,0 +1,45 @@
+#ifndef LVCPU_LUA_MODULE_HPP_INCLUDED
+#define LVCPU_LUA_MODULE_HPP_INCLUDED
+
+extern "C" {
+#include <lua.h>
+}
+
+// The lvcpu Lua module, for scripts to run any number of machines in one
+// process and look into them directly. lvcpu gives it to the script named by
+// script_path, and make module builds it as lvcpu.so for other interpreters.
+//
+//   lvcpu.new([options])     a machine, options being a table of
+//     image                    flat or segmented image to load, or all zeros
+//     engine                   'interpreter' (default) or 'jit'
+//     fusion                   run superinstructions, false by default
+//     clock_rate               1000000 by default
+//     clock_mode               'virtual' (default), 'unthrottled' or 'paced'
+//     input                    what IN reads first, '' by default
+//
+//   machine:load(path)       load an image and start over from power on
+//   machine:run(cycles)      run until cycles have passed or STOP, and give
+//                            the cycles run; translated code may overrun
+//   machine:step()           run one instruction, or translated block, and
+//                            give whether the machine is still on
+//   machine:is_on()
+//   machine:cycles()         cycles run in all
+//   machine:register(name)   a, c, sp, bp, ip, f, ic, t, al, ah, cl or ch
+//   machine:set_register(name, value)
+//   machine:interrupt(code)  raise hardware interrupt 0x10 to 0x3F
+//   machine:input(text)      add to what IN reads
+//   machine:output()         what OUT has written since last asked
+//   machine:memory()         a view of the machine's RAM:
+//     memory[address]          a byte, read or written in place
+//     #memory                  0x10000
+//     memory:read_block(address, count)
+//                              count bytes as a string
+//     memory:write_block(address, bytes)
+//
+// Addresses wrap from 0xFFFF to 0. The view is of RAM as the host sees it,
+// past any devices and watchpoints, and copies whole pages at a time for
+// read_block() and write_block(), so that scripts cross into C once per
+// block rather than per byte.
+extern "C" int luaopen_lvcpu(lua_State *state);
+
+#endif // LVCPU_LUA_MODULE_HPP_INCLUDED
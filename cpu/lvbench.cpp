@@ -0,0 +1,555 @@
+// Microbenchmarks of the emulator, running CPU and Mem directly and
+// unthrottled, for catching regressions between builds.
+//
+//   lvbench [-r runs] [-f filter] [-o results] [-c baseline] [-t percent]
+//
+//   -r runs      timed runs of each benchmark, after one untimed, default 10
+//   -f filter    only benchmarks whose name contains filter
+//   -o results   writes the results as JSON, for -c of a later build
+//   -c baseline  compares the fastest runs with those in a results file,
+//                exiting with failure when any is slower by more than -t
+//   -t percent   slowdown taken as a regression, default 5
+//
+// Guest benchmarks run a loop of one class of instruction on each engine,
+// and report guest instructions; the others report their own operations.
+// Config startup loads lvcpu.conf from the current directory, and is left
+// out when there is none.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cpu.hpp"
+#include "image.hpp"
+#include "lua.hpp"
+#include "mem.hpp"
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	// Times of one benchmark's runs, each of ops operations
+	struct Result {
+		std::string name;
+		const char *unit;
+		std::uint64_t ops;
+		std::vector<double> ns_per_op;
+
+		double mean() const
+		{
+			double sum = 0;
+			for (const auto ns : ns_per_op) {
+				sum += ns;
+			}
+			return sum / ns_per_op.size();
+		}
+
+		double stddev() const
+		{
+			const auto m = mean();
+			double sum = 0;
+			for (const auto ns : ns_per_op) {
+				sum += (ns - m) * (ns - m);
+			}
+			return ns_per_op.size() > 1 ? std::sqrt(sum / (ns_per_op.size() - 1)) : 0.0;
+		}
+
+		double min() const
+		{
+			return *std::min_element(ns_per_op.begin(), ns_per_op.end());
+		}
+	};
+
+	struct Settings {
+		unsigned runs = 10;
+		std::string filter;
+		std::string results_path;
+		std::string baseline_path;
+		double threshold = 5;
+	};
+
+	// Guest code under construction, counting the instructions it will run
+	class Program {
+		std::vector<std::uint8_t> _bytes;
+		std::vector<std::pair<std::uint16_t, std::vector<std::uint8_t>>> _placed;
+
+	public:
+		unsigned instructions = 0;
+
+		std::uint16_t here() const
+		{
+			return static_cast<std::uint16_t>(_bytes.size());
+		}
+
+		void emit(std::initializer_list<std::uint8_t> instruction)
+		{
+			_bytes.insert(_bytes.end(), instruction);
+			++instructions;
+		}
+
+		void emit_n16(const std::uint8_t op_code, const std::uint16_t value)
+		{
+			emit({op_code, static_cast<std::uint8_t>(value), static_cast<std::uint8_t>(value >> 8)});
+		}
+
+		// Puts code at address, past what is emitted, not counting it as run
+		void place(const std::uint16_t address, std::initializer_list<std::uint8_t> code)
+		{
+			_placed.emplace_back(address, code);
+		}
+
+		std::vector<std::uint8_t> bytes() const
+		{
+			auto bytes = _bytes;
+			for (const auto &placed : _placed) {
+				const auto &code = placed.second;
+				bytes.resize(std::max<std::size_t>(bytes.size(), placed.first + code.size()));
+				std::copy(code.begin(), code.end(), bytes.begin() + placed.first);
+			}
+			return bytes;
+		}
+	};
+
+	// A loop of one class of instruction. The body runs iterations times,
+	// counted by BP up from -iterations, so [BP+i8] forms reach only the
+	// top of memory when i8 is negative.
+	struct Guest_benchmark {
+		const char *name;
+		std::function<void(Program &)> setup;
+		std::function<void(Program &)> body;
+	};
+
+	constexpr std::uint16_t iterations = 20000;
+	constexpr std::uint16_t stack_top = 0xF000;
+	constexpr std::uint16_t data = 0x8000;
+	constexpr std::uint16_t subroutine = 0x300;
+	constexpr std::uint8_t interrupt_code = 0x40;
+
+	const std::vector<Guest_benchmark> & guest_benchmarks()
+	{
+		static const std::vector<Guest_benchmark> benchmarks{
+			{
+				"alu_g8",
+				[](Program &) {},
+				[](Program &program) {
+					for (unsigned i = 0; i < 8; ++i) {
+						program.emit({0x01, 0x02}); // ADD AL, CL
+						program.emit({0x03, 0x13}); // SUB AH, CH
+						program.emit({0xE2, 0x05}); // ADD CL, 5
+						program.emit({0x07, 0x00}); // NEG AL
+					}
+				}
+			},
+			{
+				"alu_r16",
+				[](Program &) {},
+				[](Program &program) {
+					for (unsigned i = 0; i < 8; ++i) {
+						program.emit({0x02, 0x01});        // ADD A, C
+						program.emit({0x04, 0x01});        // SUB A, C
+						program.emit({0xF1, 0x05, 0x01});  // ADD C, 0x105
+						program.emit({0x07, 0x10});        // NEG A
+					}
+				}
+			},
+			{
+				"mov_memory",
+				[](Program &program) {
+					program.emit_n16(0x91, data); // MOV C, data
+				},
+				[](Program &program) {
+					for (unsigned i = 0; i < 4; ++i) {
+						program.emit({0x24});        // MOV AL, [C]
+						program.emit({0x26});        // MOV [C], AL
+						program.emit({0x2A});        // MOV A, [C]
+						program.emit({0x2E});        // MOV [C], A
+						program.emit({0x23, 0xFC});  // MOV AL, [BP-4]
+						program.emit({0x25, 0xFA});  // MOV [BP-6], AL
+						program.emit({0x29, 0xF8});  // MOV A, [BP-8]
+						program.emit({0x2D, 0xF6});  // MOV [BP-10], A
+					}
+				}
+			},
+			{
+				"push_pop",
+				[](Program &program) {
+					program.emit_n16(0x92, stack_top); // MOV SP, stack_top
+				},
+				[](Program &program) {
+					for (unsigned i = 0; i < 8; ++i) {
+						program.emit({0xB0}); // PUSH A
+						program.emit({0xA2}); // PUSH CL
+						program.emit({0xC2}); // POP CL
+						program.emit({0xD0}); // POP A
+					}
+				}
+			},
+			{
+				"branches",
+				[](Program &) {},
+				[](Program &program) {
+					// Z is clear from the loop count, so JNZ is taken and
+					// JZ is not; each goes to the next instruction
+					static const std::uint8_t op_codes[] = {
+						0x40, // JP
+						0x43, // JNZ
+						0x41  // JZ
+					};
+					for (unsigned i = 0; i < 32; ++i) {
+						program.emit_n16(op_codes[i % 3], program.here() + 3);
+					}
+				}
+			},
+			{
+				"call_ret",
+				[](Program &program) {
+					program.emit_n16(0x92, stack_top);     // MOV SP, stack_top
+					program.place(subroutine, {0x4B});  // RET
+				},
+				[](Program &program) {
+					// CALL does not push the return address
+					for (unsigned i = 0; i < 8; ++i) {
+						program.emit_n16(0x90, program.here() + 7); // MOV A, back
+						program.emit({0xB0});                       // PUSH A
+						program.emit_n16(0x48, subroutine);         // CALL subroutine
+						++program.instructions;                     // RET
+					}
+				}
+			},
+			{
+				"interrupt_iret",
+				[](Program &program) {
+					program.emit_n16(0x92, stack_top); // MOV SP, stack_top
+					program.emit({0x50});              // EIH
+					program.place(16 * interrupt_code, {0x4C}); // IRET
+				},
+				[](Program &program) {
+					for (unsigned i = 0; i < 16; ++i) {
+						program.emit({0x4A, interrupt_code}); // INT interrupt_code
+						++program.instructions;               // IRET
+					}
+				}
+			}
+		};
+		return benchmarks;
+	}
+
+	// Builds the loop: setup, then body iterations times, then STOP
+	std::shared_ptr<const Image> build(const Guest_benchmark &benchmark, std::uint64_t &instructions)
+	{
+		Program program;
+		benchmark.setup(program);
+		program.emit_n16(0x93, -iterations); // MOV BP, -iterations
+		const auto setup = program.instructions;
+		const auto loop = program.here();
+		benchmark.body(program);
+		program.emit({0xF3, 0x01, 0x00}); // ADD BP, 1
+		program.emit_n16(0x43, loop);     // JNZ loop
+		const auto per_iteration = program.instructions - setup;
+		program.emit({0x70});             // STOP
+		if (program.here() > subroutine) {
+			std::cerr << "lvbench: " << benchmark.name << " is too long\n";
+			std::exit(EXIT_FAILURE);
+		}
+		instructions = setup + std::uint64_t{per_iteration} * iterations + 1;
+		const auto bytes = program.bytes();
+		return Image::parse(bytes.data(), bytes.size());
+	}
+
+	// Times runs of the operation, the first not counted
+	Result measure(
+		const std::string                      &name,
+		const char                             *const unit,
+		const std::uint64_t                    ops,
+		const unsigned                         runs,
+		const std::function<void()>            &operation)
+	{
+		Result result{name, unit, ops, {}};
+		for (unsigned run = 0; run <= runs; ++run) {
+			const auto start = Clock::now();
+			operation();
+			const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+			if (run) {
+				result.ns_per_op.push_back(elapsed.count() / ops);
+			}
+		}
+		return result;
+	}
+
+	Result run_guest(const Guest_benchmark &benchmark, const char *const engine_name, CPU::Options options, const unsigned runs)
+	{
+		std::uint64_t instructions;
+		const auto image = build(benchmark, instructions);
+		options.clock_mode = Pacer::Mode::unthrottled;
+		std::istringstream input;
+		std::ostringstream output;
+		Mem mem{image};
+		CPU cpu{mem, 1e6, input, output, options};
+		bool first = true;
+		return measure(std::string{benchmark.name} + "/" + engine_name, "instruction", instructions, runs, [&] {
+			if (!first) {
+				mem.reset(image);
+				cpu.reset();
+			}
+			first = false;
+			while (cpu.is_on()) {
+				cpu.step();
+			}
+		});
+	}
+
+	std::vector<Result> run_all(const Settings &settings)
+	{
+		std::vector<Result> results;
+		const auto wanted = [&](const std::string &name) {
+			return name.find(settings.filter) != std::string::npos;
+		};
+		const auto add = [&](Result result) {
+			results.push_back(std::move(result));
+		};
+
+		CPU::Options interpreter, fusion, jit;
+		fusion.fusion = true;
+		jit.engine = CPU::Engine::jit;
+		const std::pair<const char *, const CPU::Options *> engines[] = {
+			{"interpreter", &interpreter},
+			{"fusion", &fusion},
+			{"jit", &jit}
+		};
+		for (const auto &benchmark : guest_benchmarks()) {
+			for (const auto &engine : engines) {
+				if (wanted(std::string{benchmark.name} + "/" + engine.first)) {
+					add(run_guest(benchmark, engine.first, *engine.second, settings.runs));
+				}
+			}
+		}
+
+		constexpr std::uint64_t mem_ops = 1 << 20;
+		Mem mem;
+		volatile std::uint16_t sink = 0;
+		if (wanted("mem_read")) {
+			add(measure("mem_read", "read", mem_ops, settings.runs, [&] {
+				std::uint16_t sum = 0;
+				for (std::uint64_t i = 0; i < mem_ops; ++i) {
+					sum += mem.read(static_cast<std::uint16_t>(i * 0x101));
+				}
+				sink = sum;
+			}));
+		}
+		if (wanted("mem_write")) {
+			add(measure("mem_write", "write", mem_ops, settings.runs, [&] {
+				for (std::uint64_t i = 0; i < mem_ops; ++i) {
+					mem.write(static_cast<std::uint16_t>(i * 0x101), static_cast<std::uint8_t>(i));
+				}
+			}));
+		}
+		if (wanted("mem_read_word")) {
+			add(measure("mem_read_word", "read", mem_ops, settings.runs, [&] {
+				std::uint16_t sum = 0;
+				for (std::uint64_t i = 0; i < mem_ops; ++i) {
+					sum += mem.read_word(static_cast<std::uint16_t>(i * 0x103));
+				}
+				sink = sum;
+			}));
+		}
+		if (wanted("mem_write_word")) {
+			add(measure("mem_write_word", "write", mem_ops, settings.runs, [&] {
+				for (std::uint64_t i = 0; i < mem_ops; ++i) {
+					mem.write_word(static_cast<std::uint16_t>(i * 0x103), static_cast<std::uint16_t>(i));
+				}
+			}));
+		}
+		static_cast<void>(sink);
+
+		// A flat binary with every other page populated, and the same as
+		// segments
+		constexpr unsigned image_loads = 64;
+		std::vector<std::uint8_t> flat(0x10000);
+		std::vector<Image::Segment> segments;
+		for (unsigned page = 0; page < 256; page += 2) {
+			for (unsigned i = 0; i < 256; ++i) {
+				flat[page << 8 | i] = static_cast<std::uint8_t>(page + i + 1);
+			}
+			segments.push_back(Image::Segment{static_cast<std::uint16_t>(page << 8), &flat[page << 8], 256});
+		}
+		if (wanted("image_flat")) {
+			add(measure("image_flat", "load", image_loads, settings.runs, [&] {
+				for (unsigned i = 0; i < image_loads; ++i) {
+					Image::parse(flat.data(), flat.size());
+				}
+			}));
+		}
+		if (wanted("image_segments")) {
+			add(measure("image_segments", "load", image_loads, settings.runs, [&] {
+				for (unsigned i = 0; i < image_loads; ++i) {
+					Image{segments};
+				}
+			}));
+		}
+
+		if (wanted("config_startup") && std::ifstream{"lvcpu.conf"}) {
+			add(measure("config_startup", "load", 1, settings.runs, [] {
+				lua::State lua_state;
+				lua_state.open_libs();
+				if (lua_state.load_file("lvcpu.conf") != static_cast<int>(lua::Status::ok)
+					|| lua_state.call(0, 0) != lua::Status::ok)
+				{
+					std::cerr << "lvbench: could not run lvcpu.conf\n";
+					std::exit(EXIT_FAILURE);
+				}
+			}));
+		}
+		return results;
+	}
+
+	void print(std::ostream &out, const std::vector<Result> &results)
+	{
+		const auto flags = out.flags();
+		const auto precision = out.precision(2);
+		out << std::fixed;
+		out << std::left << std::setw(28) << "benchmark" << std::right;
+		out << std::setw(14) << "ns/op" << std::setw(9) << "+-%" << std::setw(14) << "min ns/op";
+		out << std::setw(11) << "MIPS" << "  op\n";
+		for (const auto &result : results) {
+			const auto mean = result.mean();
+			out << std::left << std::setw(28) << result.name << std::right;
+			out << std::setw(14) << mean;
+			out << std::setw(9) << (mean > 0 ? 100 * result.stddev() / mean : 0.0);
+			out << std::setw(14) << result.min();
+			if (result.unit == std::string{"instruction"}) {
+				out << std::setw(11) << 1e3 / mean;
+			} else {
+				out << std::setw(11) << "";
+			}
+			out << "  " << result.unit << "\n";
+		}
+		out.flags(flags);
+		out.precision(precision);
+	}
+
+	// One benchmark to a line, so baselines read back with sscanf
+	void write_json(std::ostream &out, const std::vector<Result> &results)
+	{
+		out << std::setprecision(4) << std::fixed;
+		out << "{\n\t\"benchmarks\": [\n";
+		for (std::size_t i = 0; i < results.size(); ++i) {
+			const auto &result = results[i];
+			const auto mean = result.mean();
+			out << "\t\t{\"name\": \"" << result.name << "\", \"min_ns_per_op\": " << result.min();
+			out << ", \"ns_per_op\": " << mean << ", \"stddev_ns\": " << result.stddev();
+			out << ", \"mips\": " << (result.unit == std::string{"instruction"} ? 1e3 / mean : 0.0);
+			out << ", \"unit\": \"" << result.unit << "\", \"ops\": " << result.ops;
+			out << ", \"runs\": " << result.ns_per_op.size() << "}";
+			out << (i + 1 < results.size() ? ",\n" : "\n");
+		}
+		out << "\t]\n}\n";
+	}
+
+	std::map<std::string, double> read_baseline(const std::string &path)
+	{
+		std::ifstream in{path};
+		if (!in) {
+			std::cerr << "lvbench: could not open " << path << "\n";
+			std::exit(EXIT_FAILURE);
+		}
+		std::map<std::string, double> baseline;
+		std::string line;
+		while (std::getline(in, line)) {
+			char name[128];
+			double min_ns_per_op;
+			if (std::sscanf(line.c_str(), " {\"name\": \"%127[^\"]\", \"min_ns_per_op\": %lf", name, &min_ns_per_op) == 2) {
+				baseline[name] = min_ns_per_op;
+			}
+		}
+		return baseline;
+	}
+
+	// Prints how each benchmark's fastest run compares with the baseline's,
+	// and gives whether none regressed past the threshold
+	bool compare(std::ostream &out, const std::vector<Result> &results, const Settings &settings)
+	{
+		const auto baseline = read_baseline(settings.baseline_path);
+		bool passed = true;
+		const auto flags = out.flags();
+		const auto precision = out.precision(2);
+		out << std::fixed;
+		out << "\ncompared with " << settings.baseline_path << ", fastest runs:\n";
+		for (const auto &result : results) {
+			const auto found = baseline.find(result.name);
+			if (found == baseline.end()) {
+				continue;
+			}
+			const auto change = 100 * (result.min() / found->second - 1);
+			const bool regressed = change > settings.threshold;
+			passed = passed && !regressed;
+			out << std::left << std::setw(28) << result.name << std::right;
+			out << std::setw(14) << found->second << std::setw(14) << result.min();
+			out << std::setw(9) << std::showpos << change << std::noshowpos << "%";
+			out << (regressed ? "  slower\n" : "\n");
+		}
+		out.flags(flags);
+		out.precision(precision);
+		return passed;
+	}
+
+	[[noreturn]] void usage()
+	{
+		std::cerr << "usage: lvbench [-r runs] [-f filter] [-o results] [-c baseline] [-t percent]\n";
+		std::exit(EXIT_FAILURE);
+	}
+}
+
+int main(const int argc, const char *const *const argv)
+{
+	Settings settings;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		const auto value = [&] {
+			if (i + 1 == argc) {
+				usage();
+			}
+			return std::string{argv[++i]};
+		};
+		if (arg == "-r") {
+			settings.runs = std::stoul(value());
+			if (!settings.runs) {
+				usage();
+			}
+		} else if (arg == "-f") {
+			settings.filter = value();
+		} else if (arg == "-o") {
+			settings.results_path = value();
+		} else if (arg == "-c") {
+			settings.baseline_path = value();
+		} else if (arg == "-t") {
+			settings.threshold = std::stod(value());
+		} else {
+			usage();
+		}
+	}
+
+	const auto results = run_all(settings);
+	print(std::cout, results);
+	if (!settings.results_path.empty()) {
+		std::ofstream out{settings.results_path};
+		write_json(out, results);
+		if (!out) {
+			std::cerr << "lvbench: could not write " << settings.results_path << "\n";
+			return EXIT_FAILURE;
+		}
+	}
+	if (!settings.baseline_path.empty() && !compare(std::cout, results, settings)) {
+		return EXIT_FAILURE;
+	}
+}
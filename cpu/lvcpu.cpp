@@ -1,13 +1,28 @@
 #include <iostream>
+#include <csignal>
+#include <cstdint>
 #include <cstdlib>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <utility>
 #include <stdexcept>
+#include <vector>
 
 #include "lua.hpp"
+#include "lua_module.hpp"
+#include "image.hpp"
 #include "mem.hpp"
+#include "batch.hpp"
+#include "console_input.hpp"
+#include "console_output.hpp"
+#include "counter_port.hpp"
 #include "cpu.hpp"
+#include "debug_console.hpp"
+#include "input_port.hpp"
+#include "lockstep.hpp"
+#include "snapshot.hpp"
+#include "timer_port.hpp"
 
 #ifndef LVCPU_SYSCONF_PATH
 	#define LVCPU_SYSCONF_PATH "/etc/lvcpu/conf"
@@ -16,16 +31,88 @@
 using namespace std::string_literals;
 
 namespace {
+	// A guest address, or a label to be found in the symbol map
+	struct Location {
+		std::uint16_t address;
+		std::string   label;
+	};
+
+	struct Watch_settings {
+		Location location;
+		unsigned size;
+		unsigned access;
+	};
+
+	enum class Break_action {
+		console,
+		dump,
+		stop
+	};
+
 	struct Program_mode {
 		double clock_rate;
 		int memory_size;
 		std::string input_path;
+		bool input_async;
+		// Page to map the input port at, or -1 for none
+		int input_port_page;
 		std::string output_path;
 		std::string bin_path;
 		bool debug_mode;
-		bool no_io_buff;
+		Console_output::Settings output_settings;
+		// Flush output before each read of input
+		bool flush_on_input;
+		CPU::Options cpu_options;
+		// Page to map the timer port at, or -1 for none
+		int timer_port_page;
+		std::string trace_path;
+		std::string profile_path;
+		std::string profile_map;
+		std::vector<Location> breakpoints;
+		std::vector<Watch_settings> watchpoints;
+		Break_action break_action;
+		std::string debug_console_path;
+		std::string counters_path;
+		// Page to map the counter port at, or -1 for none
+		int counter_port_page;
+		std::string snapshot_path;
+		// Cycle count to write a snapshot at, or 0 to write it at STOP
+		std::uint64_t snapshot_cycles;
+		std::string restore_path;
+		std::string batch_path;
+		unsigned batch_threads;
+		unsigned batch_lanes;
+		std::string script_path;
 	};
 
+	volatile std::sig_atomic_t snapshot_requested = 0;
+
+	extern "C" void request_snapshot(int)
+	{
+		snapshot_requested = 1;
+	}
+
+	volatile std::sig_atomic_t trace_requested = 0;
+	// Signal asking to stop, once the trace is written, or 0
+	volatile std::sig_atomic_t stop_signal = 0;
+
+	extern "C" void request_trace(int)
+	{
+		trace_requested = 1;
+	}
+
+	extern "C" void request_stop(const int signal)
+	{
+		stop_signal = signal;
+	}
+
+	volatile std::sig_atomic_t counters_requested = 0;
+
+	extern "C" void request_counters(int)
+	{
+		counters_requested = 1;
+	}
+
 	[[noreturn]] void conf_error(
 		const std::string &reason,
 		const std::string &lua_error = "",
@@ -151,21 +238,463 @@ namespace {
 		conf_error(name + " must be boolean");
 	}
 
+	CPU::Engine state_read_engine(lua::State &lua_state, const std::string &name)
+	{
+		const auto engine = state_read_string(lua_state, name);
+		if (engine == "interpreter") {
+			return CPU::Engine::interpreter;
+		} else if (engine == "jit") {
+			return CPU::Engine::jit;
+		}
+		conf_error(name + " must be 'interpreter' or 'jit'");
+	}
+
+	Pacer::Mode state_read_clock_mode(lua::State &lua_state, const std::string &name)
+	{
+		const auto clock_mode = state_read_string(lua_state, name);
+		if (clock_mode == "paced") {
+			return Pacer::Mode::paced;
+		} else if (clock_mode == "unthrottled") {
+			return Pacer::Mode::unthrottled;
+		} else if (clock_mode == "virtual") {
+			return Pacer::Mode::virtual_time;
+		}
+		conf_error(name + " must be 'paced', 'unthrottled' or 'virtual'");
+	}
+
+	unsigned state_read_pacing_quantum(lua::State &lua_state, const std::string &name)
+	{
+		const auto quantum = state_read_integer(lua_state, name);
+		if (quantum <= 0) {
+			conf_error(name + " must be positive");
+		}
+		return quantum;
+	}
+
+	lua::Integer table_read_integer(
+		lua::State        &lua_state,
+		const std::string &table_name,
+		const std::string &name)
+	{
+		if (lua_state.get_field(-1, name) == lua::Type::number) {
+			if (lua_state.is_integer(-1)) {
+				const auto result = lua_state.to_integer(-1);
+				lua_state.pop();
+				return result;
+			}
+		}
+		conf_error(table_name + "." + name + " must be integer");
+	}
+
+	bool table_read_boolean(
+		lua::State        &lua_state,
+		const std::string &table_name,
+		const std::string &name,
+		const bool        default_value)
+	{
+		const auto type = lua_state.get_field(-1, name);
+		if (type == lua::Type::boolean || type == lua::Type::nil) {
+			const bool result = type == lua::Type::nil ? default_value : lua_state.to_boolean(-1);
+			lua_state.pop();
+			return result;
+		}
+		conf_error(table_name + "." + name + " must be boolean");
+	}
+
+	std::vector<Timer::Settings> state_read_timers(lua::State &lua_state, const std::string &name)
+	{
+		if (lua_state.get_global(name) != lua::Type::table) {
+			conf_error(name + " must be table");
+		}
+		std::vector<Timer::Settings> timers;
+		for (lua::Integer i = 1;; ++i) {
+			const auto type = lua_state.get_index(-1, i);
+			if (type == lua::Type::nil) {
+				break;
+			}
+			const auto timer_name = name + "[" + std::to_string(i) + "]";
+			if (type != lua::Type::table) {
+				conf_error(timer_name + " must be table");
+			}
+			Timer::Settings timer;
+			const auto code = table_read_integer(lua_state, timer_name, "code");
+			if (code < 0x10 || code > 0x3F) {
+				conf_error(timer_name + ".code must be a hardware interrupt, 0x10 to 0x3F");
+			}
+			timer.interrupt_code = code;
+			const auto period = table_read_integer(lua_state, timer_name, "period");
+			if (period <= 0) {
+				conf_error(timer_name + ".period must be positive");
+			}
+			timer.period = period;
+			timer.periodic = table_read_boolean(lua_state, timer_name, "periodic", true);
+			timers.push_back(timer);
+			lua_state.pop();
+		}
+		lua_state.pop(2);
+		return timers;
+	}
+
+	std::uint64_t state_read_snapshot_at(lua::State &lua_state, const std::string &name)
+	{
+		const auto type = lua_state.get_global(name);
+		if (type == lua::Type::string && lua_state.to_string(-1) == "stop") {
+			lua_state.pop();
+			return 0;
+		}
+		if (type == lua::Type::number && lua_state.is_integer(-1)) {
+			const auto cycles = lua_state.to_integer(-1);
+			lua_state.pop();
+			if (cycles <= 0) {
+				conf_error(name + " must be a positive cycle count");
+			}
+			return cycles;
+		}
+		conf_error(name + " must be 'stop' or a cycle count");
+	}
+
+	// Reads the list of events that write out held output into settings and
+	// flush_on_input
+	void state_read_output_flush(
+		lua::State               &lua_state,
+		const std::string        &name,
+		Console_output::Settings &settings,
+		bool                     &flush_on_input)
+	{
+		if (lua_state.get_global(name) != lua::Type::table) {
+			conf_error(name + " must be table");
+		}
+		bool on_interval = false;
+		flush_on_input = false;
+		for (lua::Integer i = 1;; ++i) {
+			const auto type = lua_state.get_index(-1, i);
+			if (type == lua::Type::nil) {
+				break;
+			}
+			const auto policy_name = name + "[" + std::to_string(i) + "]";
+			if (type != lua::Type::string) {
+				conf_error(policy_name + " must be string");
+			}
+			const std::string policy = lua_state.to_string(-1);
+			if (policy == "newline") {
+				settings.on_newline = true;
+			} else if (policy == "input") {
+				flush_on_input = true;
+			} else if (policy == "interval") {
+				on_interval = true;
+			} else {
+				conf_error(policy_name + " must be 'newline', 'input' or 'interval'");
+			}
+			lua_state.pop();
+		}
+		lua_state.pop(2);
+		const auto interval = state_read_integer(lua_state, name + "_interval");
+		if (interval <= 0) {
+			conf_error(name + "_interval must be positive");
+		}
+		if (on_interval) {
+			settings.interval = std::chrono::milliseconds{interval};
+		}
+	}
+
+	std::uint8_t state_read_input_interrupt(lua::State &lua_state, const std::string &name)
+	{
+		const auto code = state_read_integer(lua_state, name);
+		if (code != 0 && (code < 0x10 || code > 0x3F)) {
+			conf_error(name + " must be 0 or a hardware interrupt, 0x10 to 0x3F");
+		}
+		return code;
+	}
+
+	// Reads the address or label on top of the stack, popping it
+	Location read_location(lua::State &lua_state, const lua::Type type, const std::string &name)
+	{
+		Location location{0, ""};
+		if (type == lua::Type::string) {
+			location.label = lua_state.to_string(-1);
+		} else if (type == lua::Type::number && lua_state.is_integer(-1)) {
+			const auto address = lua_state.to_integer(-1);
+			if (address < 0 || address > 0xFFFF) {
+				conf_error(name + " must be an address, 0 to 0xFFFF");
+			}
+			location.address = address;
+		} else {
+			conf_error(name + " must be an address or a label");
+		}
+		lua_state.pop();
+		return location;
+	}
+
+	std::vector<Location> state_read_breakpoints(lua::State &lua_state, const std::string &name)
+	{
+		if (lua_state.get_global(name) != lua::Type::table) {
+			conf_error(name + " must be table");
+		}
+		std::vector<Location> breakpoints;
+		for (lua::Integer i = 1;; ++i) {
+			const auto type = lua_state.get_index(-1, i);
+			if (type == lua::Type::nil) {
+				break;
+			}
+			breakpoints.push_back(read_location(lua_state, type, name + "[" + std::to_string(i) + "]"));
+		}
+		lua_state.pop(2);
+		return breakpoints;
+	}
+
+	std::vector<Watch_settings> state_read_watchpoints(lua::State &lua_state, const std::string &name)
+	{
+		if (lua_state.get_global(name) != lua::Type::table) {
+			conf_error(name + " must be table");
+		}
+		std::vector<Watch_settings> watchpoints;
+		for (lua::Integer i = 1;; ++i) {
+			const auto type = lua_state.get_index(-1, i);
+			if (type == lua::Type::nil) {
+				break;
+			}
+			const auto watch_name = name + "[" + std::to_string(i) + "]";
+			if (type != lua::Type::table) {
+				conf_error(watch_name + " must be table");
+			}
+			Watch_settings watch;
+			watch.location = read_location(lua_state, lua_state.get_field(-1, "address"), watch_name + ".address");
+			const auto size_type = lua_state.get_field(-1, "size");
+			lua_state.pop();
+			const auto size = size_type == lua::Type::nil ? 1 : table_read_integer(lua_state, watch_name, "size");
+			if (size <= 0 || size > 0x10000) {
+				conf_error(watch_name + ".size must be 1 to 0x10000");
+			}
+			watch.size = size;
+			const auto access_type = lua_state.get_field(-1, "access");
+			const std::string access = access_type == lua::Type::string ? lua_state.to_string(-1) : "";
+			lua_state.pop();
+			if (access_type == lua::Type::nil || access == "write") {
+				watch.access = Breakpoints::writes;
+			} else if (access == "read") {
+				watch.access = Breakpoints::reads;
+			} else if (access == "access") {
+				watch.access = Breakpoints::reads | Breakpoints::writes;
+			} else {
+				conf_error(watch_name + ".access must be 'read', 'write' or 'access'");
+			}
+			watchpoints.push_back(watch);
+			lua_state.pop();
+		}
+		lua_state.pop(2);
+		return watchpoints;
+	}
+
+	Break_action state_read_break_action(lua::State &lua_state, const std::string &name)
+	{
+		const auto action = state_read_string(lua_state, name);
+		if (action == "console") {
+			return Break_action::console;
+		} else if (action == "dump") {
+			return Break_action::dump;
+		} else if (action == "stop") {
+			return Break_action::stop;
+		}
+		conf_error(name + " must be 'console', 'dump' or 'stop'");
+	}
+
+	// The address of a location, looking labels up in the symbol map
+	std::uint16_t resolve(const Location &location, const Symbol_map *const symbols)
+	{
+		if (location.label.empty()) {
+			return location.address;
+		}
+		if (!symbols) {
+			conf_error("breakpoint label " + location.label + " needs profile_map");
+		}
+		const auto label = symbols->find(location.label);
+		if (!label) {
+			conf_error("breakpoint label " + location.label + " not in profile_map");
+		}
+		return label->address;
+	}
+
+	int state_read_page(lua::State &lua_state, const std::string &name)
+	{
+		const auto page = state_read_integer(lua_state, name);
+		if (page < -1 || page > 0xFF) {
+			conf_error(name + " must be -1 or a page, 0 to 0xFF");
+		}
+		return page;
+	}
+
+	std::size_t state_read_trace_records(lua::State &lua_state, const std::string &name)
+	{
+		const auto records = state_read_integer(lua_state, name);
+		if (records <= 0) {
+			conf_error(name + " must be positive");
+		}
+		return records;
+	}
+
+	unsigned state_read_profile_interval(lua::State &lua_state, const std::string &name)
+	{
+		const auto interval = state_read_integer(lua_state, name);
+		if (interval <= 0) {
+			conf_error(name + " must be positive");
+		}
+		return interval;
+	}
+
+	unsigned state_read_batch_threads(lua::State &lua_state, const std::string &name)
+	{
+		const auto threads = state_read_integer(lua_state, name);
+		if (threads < 0) {
+			conf_error(name + " must not be negative");
+		}
+		return threads;
+	}
+
+	unsigned state_read_batch_lanes(lua::State &lua_state, const std::string &name)
+	{
+		const auto lanes = state_read_integer(lua_state, name);
+		if (lanes < 1 || lanes > static_cast<int>(Lockstep::max_lanes)) {
+			conf_error(name + " must be 1 to " + std::to_string(Lockstep::max_lanes));
+		}
+		return lanes;
+	}
+
+	// Opens the guest's input, read ahead on a thread of its own if async,
+	// waiting then to tell whether any is ready if blocking
+	std::unique_ptr<std::streambuf> open_input(
+		const std::string &path,
+		const bool        async,
+		const bool        blocking)
+	{
+		if (async) {
+			auto input = std::make_unique<Console_input>(path, blocking);
+			if (input->is_open()) {
+				return input;
+			}
+		} else {
+			auto input = std::make_unique<std::filebuf>();
+			if (input->open(path, std::ios::in)) {
+				return input;
+			}
+		}
+		return nullptr;
+	}
+
+	int run_batch(const Program_mode &program_mode)
+	{
+		std::ifstream manifest{program_mode.batch_path};
+		if (!manifest) {
+			std::cerr << "Could not open batch manifest!";
+			std::endl(std::cerr);
+			return EXIT_FAILURE;
+		}
+		Batch batch{manifest};
+		batch.run(
+			program_mode.clock_rate,
+			program_mode.cpu_options,
+			program_mode.batch_threads,
+			program_mode.batch_lanes
+		);
+		batch.report(std::cout);
+		return batch.succeeded() ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Runs the script in the state the configuration ran in, so that it sees
+	// the settings given on the command line, with the lvcpu module to hand
+	int run_script(lua::State &lua_state, const std::string &path)
+	{
+		lua_state.require("lvcpu", luaopen_lvcpu);
+		if (
+			lua_state.load_file(path) != static_cast<int>(lua::Status::ok)
+			|| lua_state.call(0, 0) != lua::Status::ok
+		) {
+			std::cerr << "script: " << lua_state.to_string(-1);
+			std::endl(std::cerr);
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
 	Program_mode state_read_mode(lua::State &lua_state)
 	{
 		Program_mode mode;
 		mode.clock_rate  = state_read_number(lua_state, "clock_rate");
 		mode.memory_size = state_read_integer(lua_state, "memory_size");
 		mode.input_path  = state_read_string(lua_state, "input_path");
+		mode.input_async = state_read_boolean(lua_state, "input_async");
+		mode.input_port_page = state_read_page(lua_state, "input_port_page");
 		mode.output_path = state_read_string(lua_state, "output_path");
 		mode.bin_path    = state_read_string(lua_state, "bin_path");
 		mode.debug_mode  = state_read_boolean(lua_state, "debug_mode");
+		state_read_output_flush(lua_state, "output_flush", mode.output_settings, mode.flush_on_input);
+		mode.output_settings.writer_thread = state_read_boolean(lua_state, "output_thread");
+		mode.output_settings.unbuffered    = state_read_boolean(lua_state, "no_io_buff");
+		mode.cpu_options.engine         = state_read_engine(lua_state, "engine");
+		mode.cpu_options.fusion         = state_read_boolean(lua_state, "fusion");
+		mode.cpu_options.opcode_profile = state_read_boolean(lua_state, "opcode_profile");
+		mode.cpu_options.pacing_quantum = state_read_pacing_quantum(lua_state, "pacing_quantum");
+		mode.cpu_options.clock_mode     = state_read_clock_mode(lua_state, "clock_mode");
+		mode.cpu_options.pacing_report  = state_read_boolean(lua_state, "pacing_report");
+		mode.cpu_options.timers         = state_read_timers(lua_state, "timers");
+		mode.timer_port_page            = state_read_page(lua_state, "timer_port_page");
+		mode.cpu_options.input_waits     = mode.input_async;
+		mode.cpu_options.input_interrupt = state_read_input_interrupt(lua_state, "input_interrupt");
+		// Only input read ahead tells when it is ready, and when it has ended
+		if (!mode.input_async && (mode.cpu_options.input_interrupt || mode.input_port_page >= 0)) {
+			conf_error("input_interrupt and input_port_page need input_async");
+		}
+		mode.trace_path = state_read_string(lua_state, "trace_path");
+		if (!mode.trace_path.empty()) {
+			mode.cpu_options.trace_records = state_read_trace_records(lua_state, "trace_records");
+		}
+		mode.profile_path = state_read_string(lua_state, "profile_path");
+		if (!mode.profile_path.empty()) {
+			mode.cpu_options.profile_interval = state_read_profile_interval(lua_state, "profile_interval");
+		}
+		mode.profile_map = state_read_string(lua_state, "profile_map");
+		mode.breakpoints        = state_read_breakpoints(lua_state, "breakpoints");
+		mode.watchpoints        = state_read_watchpoints(lua_state, "watchpoints");
+		mode.break_action       = state_read_break_action(lua_state, "break_action");
+		mode.debug_console_path = state_read_string(lua_state, "debug_console_path");
+		mode.counters_path     = state_read_string(lua_state, "counters_path");
+		mode.counter_port_page = state_read_page(lua_state, "counter_port_page");
+		if (!Counters::enabled && (!mode.counters_path.empty() || mode.counter_port_page >= 0)) {
+			conf_error("counters_path and counter_port_page need lvcpu built with COUNTERS=1");
+		}
+		if (mode.counter_port_page >= 0 && mode.counter_port_page == mode.input_port_page) {
+			conf_error("counter_port_page and input_port_page must differ");
+		}
+		if (
+			mode.timer_port_page >= 0
+			&& (mode.timer_port_page == mode.input_port_page || mode.timer_port_page == mode.counter_port_page)
+		) {
+			conf_error("timer_port_page must differ from input_port_page and counter_port_page");
+		}
+		mode.snapshot_path   = state_read_string(lua_state, "snapshot_path");
+		mode.snapshot_cycles = state_read_snapshot_at(lua_state, "snapshot_at");
+		mode.restore_path    = state_read_string(lua_state, "restore_path");
+		mode.batch_path      = state_read_string(lua_state, "batch_path");
+		mode.batch_threads   = state_read_batch_threads(lua_state, "batch_threads");
+		mode.batch_lanes     = state_read_batch_lanes(lua_state, "batch_lanes");
+		mode.script_path     = state_read_string(lua_state, "script_path");
+		if (!mode.batch_path.empty() && !mode.profile_path.empty()) {
+			conf_error("profile_path does not work with batch_path");
+		}
+		if (!mode.batch_path.empty() && (!mode.breakpoints.empty() || !mode.watchpoints.empty())) {
+			conf_error("breakpoints and watchpoints do not work with batch_path");
+		}
+		// Jobs read their input straight from files, which never tell of its end
+		if (!mode.batch_path.empty() && mode.input_async) {
+			conf_error("input_async does not work with batch_path");
+		}
 		return std::move(mode);
 	}
 
-	Program_mode load_mode(const int argc, const char *const *const argv)
+	Program_mode load_mode(
+		lua::State               &lua_state,
+		const int                argc,
+		const char *const *const argv)
 	{
-		lua::State lua_state;
 		lua_state.open_libs();
 		if (!conf_file_load(lua_state, "lvcpu.conf") && !conf_file_load(lua_state, LVCPU_SYSCONF_PATH)) {
 			std::cerr << "Warning: did not find any configuration files";
@@ -177,41 +706,169 @@ namespace {
 		conf_run(lua_state);
 		return state_read_mode(lua_state);
 	}
-
-	void read_bin_file(Mem &system_mem, std::istream &bin_file)
-	{
-		for (std::uint16_t addr = 0; bin_file; ++addr) {
-			char input_char;
-			bin_file.get(input_char);
-			system_mem.write(addr, input_char);
-		}
-	}
 }
 
 int main(const int argc, const char *const *const argv)
 {
-	Program_mode program_mode = load_mode(argc, argv);
-	Mem system_mem;
-	std::ifstream binary_file{program_mode.bin_path};
-	if (!binary_file) {
-		std::cerr << "Could not open binary file!";
-		std::endl(std::cerr);
-		return EXIT_FAILURE;
+	lua::State lua_state;
+	Program_mode program_mode = load_mode(lua_state, argc, argv);
+	if (!program_mode.script_path.empty()) {
+		return run_script(lua_state, program_mode.script_path);
+	}
+	if (!program_mode.batch_path.empty()) {
+		return run_batch(program_mode);
+	}
+	std::unique_ptr<Snapshot> restored;
+	std::shared_ptr<const Image> image;
+	if (!program_mode.restore_path.empty()) {
+		restored = std::make_unique<Snapshot>(program_mode.restore_path);
+		image = restored->image();
+	} else {
+		image = Image::load_file(program_mode.bin_path);
+		if (!image) {
+			std::cerr << "Could not open binary file!";
+			std::endl(std::cerr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!program_mode.profile_map.empty()) {
+		program_mode.cpu_options.profile_symbols = std::make_shared<const Symbol_map>(program_mode.profile_map);
+	}
+	const auto &symbols = program_mode.cpu_options.profile_symbols;
+	std::shared_ptr<Breakpoints> breakpoints;
+	if (!program_mode.breakpoints.empty() || !program_mode.watchpoints.empty()) {
+		breakpoints = std::make_shared<Breakpoints>();
+		for (const auto &location : program_mode.breakpoints) {
+			breakpoints->add_breakpoint(resolve(location, symbols.get()));
+		}
+		for (const auto &watch : program_mode.watchpoints) {
+			const auto first = resolve(watch.location, symbols.get());
+			if (first + watch.size > 0x10000) {
+				conf_error("watchpoints must end by 0xFFFF");
+			}
+			breakpoints->add_watchpoint(Breakpoints::Watchpoint{
+				first,
+				static_cast<std::uint16_t>(first + watch.size - 1),
+				watch.access
+			});
+		}
+		program_mode.cpu_options.breakpoints = breakpoints;
 	}
-	read_bin_file(system_mem, binary_file);
-	binary_file.close();
-	std::ifstream input_file{program_mode.input_path};
-	std::ofstream output_file{program_mode.output_path};
-	if (!input_file) {
+	Mem system_mem{image};
+	const auto input_buffer = open_input(
+		program_mode.input_path,
+		program_mode.input_async,
+		program_mode.cpu_options.clock_mode == Pacer::Mode::virtual_time
+	);
+	std::istream input_file{input_buffer.get()};
+	Console_output console{program_mode.output_path, program_mode.output_settings};
+	std::ostream output_file{&console};
+	if (!input_buffer) {
 		std::cerr << "Could not open input file!";
 		std::endl(std::cerr);
 		return EXIT_FAILURE;
-	} else if (!output_file) {
+	} else if (!console.is_open()) {
 		std::cerr << "Could not open output file!";
 		std::endl(std::cerr);
 		return EXIT_FAILURE;
 	}
-	CPU CPU_state{system_mem, program_mode.clock_rate, input_file, output_file};
+	if (program_mode.flush_on_input) {
+		input_file.tie(&output_file);
+	}
+	Input_port input_port{input_file};
+	if (program_mode.input_port_page >= 0) {
+		system_mem.map(input_port, program_mode.input_port_page);
+	}
+	CPU CPU_state{
+		system_mem,
+		program_mode.clock_rate,
+		input_file,
+		output_file,
+		program_mode.cpu_options
+	};
+	if (restored) {
+		CPU_state.restore(restored->state());
+		restored.reset();
+	}
+	Counter_port counter_port{CPU_state};
+	if (program_mode.counter_port_page >= 0) {
+		system_mem.map(counter_port, program_mode.counter_port_page);
+	}
+	Timer_port timer_port{CPU_state};
+	if (program_mode.timer_port_page >= 0) {
+		system_mem.map(timer_port, program_mode.timer_port_page);
+	}
+	const bool counting = !program_mode.counters_path.empty();
+	if (counting) {
+#if defined(SIGQUIT)
+		std::signal(SIGQUIT, request_counters);
+#endif
+	}
+	const auto write_counters = [&] {
+		std::ofstream out{program_mode.counters_path};
+		CPU_state.write_counters(out);
+		if (!out) {
+			std::cerr << "Could not write counters!";
+			std::endl(std::cerr);
+		}
+	};
+	const bool snapshots = !program_mode.snapshot_path.empty();
+	auto snapshot_cycles = program_mode.snapshot_cycles;
+	if (snapshots) {
+#if defined(SIGUSR1)
+		std::signal(SIGUSR1, request_snapshot);
+#endif
+		if (snapshot_cycles && CPU_state.cycles() >= snapshot_cycles) {
+			// Already past it, as when restored from a later snapshot
+			snapshot_cycles = Scheduler::never;
+		}
+	}
+	const auto write_snapshot = [&] {
+		Snapshot{CPU_state, system_mem}.write(program_mode.snapshot_path);
+	};
+	const bool tracing = !program_mode.trace_path.empty();
+	if (tracing) {
+#if defined(SIGUSR2)
+		std::signal(SIGUSR2, request_trace);
+#endif
+		std::signal(SIGINT, request_stop);
+		std::signal(SIGTERM, request_stop);
+	}
+	std::ifstream console_input;
+	std::unique_ptr<Debug_console> debug_console;
+	if (breakpoints) {
+		if (program_mode.break_action == Break_action::console) {
+			console_input.open(program_mode.debug_console_path);
+			if (!console_input) {
+				std::cerr << "Could not open debug console!";
+				std::endl(std::cerr);
+				return EXIT_FAILURE;
+			}
+		}
+		debug_console = std::make_unique<Debug_console>(
+			CPU_state,
+			system_mem,
+			*breakpoints,
+			symbols,
+			console_input,
+			std::cerr
+		);
+	}
+	// Gives whether to carry on from a breakpoint or watchpoint hit
+	const auto stopped = [&] {
+		std::flush(output_file);
+		switch (program_mode.break_action) {
+		case Break_action::console:
+			return debug_console->run();
+		case Break_action::dump:
+			debug_console->print_stop();
+			breakpoints->resume();
+			return true;
+		default:
+			debug_console->print_stop();
+			return false;
+		}
+	};
 	if (program_mode.debug_mode) {
 		std::cerr << CPU_state;
 		std::endl(std::cerr);
@@ -222,8 +879,65 @@ int main(const int argc, const char *const *const argv)
 			std::cerr << CPU_state;
 			std::endl(std::cerr);
 		}
-		if (program_mode.no_io_buff) {
+		if (breakpoints && breakpoints->stopped() && !stopped()) {
+			break;
+		}
+		if (snapshots) {
+			if (snapshot_cycles && CPU_state.cycles() >= snapshot_cycles) {
+				write_snapshot();
+				snapshot_cycles = Scheduler::never;
+			}
+			if (snapshot_requested) {
+				snapshot_requested = 0;
+				write_snapshot();
+			}
+		}
+		if (counting && counters_requested) {
+			counters_requested = 0;
+			write_counters();
+		}
+		if (tracing) {
+			if (trace_requested) {
+				trace_requested = 0;
+				CPU_state.trace()->write(program_mode.trace_path, Trace::signal);
+			}
+			if (stop_signal) {
+				break;
+			}
+		}
+	}
+	if (snapshots && !program_mode.snapshot_cycles) {
+		write_snapshot();
+	}
+	if (counting) {
+		write_counters();
+	}
+	if (tracing) {
+		CPU_state.trace()->write(program_mode.trace_path, stop_signal ? Trace::signal : Trace::stop);
+		if (stop_signal) {
+			// Ends as the signal would have, with the trace and the output
+			// held so far written, as no destructor runs after this
 			std::flush(output_file);
+			std::signal(stop_signal, SIG_DFL);
+			std::raise(stop_signal);
+		}
+	}
+	if (!program_mode.profile_path.empty()) {
+		std::ofstream folded{program_mode.profile_path};
+		CPU_state.profiler()->write_folded(folded);
+		if (!folded) {
+			std::cerr << "Could not write profile!";
+			std::endl(std::cerr);
 		}
 	}
+	const auto &cpu_options = program_mode.cpu_options;
+	if (
+		cpu_options.fusion
+		|| cpu_options.opcode_profile
+		|| cpu_options.pacing_report
+		|| cpu_options.profile_interval
+	) {
+		std::flush(output_file);
+		CPU_state.report(std::cerr);
+	}
 }
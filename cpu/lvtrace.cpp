@@ -0,0 +1,278 @@
+// Prints, filters and compares traces written by lvcpu.
+//
+//   lvtrace [filters] trace       prints the records that pass the filters
+//   lvtrace -d trace other        prints where two traces first differ
+//
+// Filters, all of which a record has to pass:
+//   -k kind      instruction, block or interrupt
+//   -i from-to   IP in the range, in hex
+//   -o op        op code, in hex
+//   -w           writes memory
+//   -r           raises an interrupt
+//   -n count     only the last count records passing
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "trace.hpp"
+
+namespace {
+	struct Trace_file {
+		Trace::Header header;
+		std::vector<Trace::Record> records;
+	};
+
+	struct Filter {
+		int kind = -1;
+		unsigned ip_from = 0, ip_to = 0xFFFF;
+		int op_code = -1;
+		bool writes = false;
+		bool raises = false;
+		std::size_t last = 0;
+	};
+
+	[[noreturn]] void usage()
+	{
+		std::cerr << "usage: lvtrace [-k kind] [-i from-to] [-o op] [-w] [-r] [-n count] trace\n";
+		std::cerr << "       lvtrace -d trace other\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	[[noreturn]] void fail(const std::string &reason)
+	{
+		std::cerr << "lvtrace: " << reason << "\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	Trace_file load(const std::string &path)
+	{
+		const Mapped_file file{path};
+		if (!file.is_open()) {
+			fail("could not open " + path);
+		}
+		Trace_file trace;
+		if (file.size() < sizeof trace.header) {
+			fail(path + " truncated");
+		}
+		std::memcpy(&trace.header, file.data(), sizeof trace.header);
+		const auto &current = Trace::current_header;
+		if (std::memcmp(trace.header.magic, current.magic, sizeof current.magic) != 0) {
+			fail(path + " is not a trace");
+		}
+		if (trace.header.byte_order != current.byte_order || trace.header.record_size != current.record_size) {
+			fail(path + " made by an incompatible build");
+		}
+		const auto size = file.size() - sizeof trace.header;
+		if (size % sizeof(Trace::Record) != 0) {
+			fail(path + " truncated");
+		}
+		trace.records.resize(size / sizeof(Trace::Record));
+		if (size) {
+			std::memcpy(trace.records.data(), file.data() + sizeof trace.header, size);
+		}
+		return trace;
+	}
+
+	const char * kind_name(const unsigned kind)
+	{
+		static const char *const names[] = {"instruction", "block", "interrupt"};
+		return kind < 3 ? names[kind] : "?";
+	}
+
+	// Marks the registers changed since previous, if there is one
+	void print(const Trace::Record &record, const Trace::Record *const previous)
+	{
+		char line[160];
+		auto length = std::snprintf(line, sizeof line, "%12llu %04X ",
+			static_cast<unsigned long long>(record.cycles), record.ip);
+		if (record.kind == Trace::instruction) {
+			length += std::snprintf(line + length, sizeof line - length, "%02X %02X %02X   ",
+				record.bytes[0], record.bytes[1], record.bytes[2]);
+		} else if (record.kind == Trace::block) {
+			const unsigned count = record.bytes[0] | record.bytes[1] << 8 | record.bytes[2] << 16;
+			length += std::snprintf(line + length, sizeof line - length, "block %-5u ", count);
+		} else {
+			length += std::snprintf(line + length, sizeof line - length, "%-12s", kind_name(record.kind));
+		}
+		const auto mark = [&](const unsigned value, const unsigned before) {
+			return previous && value != before ? '*' : ' ';
+		};
+		const auto &before = previous ? *previous : record;
+		length += std::snprintf(line + length, sizeof line - length,
+			"A=%04X%c C=%04X%c SP=%04X%c BP=%04X%c F=%02X%c",
+			record.a, mark(record.a, before.a),
+			record.c, mark(record.c, before.c),
+			record.sp, mark(record.sp, before.sp),
+			record.bp, mark(record.bp, before.bp),
+			record.f, mark(record.f, before.f));
+		if (record.write_size == 1) {
+			length += std::snprintf(line + length, sizeof line - length, " [%04X]=%02X",
+				record.write_address, record.write_value);
+		} else if (record.write_size == 2) {
+			length += std::snprintf(line + length, sizeof line - length, " [%04X]=%04X",
+				record.write_address, record.write_value);
+		}
+		if (record.flags & Trace::raised) {
+			length += std::snprintf(line + length, sizeof line - length, " int %02X%s",
+				record.interrupt, record.flags & Trace::double_fault ? " double fault" : "");
+		}
+		std::cout << line << "\n";
+	}
+
+	void print_header(const std::string &path, const Trace_file &trace)
+	{
+		std::cout << path << ": " << trace.records.size() << " of " << trace.header.records
+			<< " records, written at " << (trace.header.reason == Trace::signal ? "signal" : "stop") << "\n";
+	}
+
+	bool passes(const Filter &filter, const Trace::Record &record)
+	{
+		return
+			(filter.kind < 0 || record.kind == filter.kind)
+			&& record.ip >= filter.ip_from && record.ip <= filter.ip_to
+			&& (filter.op_code < 0 || (record.kind == Trace::instruction && record.bytes[0] == filter.op_code))
+			&& (!filter.writes || record.write_size)
+			&& (!filter.raises || (record.flags & Trace::raised));
+	}
+
+	// Records are the same step with the same outcome
+	bool same(const Trace::Record &lhs, const Trace::Record &rhs)
+	{
+		return
+			lhs.cycles == rhs.cycles && lhs.ip == rhs.ip && lhs.kind == rhs.kind
+			&& std::memcmp(lhs.bytes, rhs.bytes, sizeof lhs.bytes) == 0
+			&& lhs.a == rhs.a && lhs.c == rhs.c && lhs.sp == rhs.sp && lhs.bp == rhs.bp && lhs.f == rhs.f
+			&& lhs.interrupt == rhs.interrupt && lhs.flags == rhs.flags
+			&& lhs.write_size == rhs.write_size
+			&& (!lhs.write_size || (lhs.write_address == rhs.write_address && lhs.write_value == rhs.write_value));
+	}
+
+	// Lines the traces up at the first cycle count both have a record for,
+	// and reports the first pair of records after it that differ
+	int diff(const std::string &path, const std::string &other_path)
+	{
+		const auto trace = load(path);
+		const auto other = load(other_path);
+		print_header(path, trace);
+		print_header(other_path, other);
+		std::size_t i = 0, j = 0;
+		while (i < trace.records.size() && j < other.records.size()) {
+			if (trace.records[i].cycles < other.records[j].cycles) {
+				++i;
+			} else if (trace.records[i].cycles > other.records[j].cycles) {
+				++j;
+			} else {
+				break;
+			}
+		}
+		if (i == trace.records.size() || j == other.records.size()) {
+			std::cout << "no cycle count in common\n";
+			return EXIT_FAILURE;
+		}
+		for (; i < trace.records.size() && j < other.records.size(); ++i, ++j) {
+			if (!same(trace.records[i], other.records[j])) {
+				std::cout << "differ after " << i << " and " << j << " records:\n";
+				const auto previous = [](const std::vector<Trace::Record> &records, const std::size_t k) {
+					return k ? &records[k - 1] : nullptr;
+				};
+				for (auto k = i > 3 ? i - 3 : 0; k < i; ++k) {
+					std::cout << "  ";
+					print(trace.records[k], previous(trace.records, k));
+				}
+				std::cout << "< ";
+				print(trace.records[i], previous(trace.records, i));
+				std::cout << "> ";
+				print(other.records[j], previous(other.records, j));
+				return EXIT_FAILURE;
+			}
+		}
+		if (i != trace.records.size() || j != other.records.size()) {
+			std::cout << "same until " << (i == trace.records.size() ? path : other_path) << " ends\n";
+			return EXIT_FAILURE;
+		}
+		std::cout << "same\n";
+		return EXIT_SUCCESS;
+	}
+}
+
+int main(const int argc, const char *const *const argv)
+{
+	Filter filter;
+	std::vector<std::string> paths;
+	bool diffing = false;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		const auto value = [&] {
+			if (i + 1 == argc) {
+				usage();
+			}
+			return std::string{argv[++i]};
+		};
+		if (arg == "-d") {
+			diffing = true;
+		} else if (arg == "-k") {
+			const auto kind = value();
+			for (unsigned k = 0; k < 3; ++k) {
+				if (kind == kind_name(k)) {
+					filter.kind = k;
+				}
+			}
+			if (filter.kind < 0) {
+				usage();
+			}
+		} else if (arg == "-i") {
+			const auto range = value();
+			if (std::sscanf(range.c_str(), "%x-%x", &filter.ip_from, &filter.ip_to) != 2) {
+				usage();
+			}
+		} else if (arg == "-o") {
+			filter.op_code = std::stoi(value(), nullptr, 16);
+		} else if (arg == "-w") {
+			filter.writes = true;
+		} else if (arg == "-r") {
+			filter.raises = true;
+		} else if (arg == "-n") {
+			filter.last = std::stoul(value());
+		} else if (!arg.empty() && arg[0] == '-') {
+			usage();
+		} else {
+			paths.push_back(arg);
+		}
+	}
+	if (diffing) {
+		if (paths.size() != 2) {
+			usage();
+		}
+		return diff(paths[0], paths[1]);
+	}
+	if (paths.size() != 1) {
+		usage();
+	}
+	const auto trace = load(paths[0]);
+	print_header(paths[0], trace);
+	std::deque<std::size_t> last;
+	const auto &records = trace.records;
+	for (std::size_t i = 0; i < records.size(); ++i) {
+		if (!passes(filter, records[i])) {
+			continue;
+		}
+		if (!filter.last) {
+			print(records[i], i ? &records[i - 1] : nullptr);
+			continue;
+		}
+		last.push_back(i);
+		if (last.size() > filter.last) {
+			last.pop_front();
+		}
+	}
+	for (const auto i : last) {
+		print(records[i], i ? &records[i - 1] : nullptr);
+	}
+}
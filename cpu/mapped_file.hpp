@@ -0,0 +1,108 @@
+#ifndef LVCPU_MAPPED_FILE_HPP_INCLUDED
+#define LVCPU_MAPPED_FILE_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(__unix__)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#else
+	#include <fstream>
+	#include <iterator>
+	#include <vector>
+#endif
+
+// The contents of a file, mapped read-only for as long as this lives where
+// the platform allows, and read into memory elsewhere.
+class Mapped_file {
+#if defined(__unix__)
+	int _fd = -1;
+	void *_data = MAP_FAILED;
+#else
+	bool _open = false;
+	std::vector<std::uint8_t> _data;
+#endif
+	std::size_t _size = 0;
+
+public:
+	inline explicit            Mapped_file(const std::string &path);
+	inline                     ~Mapped_file();
+	Mapped_file(const Mapped_file &) = delete;
+	Mapped_file & operator = (const Mapped_file &) = delete;
+	inline bool                is_open() const;
+	inline const std::uint8_t * data() const;
+	inline std::size_t         size() const;
+};
+
+#if defined(__unix__)
+
+Mapped_file::Mapped_file(const std::string &path)
+{
+	_fd = ::open(path.c_str(), O_RDONLY);
+	struct stat status;
+	if (_fd < 0 || ::fstat(_fd, &status) != 0) {
+		return;
+	}
+	_size = status.st_size;
+	if (_size > 0) {
+		_data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+	}
+}
+
+Mapped_file::~Mapped_file()
+{
+	if (_data != MAP_FAILED) {
+		::munmap(_data, _size);
+	}
+	if (_fd >= 0) {
+		::close(_fd);
+	}
+}
+
+bool Mapped_file::is_open() const
+{
+	return _fd >= 0 && (_size == 0 || _data != MAP_FAILED);
+}
+
+const std::uint8_t * Mapped_file::data() const
+{
+	return _size ? static_cast<const std::uint8_t *>(_data) : nullptr;
+}
+
+#else
+
+Mapped_file::Mapped_file(const std::string &path)
+{
+	std::ifstream file{path, std::ios::binary};
+	if (!file) {
+		return;
+	}
+	_open = true;
+	_data.assign(std::istreambuf_iterator<char>{file}, {});
+	_size = _data.size();
+}
+
+Mapped_file::~Mapped_file() = default;
+
+bool Mapped_file::is_open() const
+{
+	return _open;
+}
+
+const std::uint8_t * Mapped_file::data() const
+{
+	return _data.data();
+}
+
+#endif
+
+std::size_t Mapped_file::size() const
+{
+	return _size;
+}
+
+#endif // LVCPU_MAPPED_FILE_HPP_INCLUDED
@@ -3,28 +3,448 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
 #include <vector>
 
+#include "bin_utils.hpp"
+#include "breakpoints.hpp"
+#include "counters.hpp"
+#include "decode_cache.hpp"
+#include "device.hpp"
+#include "image.hpp"
+#include "jit.hpp"
+#include "trace.hpp"
+
+// The guest's 64 KiB address space, in 256 pages of 256 bytes. Each page is
+// either RAM, reached through a pointer, or mapped to a device.
+//
+// RAM pages are shared with an image, or the zero page, until first written
+// to, when the page is copied. Many Mems of the same image then cost only
+// the pages each one writes.
+//
+// Pages watched for reads or writes by attached Breakpoints are reached the
+// slow way for those accesses, as device pages are, and the rest as fast as
+// without them. Fetching instructions does not count as reading.
 class Mem {
-	std::vector<std::uint8_t> _contents;
+	std::shared_ptr<const Image> _image;
+	// Copies of pages written to, or once RAM is made flat, all of it. Only
+	// the first _copies_used are in use, the rest kept from before a reset.
+	std::vector<std::unique_ptr<std::uint8_t[]>> _copies;
+	std::size_t _copies_used = 0;
+	std::unique_ptr<std::uint8_t[]> _flat;
+	// This Mem's own copy of each page, or null while the page is shared
+	std::array<std::uint8_t *, 256> _private_pages = {};
+	// RAM behind each page for reads, and for writes once it is private,
+	// or null where a device is mapped or the access is watched
+	std::array<const std::uint8_t *, 256> _ram_pages;
+	std::array<std::uint8_t *, 256> _writable_pages = {};
+	std::array<Device *, 256> _devices = {};
+	Decode_cache *_decode_cache = nullptr;
+	Jit *_jit = nullptr;
+	Trace *_trace = nullptr;
+	Counters *_counters = nullptr;
+	Breakpoints *_breakpoints = nullptr;
+
+	inline const std::uint8_t * shared_page(std::uint8_t page) const;
+	inline std::uint8_t *       make_private(std::uint8_t page);
+	inline void                 update_page(std::uint8_t page);
+	inline std::uint8_t *       write_page(std::uint16_t address, std::uint8_t value);
+	inline std::uint8_t         read_unwatched(std::uint16_t address);
+	inline void                 mapping_changed();
+
 public:
-	inline              Mem();
-	inline std::uint8_t read(std::uint16_t address);
-	inline void         write(std::uint16_t address, std::uint8_t value);
+	inline                      Mem();
+	inline explicit             Mem(std::shared_ptr<const Image> image);
+	Mem(const Mem &) = delete;
+	Mem & operator = (const Mem &) = delete;
+	inline void                 reset(std::shared_ptr<const Image> image);
+	inline std::uint8_t         read(std::uint16_t address);
+	inline void                 write(std::uint16_t address, std::uint8_t value);
+	inline std::uint16_t        read_word(std::uint16_t address);
+	inline void                 write_word(std::uint16_t address, std::uint16_t value);
+	inline void                 fetch(std::uint16_t address, std::uint8_t *bytes, unsigned count);
+	inline void                 map(Device &device, std::uint8_t first_page, unsigned pages = 1);
+	inline void                 unmap(std::uint8_t first_page, unsigned pages = 1);
+	inline bool                 is_ram(std::uint16_t address) const;
+	inline bool                 reads_ram(std::uint16_t address) const;
+	inline bool                 breaks_at(std::uint16_t address) const;
+	inline bool                 stopped() const;
+	inline const std::uint8_t * ram_page(std::uint8_t page) const;
+	inline void                 read_block(std::uint16_t address, std::uint8_t *bytes, std::size_t count) const;
+	inline void                 write_block(std::uint16_t address, const std::uint8_t *bytes, std::size_t count);
+	inline void                 attach(Decode_cache *decode_cache);
+	inline void                 attach(Jit *jit);
+	inline void                 attach(Trace *trace);
+	inline void                 attach(Counters *counters);
+	inline void                 attach(Breakpoints *breakpoints);
+	inline void                 breakpoints_changed();
+	inline const std::uint8_t * contents();
 };
 
+// All zeros, sharing the zero page until written to
 Mem::Mem() :
-	_contents(0x10000, 0)
+	Mem(nullptr)
 {}
 
+Mem::Mem(std::shared_ptr<const Image> image) :
+	_image(std::move(image))
+{
+	for (unsigned page = 0; page < _ram_pages.size(); ++page) {
+		_ram_pages[page] = shared_page(page);
+	}
+}
+
+// Starts over with the contents of image, keeping devices mapped and the
+// memory allocated for private pages. RAM made flat stays flat, refilled.
+void Mem::reset(std::shared_ptr<const Image> image)
+{
+	_image = std::move(image);
+	_copies_used = 0;
+	for (unsigned page = 0; page < _ram_pages.size(); ++page) {
+		if (_flat) {
+			std::memcpy(_private_pages[page], shared_page(page), 0x100);
+		} else {
+			_private_pages[page] = nullptr;
+		}
+		update_page(page);
+	}
+	mapping_changed();
+}
+
+const std::uint8_t * Mem::shared_page(const std::uint8_t page) const
+{
+	return _image ? _image->page(page) : Image::zero_page();
+}
+
+// Gives the page a private copy to be written to, of what it was sharing
+std::uint8_t * Mem::make_private(const std::uint8_t page)
+{
+	if (_copies_used == _copies.size()) {
+		_copies.emplace_back(new std::uint8_t[0x100]);
+	}
+	const auto copy = _copies[_copies_used++].get();
+	std::memcpy(copy, shared_page(page), 0x100);
+	_private_pages[page] = copy;
+	update_page(page);
+	return copy;
+}
+
+// Points the page's reads at its RAM and its writes at its private copy,
+// unless a device is mapped there or they are watched
+void Mem::update_page(const std::uint8_t page)
+{
+	if (_devices[page]) {
+		_ram_pages[page] = nullptr;
+		_writable_pages[page] = nullptr;
+		return;
+	}
+	const bool reads_watched = _breakpoints && _breakpoints->watches_reads(page);
+	const bool writes_watched = _breakpoints && _breakpoints->watches_writes(page);
+	_ram_pages[page] = reads_watched ? nullptr : ram_page(page);
+	_writable_pages[page] = writes_watched ? nullptr : _private_pages[page];
+}
+
+// The RAM for a write the fast way cannot make, to a device, to a page not
+// yet private, or to a watched one; or null when a device took the write
+std::uint8_t * Mem::write_page(const std::uint16_t address, const std::uint8_t value)
+{
+	if (_breakpoints) {
+		_breakpoints->wrote(address, value);
+	}
+	const auto page = address >> 8;
+	if (_devices[page]) {
+		_devices[page]->write(address, value);
+		return nullptr;
+	}
+	return _private_pages[page] ? _private_pages[page] : make_private(page);
+}
+
+std::uint8_t Mem::read_unwatched(const std::uint16_t address)
+{
+	if (_devices[address >> 8]) {
+		return _devices[address >> 8]->read(address);
+	}
+	return ram_page(address >> 8)[address & 0xFF];
+}
+
 std::uint8_t Mem::read(const std::uint16_t address)
 {
-	return _contents[address];
+	if constexpr (Counters::enabled) {
+		if (_counters) {
+			_counters->read(1);
+		}
+	}
+	const auto ram = _ram_pages[address >> 8];
+	if (ram) {
+		return ram[address & 0xFF];
+	}
+	const auto value = read_unwatched(address);
+	if (_breakpoints) {
+		_breakpoints->read(address, value);
+	}
+	return value;
 }
 
 void Mem::write(const std::uint16_t address, const std::uint8_t value)
 {
-	_contents[address] = value;
+	if (_trace) {
+		_trace->wrote(address, value, 1);
+	}
+	if constexpr (Counters::enabled) {
+		if (_counters) {
+			_counters->wrote(1);
+		}
+	}
+	auto ram = _writable_pages[address >> 8];
+	if (!ram) {
+		ram = write_page(address, value);
+		if (!ram) {
+			return;
+		}
+	}
+	ram[address & 0xFF] = value;
+	if (_decode_cache) {
+		_decode_cache->invalidate(address);
+	}
+	if (_jit) {
+		_jit->invalidate(address);
+	}
+}
+
+// Reads the little-endian word at address, wrapping from 0xFFFF to 0
+std::uint16_t Mem::read_word(const std::uint16_t address)
+{
+	const auto ram = _ram_pages[address >> 8];
+	const auto offset = address & 0xFF;
+	if (ram && offset != 0xFF) {
+		if constexpr (Counters::enabled) {
+			if (_counters) {
+				_counters->read(2);
+			}
+		}
+		return make_word(ram[offset], ram[offset + 1]);
+	}
+	// Crosses into the next page, or reads a device, a byte at a time
+	const auto low_byte = read(address);
+	return make_word(low_byte, read(address + 1));
+}
+
+// Writes the little-endian word at address, wrapping from 0xFFFF to 0
+void Mem::write_word(const std::uint16_t address, const std::uint16_t value)
+{
+	const auto ram = _writable_pages[address >> 8];
+	const auto offset = address & 0xFF;
+	// Crosses into the next page, or is not yet private, or writes a device,
+	// or is watched
+	if (!ram || offset == 0xFF) {
+		write(address, get_low_byte(value));
+		write(address + 1, get_high_byte(value));
+		return;
+	}
+	if (_trace) {
+		_trace->wrote(address, value, 2);
+	}
+	if constexpr (Counters::enabled) {
+		if (_counters) {
+			_counters->wrote(2);
+		}
+	}
+	ram[offset] = get_low_byte(value);
+	ram[offset + 1] = get_high_byte(value);
+	if (_decode_cache) {
+		_decode_cache->invalidate(address, 2);
+	}
+	if (_jit) {
+		_jit->invalidate(address);
+	}
+}
+
+// Reads count bytes from address on, at most a page's worth, in order
+void Mem::fetch(const std::uint16_t address, std::uint8_t *const bytes, const unsigned count)
+{
+	const auto ram = _ram_pages[address >> 8];
+	const auto offset = address & 0xFF;
+	if (ram && offset + count <= 0x100) {
+		std::memcpy(bytes, ram + offset, count);
+		return;
+	}
+	for (unsigned i = 0; i < count; ++i) {
+		bytes[i] = read_unwatched(address + i);
+	}
+}
+
+// Routes accesses to a range of pages to device. The RAM underneath stays
+// as it was, and comes back when the pages are unmapped. Not to be called
+// from translated code or a device access.
+void Mem::map(Device &device, const std::uint8_t first_page, const unsigned pages)
+{
+	if (pages == 0 || first_page + pages > _ram_pages.size()) {
+		throw std::out_of_range{"Mem::map() given pages outside the address space"};
+	}
+	for (unsigned page = first_page; page < first_page + pages; ++page) {
+		_devices[page] = &device;
+		update_page(page);
+	}
+	mapping_changed();
+}
+
+void Mem::unmap(const std::uint8_t first_page, const unsigned pages)
+{
+	if (pages == 0 || first_page + pages > _ram_pages.size()) {
+		throw std::out_of_range{"Mem::unmap() given pages outside the address space"};
+	}
+	for (unsigned page = first_page; page < first_page + pages; ++page) {
+		_devices[page] = nullptr;
+		update_page(page);
+	}
+	mapping_changed();
+}
+
+// Whether address is RAM rather than mapped to a device
+bool Mem::is_ram(const std::uint16_t address) const
+{
+	return !_devices[address >> 8];
+}
+
+// Whether reads of address come straight from RAM, neither a device nor
+// watched
+bool Mem::reads_ram(const std::uint16_t address) const
+{
+	return _ram_pages[address >> 8];
+}
+
+bool Mem::breaks_at(const std::uint16_t address) const
+{
+	return _breakpoints && _breakpoints->breaks_at(address);
+}
+
+// Whether the attached breakpoints have been hit and not resumed from
+bool Mem::stopped() const
+{
+	return _breakpoints && _breakpoints->stopped();
+}
+
+// The RAM behind a page, whether or not a device is mapped there
+const std::uint8_t * Mem::ram_page(const std::uint8_t page) const
+{
+	const auto private_page = _private_pages[page];
+	return private_page ? private_page : shared_page(page);
+}
+
+// Copies count bytes of RAM from address on, wrapping from 0xFFFF to 0, a
+// page at a time. As with ram_page(), devices and watchpoints are passed by.
+void Mem::read_block(std::uint16_t address, std::uint8_t *bytes, std::size_t count) const
+{
+	while (count > 0) {
+		const auto offset = address & 0xFF;
+		const auto size = std::min<std::size_t>(count, 0x100 - offset);
+		std::memcpy(bytes, ram_page(address >> 8) + offset, size);
+		address = static_cast<std::uint16_t>(address + size);
+		bytes += size;
+		count -= size;
+	}
+}
+
+// Copies count bytes into RAM from address on, wrapping from 0xFFFF to 0, a
+// page at a time. This is the host writing rather than the guest: devices,
+// watchpoints, the trace and counters do not see it, while decoded and
+// translated code over it is still made again.
+void Mem::write_block(std::uint16_t address, const std::uint8_t *bytes, std::size_t count)
+{
+	while (count > 0) {
+		const auto page = address >> 8;
+		const auto offset = address & 0xFF;
+		const auto size = std::min<std::size_t>(count, 0x100 - offset);
+		const auto ram = _private_pages[page] ? _private_pages[page] : make_private(page);
+		std::memcpy(ram + offset, bytes, size);
+		if (_decode_cache) {
+			_decode_cache->invalidate(address, size);
+		}
+		if (_jit) {
+			_jit->invalidate(address);
+		}
+		address = static_cast<std::uint16_t>(address + size);
+		bytes += size;
+		count -= size;
+	}
+}
+
+// Decoded and translated code may have read from pages that changed
+void Mem::mapping_changed()
+{
+	if (_decode_cache) {
+		_decode_cache->clear();
+	}
+	if (_jit) {
+		_jit->devices_changed();
+	}
+}
+
+void Mem::attach(Decode_cache *const decode_cache)
+{
+	_decode_cache = decode_cache;
+	if (_decode_cache) {
+		_decode_cache->clear();
+	}
+}
+
+void Mem::attach(Jit *const jit)
+{
+	_jit = jit;
+}
+
+// Has writes noted in the step being traced
+void Mem::attach(Trace *const trace)
+{
+	_trace = trace;
+}
+
+// Has reads and writes counted, by the byte
+void Mem::attach(Counters *const counters)
+{
+	_counters = counters;
+}
+
+// Has accesses to watched addresses stop the run, and breakpoints seen by
+// the CPU and Jit
+void Mem::attach(Breakpoints *const breakpoints)
+{
+	_breakpoints = breakpoints;
+	breakpoints_changed();
+}
+
+// Rereads which pages are watched, and has decoded and translated code
+// made again with the breakpoints as they are now
+void Mem::breakpoints_changed()
+{
+	for (unsigned page = 0; page < _ram_pages.size(); ++page) {
+		update_page(page);
+	}
+	mapping_changed();
+}
+
+// The RAM behind all pages, including those mapped to devices, in one
+// block. The first call gives every page a private copy in that block, so
+// it stops sharing pages.
+const std::uint8_t * Mem::contents()
+{
+	if (_flat) {
+		return _flat.get();
+	}
+	_flat.reset(new std::uint8_t[0x10000]);
+	for (unsigned page = 0; page < _ram_pages.size(); ++page) {
+		const auto copy = &_flat[page << 8];
+		std::memcpy(copy, ram_page(page), 0x100);
+		_private_pages[page] = copy;
+		update_page(page);
+	}
+	_copies.clear();
+	_copies_used = 0;
+	return _flat.get();
 }
 
 #endif // LVCPU_MEM_HPP_INCLUDED
@@ -0,0 +1,106 @@
+#include "opcode_profile.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+	// Keys are 19 bits wide, so a triple of them fits in one integer
+	constexpr unsigned key_bits = 19;
+	constexpr std::uint64_t key_mask = (std::uint64_t{1} << key_bits) - 1;
+	constexpr std::uint64_t pair_mask = (std::uint64_t{1} << 2 * key_bits) - 1;
+	constexpr std::uint64_t triple_mask = (std::uint64_t{1} << 3 * key_bits) - 1;
+
+	std::string format_key(const std::uint64_t key)
+	{
+		static const char digits[] = "0123456789ABCDEF";
+		const auto hex = [](const unsigned byte) {
+			return std::string{digits[byte >> 4], digits[byte & 0xF]};
+		};
+		auto result = hex(key >> 8 & 0xFF);
+		if (key >> 16 & 1) {
+			result += " " + hex(key & 0xFF);
+		}
+		const auto instructions = key >> 17;
+		if (instructions > 1) {
+			result += " (fused x" + std::to_string(instructions) + ")";
+		}
+		return result;
+	}
+
+	std::string format_sequence(std::uint64_t sequence, const unsigned length)
+	{
+		std::string result;
+		for (unsigned i = length; i-- > 0;) {
+			result += format_key(sequence >> i * key_bits & key_mask);
+			if (i > 0) {
+				result += " | ";
+			}
+		}
+		return result;
+	}
+
+	void report_top(
+		std::ostream                                           &out,
+		const char                                             *title,
+		const std::unordered_map<std::uint64_t, std::uint64_t> &counts,
+		const unsigned                                         length,
+		const std::size_t                                      top)
+	{
+		std::vector<std::pair<std::uint64_t, std::uint64_t>> sorted(
+			counts.begin(),
+			counts.end()
+		);
+		const auto shown = std::min(top, sorted.size());
+		std::partial_sort(
+			sorted.begin(),
+			sorted.begin() + shown,
+			sorted.end(),
+			[](const auto &lhs, const auto &rhs) {
+				return lhs.second > rhs.second
+					|| (lhs.second == rhs.second && lhs.first < rhs.first);
+			}
+		);
+		out << title << ":\n";
+		for (std::size_t i = 0; i < shown; ++i) {
+			out << std::setw(14) << sorted[i].second << "  ";
+			out << format_sequence(sorted[i].first, length) << "\n";
+		}
+	}
+}
+
+void Opcode_profile::record(const std::uint32_t key, const unsigned instructions)
+{
+	_instructions += instructions;
+	++_dispatches;
+	_history = (_history << key_bits | key) & triple_mask;
+	++_singles[key];
+	if (_history_length >= 1) {
+		++_pairs[_history & pair_mask];
+	}
+	if (_history_length >= 2) {
+		++_triples[_history];
+	} else {
+		++_history_length;
+	}
+}
+
+void Opcode_profile::report(std::ostream &out, const std::size_t top) const
+{
+	out << "opcode profile: " << _instructions << " instructions in ";
+	out << _dispatches << " dispatches";
+	if (_dispatches) {
+		const auto flags = out.flags();
+		const auto precision = out.precision(3);
+		out << " (" << std::fixed << static_cast<double>(_instructions) / _dispatches;
+		out << " per dispatch)";
+		out.flags(flags);
+		out.precision(precision);
+	}
+	out << "\n";
+	report_top(out, "top dispatches", _singles, 1, top);
+	report_top(out, "top pairs", _pairs, 2, top);
+	report_top(out, "top triples", _triples, 3, top);
+}
@@ -0,0 +1,48 @@
+#ifndef LVCPU_OPCODE_PROFILE_HPP_INCLUDED
+#define LVCPU_OPCODE_PROFILE_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+
+// Counts how often each dispatch, and each pair and triple of consecutive
+// dispatches, occurs. A dispatch is keyed by its op code, the parameter
+// byte for ops taking register parameters, and the number of instructions
+// it ran when it was a fused sequence.
+class Opcode_profile {
+	std::uint64_t _history = 0;
+	unsigned _history_length = 0;
+	std::uint64_t _instructions = 0;
+	std::uint64_t _dispatches = 0;
+	std::unordered_map<std::uint64_t, std::uint64_t> _singles;
+	std::unordered_map<std::uint64_t, std::uint64_t> _pairs;
+	std::unordered_map<std::uint64_t, std::uint64_t> _triples;
+
+public:
+	static constexpr std::uint32_t key(
+		std::uint8_t op_code,
+		std::uint8_t param,
+		bool         has_param,
+		unsigned     instructions
+	);
+
+	void record(std::uint32_t key, unsigned instructions);
+	void report(std::ostream &out, std::size_t top = 12) const;
+};
+
+constexpr std::uint32_t Opcode_profile::key(
+	const std::uint8_t op_code,
+	const std::uint8_t param,
+	const bool         has_param,
+	const unsigned     instructions
+)
+{
+	return
+		static_cast<std::uint32_t>(instructions) << 17
+		| static_cast<std::uint32_t>(has_param) << 16
+		| static_cast<std::uint32_t>(op_code) << 8
+		| (has_param ? param : 0u);
+}
+
+#endif // LVCPU_OPCODE_PROFILE_HPP_INCLUDED
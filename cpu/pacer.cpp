@@ -0,0 +1,167 @@
+#include "pacer.hpp"
+
+#include <cerrno>
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__linux__)
+	#include <time.h>
+#endif
+
+namespace {
+	// Once this far behind, lost time is given up instead of run in a burst
+	constexpr std::chrono::milliseconds max_catch_up{100};
+
+	void sleep_until(const Pacer::Clock::time_point deadline)
+	{
+#if defined(__linux__)
+		// steady_clock is CLOCK_MONOTONIC here, so its epoch can be used as is
+		const auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			deadline.time_since_epoch()
+		).count();
+		timespec time;
+		time.tv_sec = since_epoch / 1'000'000'000;
+		time.tv_nsec = since_epoch % 1'000'000'000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, nullptr) == EINTR) {
+		}
+#else
+		std::this_thread::sleep_until(deadline);
+#endif
+	}
+}
+
+Pacer::Pacer(const double rate, const unsigned quantum, const Mode mode) :
+	_rate(rate),
+	_quantum(quantum),
+	_mode(mode),
+	_start(Clock::now()),
+	_epoch(_start)
+{
+	if (rate <= 0) {
+		throw std::out_of_range{"CPU clock_rate given not positive"};
+	}
+	if (quantum == 0) {
+		throw std::out_of_range{"CPU pacing_quantum given not positive"};
+	}
+}
+
+void Pacer::pace()
+{
+	const auto cycles = _stage - _stage % _quantum;
+	_stage -= cycles;
+	_cycles += cycles;
+	if (_mode != Mode::paced) {
+		return;
+	}
+
+	_paced_cycles += cycles;
+	const auto deadline = _start + std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>{_paced_cycles / _rate}
+	);
+	const auto now = Clock::now();
+	const auto lag = now - deadline;
+	if (lag <= Clock::duration::zero()) {
+		++_lag_histogram[0];
+		_slept -= lag;
+		sleep_until(deadline);
+		return;
+	}
+
+	const auto lag_us = std::chrono::duration_cast<std::chrono::microseconds>(lag).count();
+	std::size_t bucket = 1;
+	while (bucket + 1 < _lag_histogram.size() && lag_us >= 1 << (bucket - 1)) {
+		++bucket;
+	}
+	++_lag_histogram[bucket];
+	_max_lag = std::max(_max_lag, lag);
+	if (lag > max_catch_up) {
+		_start = now;
+		_paced_cycles = 0;
+		++_resyncs;
+	}
+}
+
+// Takes back cycles ticked for work that was not done after all. Quanta
+// that have ended are not paced again, only counted as not having ended.
+void Pacer::refund(const unsigned cycles)
+{
+	if (cycles <= _stage) {
+		_stage -= cycles;
+		return;
+	}
+	const auto total = this->cycles() - cycles;
+	const auto ended = _cycles - (total - total % _quantum);
+	_stage = total % _quantum;
+	_cycles -= ended;
+	_paced_cycles -= std::min(_paced_cycles, ended);
+}
+
+// Continues from a total of cycles run before, as when a snapshot is
+// restored, keeping quanta where they would have ended and pacing from now
+void Pacer::restore(const std::uint64_t cycles)
+{
+	_stage = cycles % _quantum;
+	_cycles = cycles - _stage;
+	_paced_cycles = 0;
+	_start = Clock::now();
+}
+
+// Guest time since the start
+std::chrono::nanoseconds Pacer::time() const
+{
+	if (_mode == Mode::virtual_time) {
+		return std::chrono::nanoseconds{
+			static_cast<std::chrono::nanoseconds::rep>(cycles() * (1e9 / _rate))
+		};
+	}
+	return Clock::now() - _epoch;
+}
+
+// Host time since the start, less the time slept to keep to the clock rate
+Pacer::Clock::duration Pacer::running() const
+{
+	return Clock::now() - _epoch - _slept;
+}
+
+void Pacer::report(std::ostream &out) const
+{
+	const std::chrono::duration<double> elapsed = Clock::now() - _epoch;
+	const auto flags = out.flags();
+	const auto precision = out.precision(3);
+	out << std::fixed;
+	switch (_mode) {
+	case Mode::paced:
+		out << "pacing: target " << _rate << " Hz";
+		break;
+	case Mode::unthrottled:
+		out << "pacing: unthrottled";
+		break;
+	case Mode::virtual_time:
+		out << "pacing: virtual time at " << _rate << " Hz, ";
+		out << std::chrono::duration<double>{time()}.count() << " s of guest time";
+		break;
+	}
+	out << ", achieved " << cycles() / elapsed.count() << " Hz";
+	out << " over " << elapsed.count() << " s\n";
+	if (_mode == Mode::paced) {
+		out << "pacing lag at end of quantum (" << _quantum << " cycles):\n";
+		out << std::setw(14) << _lag_histogram[0] << "  on time\n";
+		for (std::size_t bucket = 1; bucket < _lag_histogram.size(); ++bucket) {
+			if (!_lag_histogram[bucket]) {
+				continue;
+			}
+			out << std::setw(14) << _lag_histogram[bucket] << "  ";
+			if (bucket + 1 == _lag_histogram.size()) {
+				out << ">= " << (1u << (bucket - 2)) << " us\n";
+			} else {
+				out << "< " << (1u << (bucket - 1)) << " us\n";
+			}
+		}
+		out << "max lag " << std::chrono::duration<double, std::micro>{_max_lag}.count();
+		out << " us, " << _resyncs << " resyncs\n";
+	}
+	out.flags(flags);
+	out.precision(precision);
+}
@@ -0,0 +1,83 @@
+#ifndef LVCPU_PACER_HPP_INCLUDED
+#define LVCPU_PACER_HPP_INCLUDED
+
+#include <cstdint>
+#include <chrono>
+#include <iostream>
+#include <array>
+
+// Keeps guest execution at the clock rate. Cycles run in quanta, and at the
+// end of each quantum the host thread sleeps until the wall-clock time that
+// quantum was due to end. Deadlines are computed from the total cycles run,
+// so rounding and oversleeping do not accumulate, and falling behind is made
+// up by not sleeping until caught up.
+//
+// Guest time normally follows the host clock. In virtual time it is the
+// cycles run divided by the clock rate, so it does not depend on the host
+// and runs as fast as the host allows.
+class Pacer {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	enum class Mode {
+		// Sleep to keep to the clock rate
+		paced,
+		// Run as fast as the host allows, on host time
+		unthrottled,
+		// Run as fast as the host allows, on time counted in cycles
+		virtual_time
+	};
+
+private:
+	double _rate;
+	unsigned _quantum;
+	Mode _mode;
+	unsigned _stage = 0;
+	// Cycles of finished quanta, counted from _start, which moves forward
+	// whenever pacing gives up catching up
+	std::uint64_t _paced_cycles = 0;
+	Clock::time_point _start;
+	std::uint64_t _cycles = 0;
+	Clock::time_point _epoch;
+	// Lag at the end of quanta, in buckets of powers of two microseconds,
+	// with the first bucket counting quanta that ended ahead of time
+	std::array<std::uint64_t, 24> _lag_histogram = {};
+	Clock::duration _max_lag = Clock::duration::zero();
+	std::uint64_t _resyncs = 0;
+	Clock::duration _slept = Clock::duration::zero();
+
+	void pace();
+
+public:
+	Pacer(double rate, unsigned quantum, Mode mode);
+	inline void              tick(unsigned cycles);
+	void                     refund(unsigned cycles);
+	inline unsigned          cycles_left() const;
+	inline std::uint64_t     cycles() const;
+	void                     restore(std::uint64_t cycles);
+	std::chrono::nanoseconds time() const;
+	Clock::duration          running() const;
+	void                     report(std::ostream &out) const;
+};
+
+void Pacer::tick(const unsigned cycles)
+{
+	_stage += cycles;
+	if (_stage >= _quantum) {
+		pace();
+	}
+}
+
+// Cycles until the end of the current quantum
+unsigned Pacer::cycles_left() const
+{
+	return _quantum - _stage;
+}
+
+// Total cycles run
+std::uint64_t Pacer::cycles() const
+{
+	return _cycles + _stage;
+}
+
+#endif // LVCPU_PACER_HPP_INCLUDED
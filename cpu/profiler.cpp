@@ -0,0 +1,139 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <set>
+#include <utility>
+
+namespace {
+	typedef std::map<std::string, std::uint64_t> Counts;
+
+	void report_top(
+		std::ostream        &out,
+		const char          *title,
+		const Counts        &counts,
+		const Counts        *const totals,
+		const std::uint64_t samples,
+		const std::size_t   top)
+	{
+		std::vector<std::pair<std::string, std::uint64_t>> sorted(counts.begin(), counts.end());
+		const auto shown = std::min(top, sorted.size());
+		std::partial_sort(
+			sorted.begin(),
+			sorted.begin() + shown,
+			sorted.end(),
+			[](const auto &lhs, const auto &rhs) {
+				return lhs.second > rhs.second
+					|| (lhs.second == rhs.second && lhs.first < rhs.first);
+			}
+		);
+		const auto percent = [&](const std::uint64_t count) {
+			return samples ? 100.0 * count / samples : 0.0;
+		};
+		out << title << ":\n";
+		for (std::size_t i = 0; i < shown; ++i) {
+			const auto &entry = sorted[i];
+			out << std::setw(14) << entry.second << std::setw(7) << percent(entry.second) << "%";
+			if (totals) {
+				const auto total = totals->at(entry.first);
+				out << std::setw(14) << total << std::setw(7) << percent(total) << "%";
+			}
+			out << "  " << entry.first << "\n";
+		}
+	}
+}
+
+Profiler::Profiler(std::shared_ptr<const Symbol_map> symbols) :
+	_symbols(symbols ? std::move(symbols) : std::make_shared<const Symbol_map>())
+{}
+
+// The routine ip is in, known by the label it is at. Without labels to go
+// by, the address itself.
+std::uint32_t Profiler::frame_at(const std::uint16_t ip) const
+{
+	if (const auto label = _symbols->label_at(ip)) {
+		return label->address;
+	}
+	return _symbols->empty() ? ip : unknown;
+}
+
+std::string Profiler::frame_name(const std::uint32_t frame) const
+{
+	if (frame == unknown) {
+		return "[unknown]";
+	}
+	if (frame & interrupt) {
+		char name[16];
+		std::snprintf(name, sizeof name, "[int %02X]", static_cast<unsigned>(frame & 0xFFu));
+		return name;
+	}
+	return _symbols->name(frame);
+}
+
+// Counts a sample at ip, in the routine on top of the stack. Within the
+// routine it is put under the label it is at, when that is not the one
+// called.
+void Profiler::sample(const std::uint16_t ip)
+{
+	++_samples;
+	++_ips[ip];
+	auto stack = _stack;
+	const auto frame = frame_at(ip);
+	if (stack.empty() || stack.back() != frame) {
+		stack.push_back(frame);
+	}
+	++_stacks[stack];
+}
+
+// Forgets the calls made so far, for when the guest starts over or is
+// restored
+void Profiler::clear_stack()
+{
+	_stack.clear();
+	_lost_depth = 0;
+}
+
+void Profiler::write_folded(std::ostream &out) const
+{
+	for (const auto &entry : _stacks) {
+		const auto &frames = entry.first;
+		for (std::size_t i = 0; i < frames.size(); ++i) {
+			out << (i ? ";" : "") << frame_name(frames[i]);
+		}
+		out << " " << entry.second << "\n";
+	}
+}
+
+// Reports samples by the label they were at, and with those in the
+// routines it called, then by source line when the map has lines
+void Profiler::report(std::ostream &out, const std::size_t top) const
+{
+	Counts self, total, lines;
+	for (const auto &entry : _ips) {
+		self[frame_name(frame_at(entry.first))] += entry.second;
+		if (const auto line = _symbols->line_at(entry.first)) {
+			lines[line->source] += entry.second;
+		}
+	}
+	for (const auto &entry : _stacks) {
+		std::set<std::string> names;
+		for (const auto frame : entry.first) {
+			names.insert(frame_name(frame));
+		}
+		for (const auto &name : names) {
+			total[name] += entry.second;
+		}
+	}
+
+	const auto flags = out.flags();
+	const auto precision = out.precision(1);
+	out << std::fixed;
+	out << "profile: " << _samples << " samples\n";
+	report_top(out, "top labels, self and total", self, &total, _samples, top);
+	if (!lines.empty()) {
+		report_top(out, "top lines", lines, nullptr, _samples, top);
+	}
+	out.flags(flags);
+	out.precision(precision);
+}
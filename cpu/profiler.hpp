@@ -0,0 +1,93 @@
+#ifndef LVCPU_PROFILER_HPP_INCLUDED
+#define LVCPU_PROFILER_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "symbol_map.hpp"
+
+// Samples where the guest is, every so many cycles, along with a shadow call
+// stack kept from CALL, RET, interrupt entry and IRET. Guests do not have
+// to keep to any calling convention: a RET with no CALL to return from is
+// ignored, and IRET drops whatever calls the handler did not return from.
+//
+// Samples are reported as folded stacks, a line of frames from the
+// outermost, separated by semicolons, and a count, for flame graph tools,
+// and as hot spots by label and by source line.
+class Profiler {
+	// A frame is the address called, an interrupt code with interrupt set,
+	// or unknown for code before any label
+	static constexpr std::uint32_t interrupt = 0x10000;
+	static constexpr std::uint32_t unknown = 0x20000;
+	static constexpr std::size_t max_depth = 256;
+
+	std::shared_ptr<const Symbol_map> _symbols;
+	std::vector<std::uint32_t> _stack;
+	// Calls made past max_depth, not kept on the stack
+	std::size_t _lost_depth = 0;
+	std::uint64_t _samples = 0;
+	// Samples by stack, innermost frame last, and by IP
+	std::map<std::vector<std::uint32_t>, std::uint64_t> _stacks;
+	std::unordered_map<std::uint16_t, std::uint64_t> _ips;
+
+	std::uint32_t frame_at(std::uint16_t ip) const;
+	std::string   frame_name(std::uint32_t frame) const;
+
+public:
+	explicit    Profiler(std::shared_ptr<const Symbol_map> symbols);
+	inline void called(std::uint16_t address);
+	inline void returned();
+	inline void interrupted(std::uint8_t interrupt_code);
+	inline void returned_from_interrupt();
+	void        sample(std::uint16_t ip);
+	void        clear_stack();
+	void        write_folded(std::ostream &out) const;
+	void        report(std::ostream &out, std::size_t top = 12) const;
+};
+
+void Profiler::called(const std::uint16_t address)
+{
+	if (_stack.size() == max_depth) {
+		++_lost_depth;
+		return;
+	}
+	_stack.push_back(address);
+}
+
+void Profiler::returned()
+{
+	if (_lost_depth) {
+		--_lost_depth;
+	} else if (!_stack.empty() && !(_stack.back() & interrupt)) {
+		_stack.pop_back();
+	}
+}
+
+void Profiler::interrupted(const std::uint8_t interrupt_code)
+{
+	if (_stack.size() == max_depth) {
+		// Interrupts have to be found again by IRET, so make room
+		_stack.pop_back();
+	}
+	_lost_depth = 0;
+	_stack.push_back(interrupt | interrupt_code);
+}
+
+void Profiler::returned_from_interrupt()
+{
+	for (auto i = _stack.size(); i-- > 0;) {
+		if (_stack[i] & interrupt) {
+			_stack.resize(i);
+			_lost_depth = 0;
+			return;
+		}
+	}
+}
+
+#endif // LVCPU_PROFILER_HPP_INCLUDED
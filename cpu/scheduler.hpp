@@ -0,0 +1,94 @@
+#ifndef LVCPU_SCHEDULER_HPP_INCLUDED
+#define LVCPU_SCHEDULER_HPP_INCLUDED
+
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+// Events due at a cycle count, kept in a heap so that the earliest deadline
+// is always at hand. Each event has a small integer id, and scheduling an id
+// again replaces its pending event.
+class Scheduler {
+public:
+	static constexpr std::uint64_t never = ~std::uint64_t{0};
+
+	struct Event {
+		std::uint64_t deadline;
+		unsigned      id;
+	};
+
+private:
+	struct Entry {
+		Event         event;
+		std::uint64_t generation;
+	};
+
+	// Replaced and cancelled entries stay in the heap until they reach the
+	// top, and are told apart by their generation being out of date
+	std::vector<Entry> _heap;
+	std::vector<std::uint64_t> _generations;
+
+	static inline bool later(const Entry &lhs, const Entry &rhs);
+	inline void        drop_stale();
+
+public:
+	inline void          schedule(unsigned id, std::uint64_t deadline);
+	inline void          cancel(unsigned id);
+	inline std::uint64_t next_deadline() const;
+	inline bool          pop_due(std::uint64_t now, Event &event);
+};
+
+bool Scheduler::later(const Entry &lhs, const Entry &rhs)
+{
+	if (lhs.event.deadline != rhs.event.deadline) {
+		return lhs.event.deadline > rhs.event.deadline;
+	}
+	return lhs.event.id > rhs.event.id;
+}
+
+void Scheduler::drop_stale()
+{
+	while (!_heap.empty() && _heap.front().generation != _generations[_heap.front().event.id]) {
+		std::pop_heap(_heap.begin(), _heap.end(), later);
+		_heap.pop_back();
+	}
+}
+
+void Scheduler::schedule(const unsigned id, const std::uint64_t deadline)
+{
+	if (id >= _generations.size()) {
+		_generations.resize(id + 1);
+	}
+	_heap.push_back(Entry{Event{deadline, id}, ++_generations[id]});
+	std::push_heap(_heap.begin(), _heap.end(), later);
+	drop_stale();
+}
+
+void Scheduler::cancel(const unsigned id)
+{
+	if (id < _generations.size()) {
+		++_generations[id];
+		drop_stale();
+	}
+}
+
+std::uint64_t Scheduler::next_deadline() const
+{
+	return _heap.empty() ? never : _heap.front().event.deadline;
+}
+
+// Takes the earliest event if it is due by now
+bool Scheduler::pop_due(const std::uint64_t now, Event &event)
+{
+	if (_heap.empty() || _heap.front().event.deadline > now) {
+		return false;
+	}
+	event = _heap.front().event;
+	++_generations[event.id];
+	std::pop_heap(_heap.begin(), _heap.end(), later);
+	_heap.pop_back();
+	drop_stale();
+	return true;
+}
+
+#endif // LVCPU_SCHEDULER_HPP_INCLUDED
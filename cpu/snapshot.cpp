@@ -0,0 +1,102 @@
+#include "snapshot.hpp"
+#include "mapped_file.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace {
+	struct Header {
+		char          magic[4];
+		std::uint32_t version;
+		std::uint32_t byte_order;
+		std::uint32_t state_size;
+	};
+
+	constexpr Header current_header = {
+		{'L', 'V', 'S', 'S'},
+		2,
+		0x01020304,
+		sizeof(CPU::State)
+	};
+
+	static_assert(std::is_trivially_copyable<CPU::State>::value, "CPU::State is copied as bytes");
+	static_assert(sizeof(CPU::State) == 112, "CPU::State has implicit padding");
+
+	constexpr std::size_t state_offset = sizeof(Header);
+	constexpr std::size_t memory_offset = state_offset + sizeof(CPU::State);
+	constexpr std::size_t file_size = memory_offset + 0x10000;
+}
+
+Snapshot::Snapshot(CPU &cpu, const Mem &mem) :
+	_state(cpu.save())
+{
+	std::vector<Image::Segment> pages;
+	for (unsigned page = 0; page < 0x100; ++page) {
+		pages.push_back(Image::Segment{
+			static_cast<std::uint16_t>(page << 8),
+			mem.ram_page(page),
+			0x100
+		});
+	}
+	_image = std::make_shared<const Image>(pages);
+}
+
+// Reads a snapshot file, throwing std::runtime_error if it is not one this
+// build can restore
+Snapshot::Snapshot(const std::string &path)
+{
+	const Mapped_file file{path};
+	if (!file.is_open()) {
+		throw std::runtime_error{"Could not open snapshot " + path};
+	}
+	Header header;
+	if (file.size() < sizeof header) {
+		throw std::runtime_error{"Snapshot " + path + " truncated"};
+	}
+	std::memcpy(&header, file.data(), sizeof header);
+	if (std::memcmp(header.magic, current_header.magic, sizeof header.magic) != 0) {
+		throw std::runtime_error{path + " is not a snapshot"};
+	}
+	if (
+		header.version != current_header.version
+		|| header.byte_order != current_header.byte_order
+		|| header.state_size != current_header.state_size
+	) {
+		throw std::runtime_error{"Snapshot " + path + " made by an incompatible build"};
+	}
+	if (file.size() != file_size) {
+		throw std::runtime_error{"Snapshot " + path + " has the wrong size"};
+	}
+	std::memcpy(&_state, file.data() + state_offset, sizeof _state);
+	_image = std::make_shared<const Image>(std::vector<Image::Segment>{
+		Image::Segment{0, file.data() + memory_offset, 0x10000}
+	});
+}
+
+void Snapshot::write(const std::string &path) const
+{
+	std::ofstream file{path, std::ios::binary};
+	file.write(reinterpret_cast<const char *>(&current_header), sizeof current_header);
+	file.write(reinterpret_cast<const char *>(&_state), sizeof _state);
+	for (unsigned page = 0; page < 0x100; ++page) {
+		file.write(reinterpret_cast<const char *>(_image->page(page)), 0x100);
+	}
+	file.close();
+	if (!file) {
+		throw std::runtime_error{"Could not write snapshot " + path};
+	}
+}
+
+const CPU::State & Snapshot::state() const
+{
+	return _state;
+}
+
+const std::shared_ptr<const Image> & Snapshot::image() const
+{
+	return _image;
+}
@@ -0,0 +1,34 @@
+#ifndef LVCPU_SNAPSHOT_HPP_INCLUDED
+#define LVCPU_SNAPSHOT_HPP_INCLUDED
+
+#include <memory>
+#include <string>
+
+#include "cpu.hpp"
+#include "image.hpp"
+#include "mem.hpp"
+
+// A machine saved between two steps, to start runs from instead of booting.
+// Its memory is an image, so that any number of Mems restored from it share
+// their pages until they write to them.
+//
+// Snapshot files are a 16-byte header, the CPU state and the 64 KiB of RAM,
+// in host byte order:
+//
+//   0   4  magic "LVSS"
+//   4   4  version, 2
+//   8   4  0x01020304, to tell the byte order
+//   12  4  size of the CPU state
+class Snapshot {
+	CPU::State _state;
+	std::shared_ptr<const Image> _image;
+
+public:
+	Snapshot(CPU &cpu, const Mem &mem);
+	explicit Snapshot(const std::string &path);
+	void                                 write(const std::string &path) const;
+	const CPU::State &                   state() const;
+	const std::shared_ptr<const Image> & image() const;
+};
+
+#endif // LVCPU_SNAPSHOT_HPP_INCLUDED
@@ -0,0 +1,109 @@
+#include "symbol_map.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+Symbol_map::Symbol_map(const std::string &path)
+{
+	std::ifstream in{path};
+	if (!in) {
+		throw std::runtime_error{"Could not open symbol map " + path};
+	}
+	std::string text;
+	for (unsigned number = 1; std::getline(in, text); ++number) {
+		if (text.empty()) {
+			continue;
+		}
+		std::istringstream fields{text};
+		std::string kind;
+		unsigned address = 0, size = 0;
+		fields >> kind >> std::hex >> address;
+		bool valid = !fields.fail() && address <= 0xFFFF;
+		if (valid && kind == "label") {
+			Label label{static_cast<std::uint16_t>(address), {}};
+			valid = static_cast<bool>(fields >> label.name);
+			_labels.push_back(std::move(label));
+		} else if (valid && kind == "line") {
+			Line line{static_cast<std::uint16_t>(address), 0, {}};
+			fields >> size >> std::ws;
+			valid = !fields.fail() && size <= 0xFFFF && std::getline(fields, line.source);
+			line.size = size;
+			_lines.push_back(std::move(line));
+		} else {
+			valid = false;
+		}
+		if (!valid) {
+			throw std::runtime_error{"Symbol map " + path + " bad at line " + std::to_string(number)};
+		}
+	}
+	// Of labels at the same address, the first in the map names it
+	std::stable_sort(_labels.begin(), _labels.end(), [](const Label &lhs, const Label &rhs) {
+		return lhs.address < rhs.address;
+	});
+	std::stable_sort(_lines.begin(), _lines.end(), [](const Line &lhs, const Line &rhs) {
+		return lhs.address < rhs.address;
+	});
+}
+
+bool Symbol_map::empty() const
+{
+	return _labels.empty() && _lines.empty();
+}
+
+// The label at or most closely before address, or null if none is
+const Symbol_map::Label * Symbol_map::label_at(const std::uint16_t address) const
+{
+	auto after = std::upper_bound(_labels.begin(), _labels.end(), address,
+		[](const std::uint16_t value, const Label &label) {
+			return value < label.address;
+		});
+	if (after == _labels.begin()) {
+		return nullptr;
+	}
+	const auto address_found = std::prev(after)->address;
+	return &*std::lower_bound(_labels.begin(), after, address_found,
+		[](const Label &label, const std::uint16_t value) {
+			return label.address < value;
+		});
+}
+
+// The line of the instruction taking up address, or null if none does
+const Symbol_map::Line * Symbol_map::line_at(const std::uint16_t address) const
+{
+	auto after = std::upper_bound(_lines.begin(), _lines.end(), address,
+		[](const std::uint16_t value, const Line &line) {
+			return value < line.address;
+		});
+	if (after == _lines.begin()) {
+		return nullptr;
+	}
+	const auto &line = *std::prev(after);
+	return address - line.address < line.size ? &line : nullptr;
+}
+
+// The label with the name, or null if there is none
+const Symbol_map::Label * Symbol_map::find(const std::string &name) const
+{
+	for (const auto &label : _labels) {
+		if (label.name == name) {
+			return &label;
+		}
+	}
+	return nullptr;
+}
+
+// The label at or before address, or else the address in hex
+std::string Symbol_map::name(const std::uint16_t address) const
+{
+	if (const auto label = label_at(address)) {
+		return label->name;
+	}
+	char hex[8];
+	std::snprintf(hex, sizeof hex, "%04X", address);
+	return hex;
+}
@@ -0,0 +1,42 @@
+#ifndef LVCPU_SYMBOL_MAP_HPP_INCLUDED
+#define LVCPU_SYMBOL_MAP_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Labels and the source line of each instruction, by address, as written by
+// the assembler's --map option. Map files are text with a line per label
+// and a line per instruction, addresses and sizes in hex:
+//
+//   label <address> <name>
+//   line <address> <size> <file>:<line>
+class Symbol_map {
+public:
+	struct Label {
+		std::uint16_t address;
+		std::string   name;
+	};
+
+	struct Line {
+		std::uint16_t address;
+		std::uint16_t size;
+		std::string   source;
+	};
+
+private:
+	std::vector<Label> _labels;
+	std::vector<Line> _lines;
+
+public:
+	// An empty map, which names addresses by their value
+	Symbol_map() = default;
+	explicit      Symbol_map(const std::string &path);
+	bool          empty() const;
+	const Label * label_at(std::uint16_t address) const;
+	const Line *  line_at(std::uint16_t address) const;
+	const Label * find(const std::string &name) const;
+	std::string   name(std::uint16_t address) const;
+};
+
+#endif // LVCPU_SYMBOL_MAP_HPP_INCLUDED
@@ -0,0 +1,74 @@
+#ifndef LVCPU_TIMER_HPP_INCLUDED
+#define LVCPU_TIMER_HPP_INCLUDED
+
+#include <cstdint>
+#include <stdexcept>
+
+// A hardware timer, raising its interrupt once period cycles after it
+// starts, or every period cycles.
+class Timer {
+public:
+	struct Settings {
+		std::uint8_t  interrupt_code = 0x10;
+		std::uint64_t period = 0;
+		bool          periodic = true;
+	};
+
+private:
+	Settings _settings;
+
+public:
+	inline explicit      Timer(const Settings &settings);
+	inline std::uint8_t  interrupt_code() const;
+	inline std::uint64_t period() const;
+	inline bool          periodic() const;
+};
+
+Timer::Timer(const Settings &settings) :
+	_settings(settings)
+{
+	if (settings.interrupt_code < 0x10 || settings.interrupt_code > 0x3F) {
+		throw std::out_of_range{"Timer interrupt_code not a hardware interrupt"};
+	}
+	if (settings.period == 0) {
+		throw std::out_of_range{"Timer period given not positive"};
+	}
+}
+
+std::uint8_t Timer::interrupt_code() const
+{
+	return _settings.interrupt_code;
+}
+
+std::uint64_t Timer::period() const
+{
+	return _settings.period;
+}
+
+bool Timer::periodic() const
+{
+	return _settings.periodic;
+}
+
+// A timer the guest programs through a Timer_port, as the CPU keeps it.
+// It only runs given a period and a hardware interrupt code.
+struct Port_timer {
+	// Timers the CPU keeps for the guest
+	static constexpr unsigned count = 4;
+
+	std::uint32_t period = 0;
+	std::uint8_t  interrupt_code = 0;
+	bool          periodic = false;
+	bool          running = false;
+};
+
+inline bool operator == (const Port_timer &lhs, const Port_timer &rhs)
+{
+	return
+		lhs.period == rhs.period
+		&& lhs.interrupt_code == rhs.interrupt_code
+		&& lhs.periodic == rhs.periodic
+		&& lhs.running == rhs.running;
+}
+
+#endif // LVCPU_TIMER_HPP_INCLUDED
@@ -0,0 +1,85 @@
+#ifndef LVCPU_TIMER_PORT_HPP_INCLUDED
+#define LVCPU_TIMER_PORT_HPP_INCLUDED
+
+#include <cstdint>
+
+#include "cpu.hpp"
+#include "device.hpp"
+
+// The CPU's timers for the guest to program, as a device. Timer n of the
+// four has 8 bytes of registers at offset 8*n of a page:
+//   0-3  period in cycles, least significant byte first
+//   4    interrupt code, 0x10 to 0x3F
+//   5    control, bit 0 enable and bit 1 periodic
+//   6-7  read as 0
+// Reads past offset 31 are 0, and writes there are ignored.
+//
+// Setting enable starts the timer, raising its interrupt period cycles on,
+// and then every period cycles if periodic. Enable reads as set while the
+// timer runs: it clears once a timer that is not periodic fires, and is not
+// set at all without a period and a hardware interrupt code. Any write to a
+// running timer's registers starts it over from then, so clear enable first
+// to change more than one byte.
+class Timer_port final : public Device {
+	CPU *_cpu;
+
+public:
+	// Control register bits
+	static constexpr std::uint8_t enable = 0x01;
+	static constexpr std::uint8_t periodic = 0x02;
+
+	inline explicit     Timer_port(CPU &cpu);
+	inline std::uint8_t read(std::uint16_t address) override;
+	inline void         write(std::uint16_t address, std::uint8_t value) override;
+};
+
+Timer_port::Timer_port(CPU &cpu) :
+	_cpu(&cpu)
+{}
+
+std::uint8_t Timer_port::read(const std::uint16_t address)
+{
+	const auto index = (address & 0xFFu) / 8;
+	const auto offset = address & 7u;
+	if (index >= Port_timer::count) {
+		return 0;
+	}
+	const auto &timer = _cpu->port_timer(index);
+	switch (offset) {
+	case 0: case 1: case 2: case 3:
+		return static_cast<std::uint8_t>(timer.period >> 8 * offset);
+	case 4:
+		return timer.interrupt_code;
+	case 5:
+		return (timer.running ? enable : 0) | (timer.periodic ? periodic : 0);
+	}
+	return 0;
+}
+
+void Timer_port::write(const std::uint16_t address, const std::uint8_t value)
+{
+	const auto index = (address & 0xFFu) / 8;
+	const auto offset = address & 7u;
+	if (index >= Port_timer::count) {
+		return;
+	}
+	auto timer = _cpu->port_timer(index);
+	switch (offset) {
+	case 0: case 1: case 2: case 3:
+		timer.period &= ~(std::uint32_t{0xFF} << 8 * offset);
+		timer.period |= std::uint32_t{value} << 8 * offset;
+		break;
+	case 4:
+		timer.interrupt_code = value;
+		break;
+	case 5:
+		timer.running = value & enable;
+		timer.periodic = value & periodic;
+		break;
+	default:
+		return;
+	}
+	_cpu->set_port_timer(index, timer);
+}
+
+#endif // LVCPU_TIMER_PORT_HPP_INCLUDED
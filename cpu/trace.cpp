@@ -0,0 +1,44 @@
+#include "trace.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<Trace::Record>::value, "Trace::Record is copied as bytes");
+static_assert(sizeof(Trace::Record) == 32, "Trace::Record has implicit padding");
+static_assert(sizeof(Trace::Header) == 24, "Trace::Header has implicit padding");
+
+const Trace::Header Trace::current_header = {
+	{'L', 'V', 'T', 'R', 'A', 'C', 'E', '\0'},
+	0x01020304,
+	sizeof(Record),
+	0,
+	0
+};
+
+Trace::Trace(const std::size_t records)
+{
+	std::size_t size = 1;
+	while (size < records) {
+		size <<= 1;
+	}
+	_records.resize(size);
+	_mask = size - 1;
+}
+
+void Trace::write(const std::string &path, const Reason reason) const
+{
+	auto header = current_header;
+	header.reason = reason;
+	header.records = _next;
+	std::ofstream file{path, std::ios::binary};
+	file.write(reinterpret_cast<const char *>(&header), sizeof header);
+	const auto kept = std::min<std::uint64_t>(_next, _records.size());
+	for (auto i = _next - kept; i < _next; ++i) {
+		file.write(reinterpret_cast<const char *>(&_records[i & _mask]), sizeof(Record));
+	}
+	file.close();
+	if (!file) {
+		throw std::runtime_error{"Could not write trace " + path};
+	}
+}
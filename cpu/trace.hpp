@@ -0,0 +1,204 @@
+#ifndef LVCPU_TRACE_HPP_INCLUDED
+#define LVCPU_TRACE_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The last steps the CPU ran, kept as fixed-size binary records in a ring,
+// to be written out when the run stops, faults or is signalled, and read
+// back by lvtrace. Recording a step costs a few stores, so tracing can stay
+// on for whole runs.
+//
+// Trace files are a 24-byte header and the records kept, oldest first, in
+// host byte order:
+//
+//   0   8  magic "LVTRACE\0"
+//   8   4  0x01020304, to tell the byte order
+//   12  2  size of a record
+//   14  2  why it was written, a Reason
+//   16  8  records made in all, of which the file has the last ones
+class Trace {
+public:
+	enum Kind : std::uint8_t {
+		// An instruction, or fused sequence, run by the interpreter
+		instruction,
+		// Instructions run by translated code, their count in bytes
+		block,
+		// A hardware or clock interrupt raised between instructions
+		interrupt
+	};
+
+	// Bits of Record::flags
+	enum : std::uint8_t {
+		// Raised an interrupt, its code in Record::interrupt
+		raised = 0x01,
+		// Raised one while handling two, powering off
+		double_fault = 0x02
+	};
+
+	enum Reason : std::uint16_t {
+		stop,
+		signal
+	};
+
+	// Registers are as the step left them. Which of them it changed is told
+	// from the record before, when reading the trace.
+	struct Record {
+		std::uint64_t cycles;
+		std::uint16_t ip;
+		Kind          kind;
+		std::uint8_t  bytes[3];
+		std::uint16_t a, c, sp, bp;
+		std::uint8_t  f;
+		std::uint8_t  flags;
+		std::uint8_t  interrupt;
+		// Bytes written to memory, 0, 1 or 2
+		std::uint8_t  write_size;
+		std::uint16_t write_address;
+		std::uint16_t write_value;
+		std::uint8_t  reserved[2];
+	};
+
+	struct Header {
+		char          magic[8];
+		std::uint32_t byte_order;
+		std::uint16_t record_size;
+		std::uint16_t reason;
+		std::uint64_t records;
+	};
+
+	static const Header current_header;
+
+private:
+	std::vector<Record> _records;
+	std::size_t _mask;
+	std::uint64_t _next = 0;
+	// Whether the record at _next is being made, by a step
+	bool _open = false;
+
+	inline Record & current();
+	inline void     finish(std::uint16_t a, std::uint16_t c, std::uint16_t sp, std::uint16_t bp, std::uint8_t f);
+
+public:
+	// Keeps the last records, rounded up to a power of two
+	explicit Trace(std::size_t records);
+	inline void begin(Kind kind, std::uint64_t cycles, std::uint16_t ip, const std::uint8_t *bytes);
+	inline void end(std::uint16_t a, std::uint16_t c, std::uint16_t sp, std::uint16_t bp, std::uint8_t f);
+	inline void wrote(std::uint16_t address, std::uint16_t value, unsigned size);
+	inline void raised_interrupt(
+		std::uint64_t cycles,
+		std::uint8_t  code,
+		bool          double_fault,
+		std::uint16_t ip,
+		std::uint16_t a,
+		std::uint16_t c,
+		std::uint16_t sp,
+		std::uint16_t bp,
+		std::uint8_t  f
+	);
+	void write(const std::string &path, Reason reason) const;
+};
+
+Trace::Record & Trace::current()
+{
+	return _records[_next & _mask];
+}
+
+void Trace::finish(
+	const std::uint16_t a,
+	const std::uint16_t c,
+	const std::uint16_t sp,
+	const std::uint16_t bp,
+	const std::uint8_t  f)
+{
+	auto &record = current();
+	record.a = a;
+	record.c = c;
+	record.sp = sp;
+	record.bp = bp;
+	record.f = f;
+	++_next;
+}
+
+// Starts the record of a step at ip, with the op code and operand bytes
+// there, or for a block the count of instructions it ran
+void Trace::begin(
+	const Kind          kind,
+	const std::uint64_t cycles,
+	const std::uint16_t ip,
+	const std::uint8_t  *const bytes)
+{
+	auto &record = current();
+	record.cycles = cycles;
+	record.ip = ip;
+	record.kind = kind;
+	record.bytes[0] = bytes[0];
+	record.bytes[1] = bytes[1];
+	record.bytes[2] = bytes[2];
+	record.flags = 0;
+	record.interrupt = 0;
+	record.write_size = 0;
+	_open = true;
+}
+
+void Trace::end(
+	const std::uint16_t a,
+	const std::uint16_t c,
+	const std::uint16_t sp,
+	const std::uint16_t bp,
+	const std::uint8_t  f)
+{
+	_open = false;
+	finish(a, c, sp, bp, f);
+}
+
+// Notes a write to memory in the step's record. A word written a byte at a
+// time, across pages, is noted as one.
+void Trace::wrote(const std::uint16_t address, const std::uint16_t value, const unsigned size)
+{
+	if (!_open) {
+		return;
+	}
+	auto &record = current();
+	if (record.write_size == 1 && size == 1 && address == static_cast<std::uint16_t>(record.write_address + 1)) {
+		record.write_value |= value << 8;
+		record.write_size = 2;
+		return;
+	}
+	record.write_address = address;
+	record.write_value = value;
+	record.write_size = size;
+}
+
+// Notes an interrupt in the step raising it, or in a record of its own if
+// raised between steps. The registers are those at the handler, which
+// starts at ip.
+void Trace::raised_interrupt(
+	const std::uint64_t cycles,
+	const std::uint8_t  code,
+	const bool          double_fault,
+	const std::uint16_t ip,
+	const std::uint16_t a,
+	const std::uint16_t c,
+	const std::uint16_t sp,
+	const std::uint16_t bp,
+	const std::uint8_t  f)
+{
+	if (_open) {
+		auto &record = current();
+		record.flags |= raised | (double_fault ? Trace::double_fault : 0);
+		record.interrupt = code;
+		return;
+	}
+	const std::uint8_t no_bytes[3] = {};
+	begin(interrupt, cycles, ip, no_bytes);
+	auto &record = current();
+	record.flags = raised | (double_fault ? Trace::double_fault : 0);
+	record.interrupt = code;
+	_open = false;
+	finish(a, c, sp, bp, f);
+}
+
+#endif // LVCPU_TRACE_HPP_INCLUDED
@@ -0,0 +1,69 @@
+#include "work_pool.hpp"
+
+#include <algorithm>
+#include <thread>
+
+// Sized to the host's cores if threads is 0
+Work_pool::Work_pool(const unsigned threads) :
+	_threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency()))
+{}
+
+unsigned Work_pool::threads() const
+{
+	return _threads;
+}
+
+bool Work_pool::take(std::vector<Queue> &queues, const unsigned worker, std::size_t &job)
+{
+	{
+		auto &own = queues[worker];
+		const std::lock_guard<std::mutex> lock{own.mutex};
+		if (!own.jobs.empty()) {
+			job = own.jobs.front();
+			own.jobs.pop_front();
+			return true;
+		}
+	}
+	// No jobs are added once running, so when every deque has been found
+	// empty there is nothing left to take
+	for (std::size_t i = 1; i < queues.size(); ++i) {
+		auto &victim = queues[(worker + i) % queues.size()];
+		const std::lock_guard<std::mutex> lock{victim.mutex};
+		if (!victim.jobs.empty()) {
+			job = victim.jobs.back();
+			victim.jobs.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+// Runs job for each of 0 to count - 1, returning once all have run. The
+// calling thread is worker 0. Jobs must not throw.
+void Work_pool::run(const std::size_t count, const Job &job)
+{
+	const auto workers = static_cast<unsigned>(std::min<std::size_t>(_threads, std::max<std::size_t>(count, 1)));
+	std::vector<Queue> queues(workers);
+	for (unsigned worker = 0; worker < workers; ++worker) {
+		const auto first = count * worker / workers;
+		const auto last = count * (worker + 1) / workers;
+		for (auto i = first; i < last; ++i) {
+			queues[worker].jobs.push_back(i);
+		}
+	}
+
+	const auto work = [&](const unsigned worker) {
+		std::size_t next;
+		while (take(queues, worker, next)) {
+			job(worker, next);
+		}
+	};
+	std::vector<std::thread> threads;
+	for (unsigned worker = 1; worker < workers; ++worker) {
+		threads.emplace_back(work, worker);
+	}
+	work(0);
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
@@ -0,0 +1,34 @@
+#ifndef LVCPU_WORK_POOL_HPP_INCLUDED
+#define LVCPU_WORK_POOL_HPP_INCLUDED
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Runs numbered jobs on a fixed number of threads. Jobs are dealt out in
+// contiguous runs, one deque per thread. Each thread takes jobs from the
+// front of its own deque, and once that is empty, steals from the back of
+// the others', so threads that draw short jobs help out the rest.
+class Work_pool {
+public:
+	typedef std::function<void(unsigned worker, std::size_t job)> Job;
+
+private:
+	struct Queue {
+		std::mutex              mutex;
+		std::deque<std::size_t> jobs;
+	};
+
+	unsigned _threads;
+
+	static bool take(std::vector<Queue> &queues, unsigned worker, std::size_t &job);
+
+public:
+	explicit Work_pool(unsigned threads = 0);
+	unsigned threads() const;
+	void     run(std::size_t count, const Job &job);
+};
+
+#endif // LVCPU_WORK_POOL_HPP_INCLUDED